@@ -11,14 +11,11 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 TARGET = RcardClient
 TEMPLATE = app
 
+include(core.pri)
 
 SOURCES += main.cpp\
-        mainwindow.cpp \
-    frame.cpp \
-    memcard.cpp
+        mainwindow.cpp
 
-HEADERS  += mainwindow.h \
-    frame.h \
-    memcard.h
+HEADERS  += mainwindow.h
 
 FORMS    += mainwindow.ui
@@ -0,0 +1,67 @@
+#include "carddirectory.h"
+
+CardDirectory::CardDirectory() :
+    valid_(false)
+{
+    for (int b = 0; b < BLOCKS; ++b)
+        free_[b] = false;
+}
+
+// true once the header and all entries are in card
+bool CardDirectory::isRead(MemCard *card)
+{
+    for (int i = 0; i < DIR_FRAMES; ++i)
+        if ( !card->hasFrameAtAddr(i * Frame::SIZE) )
+            return false;
+    return true;
+}
+
+/* Find the free blocks. Without the "MC" header this is not a formatted
+ * card, nothing is taken as free then.
+ */
+bool CardDirectory::parse(MemCard *card)
+{
+    QByteArray d = card->data();
+    const char *p = d.constData();
+
+    valid_ = false;
+    for (int b = 0; b < BLOCKS; ++b)
+        free_[b] = false;
+    if ( !isRead(card) || p[0] != 'M' || p[1] != 'C' )
+        return false;
+
+    for (int b = 1; b < BLOCKS; ++b){
+        const char *e = p + b * Frame::SIZE;
+        bool intact = Frame::xorBytes((const uint8_t *)e, Frame::SIZE - 1)
+                == (uint8_t)e[Frame::SIZE - 1];
+        free_[b] = intact && (quint8)e[0] == STATE_FREE;
+    }
+    valid_ = true;
+    return true;
+}
+
+bool CardDirectory::isValid() const
+{
+    return valid_;
+}
+
+bool CardDirectory::isFree(int block) const
+{
+    return block > 0 && block < BLOCKS && free_[block];
+}
+
+int CardDirectory::usedBlocks() const
+{
+    int n = 0;
+    for (int b = 1; b < BLOCKS; ++b)
+        if ( !free_[b] )
+            ++n;
+    return n;
+}
+
+// what a free block holds on a freshly formatted card
+Frame CardDirectory::emptyFrame(int block, int frame)
+{
+    static const char zeroes[Frame::SIZE] = { 0 };
+    return Frame(block, frame, zeroes, Frame::SIZE);
+}
@@ -0,0 +1,42 @@
+#ifndef CARDDIRECTORY_H
+#define CARDDIRECTORY_H
+
+#include <QByteArray>
+
+#include "frame.h"
+#include "memcard.h"
+
+/* The directory in block 0 of a PS1 card: frame 0 is the "MC" header,
+ * frames 1..15 describe blocks 1..15. Byte 0 of an entry is the block's
+ * state: 51h first block of a save, 52h middle, 53h last of a chain,
+ * A0h free and never used, A1h..A3h deleted. Byte 127 is the XOR of
+ * bytes 0..126.
+ * Only a block whose entry is intact and says A0h counts as free; a
+ * deleted save keeps its data and is read like a used one.
+ */
+class CardDirectory
+{
+public:
+    enum {
+        BLOCKS = 16,
+        FRAMES_PER_BLOCK = 64,
+        DIR_FRAMES = 16,        // header and one entry per data block
+        STATE_FREE = 0xA0
+    };
+
+    CardDirectory();
+
+    static bool isRead(MemCard *card);
+    bool parse(MemCard *card);
+    bool isValid() const;
+    bool isFree(int block) const;
+    int usedBlocks() const;
+
+    static Frame emptyFrame(int block, int frame);
+
+private:
+    bool valid_;
+    bool free_[BLOCKS];
+};
+
+#endif // CARDDIRECTORY_H
@@ -0,0 +1,241 @@
+#include "cardfile.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char journal_magic[CardFile::MAGIC_SIZE] = { 'R', 'C', 'J', '2' };
+
+static int countBits(const uchar *bits)
+{
+    int n = 0;
+    for (int i = 0; i < MemCard::FRAME_COUNT / 8; ++i)
+        for (uchar b = bits[i]; b; b &= b - 1)
+            ++n;
+    return n;
+}
+
+CardFile::CardFile(QObject *parent) : QObject(parent),
+    data_(0),
+    present_(0),
+    count_(0),
+    pending_(false),
+    resumed_(false)
+{
+    memset(fresh_, 0, sizeof fresh_);
+}
+
+CardFile::~CardFile()
+{
+    this->close();
+}
+
+bool CardFile::fail(QFile &f)
+{
+    error_ = f.fileName() + ": " + f.errorString();
+    this->close();
+    return false;
+}
+
+bool CardFile::open(const QString &fileName)
+{
+    this->close();
+    name_ = fileName;
+    image_.setFileName(fileName + ".part");
+    journal_.setFileName(fileName + ".journal");
+
+    bool resumed = false;
+    if ( !this->openJournal(&resumed) )
+        return false;
+    // a fresh dump starts from an image of zeroes, like MemCard
+    QIODevice::OpenMode mode = QIODevice::ReadWrite;
+    if ( !resumed )
+        mode |= QIODevice::Truncate;
+    if ( !image_.open(mode)
+         || !image_.resize(MemCard::CARD_SIZE) )
+        return this->fail(image_);
+    data_ = image_.map(0, MemCard::CARD_SIZE);
+    if ( !data_ )
+        return this->fail(image_);
+
+    count_ = countBits(present_);
+    pending_ = resumed;
+    return true;
+}
+
+// Map the journal, keeping its bitmap only if it belongs to this image;
+// whether it belongs to the card is up to checkCard().
+bool CardFile::openJournal(bool *resumed)
+{
+    bool had_image = image_.exists();
+    if ( !journal_.open(QIODevice::ReadWrite) )
+        return this->fail(journal_);
+    QByteArray head = journal_.read(HEADER_SIZE);
+    *resumed = had_image
+            && journal_.size() == JOURNAL_SIZE
+            && head.startsWith(QByteArray(journal_magic, MAGIC_SIZE))
+            && uchar(head.at(4)) == (MemCard::FRAME_COUNT & 0xFF)
+            && uchar(head.at(5)) == (MemCard::FRAME_COUNT >> 8);
+    if ( !*resumed ) {
+        QByteArray fresh(JOURNAL_SIZE, 0);
+        memcpy(fresh.data(), journal_magic, MAGIC_SIZE);
+        fresh[4] = char(MemCard::FRAME_COUNT & 0xFF);
+        fresh[5] = char(MemCard::FRAME_COUNT >> 8);
+        if ( !journal_.resize(0) || !journal_.seek(0)
+             || journal_.write(fresh) != JOURNAL_SIZE || !journal_.flush() )
+            return this->fail(journal_);
+    }
+    uchar *j = journal_.map(0, JOURNAL_SIZE);
+    if ( !j )
+        return this->fail(journal_);
+    present_ = j + HEADER_SIZE;
+    return true;
+}
+
+/* Unmap both files. A complete image is put in place of FILE, then the
+ * journal goes; false if the image could not be renamed, it and the
+ * journal are kept then.
+ */
+bool CardFile::close()
+{
+    bool complete = present_ && this->isComplete();
+    bool ok = true;
+    if ( data_ )
+        image_.unmap(data_);
+    if ( present_ )
+        journal_.unmap(present_ - HEADER_SIZE);
+    data_ = 0;
+    present_ = 0;
+    image_.close();
+    journal_.close();
+    if ( complete ) {
+        // rename(2) replaces FILE in one step, QFile::rename() would not
+        if ( ::rename(QFile::encodeName(image_.fileName()).constData(),
+                      QFile::encodeName(name_).constData()) == 0 ) {
+            journal_.remove();
+        } else {
+            error_ = name_ + ": " + strerror(errno);
+            ok = false;
+        }
+    }
+    memset(fresh_, 0, sizeof fresh_);
+    count_ = 0;
+    pending_ = false;
+    resumed_ = false;
+    return ok;
+}
+
+bool CardFile::isOpen()
+{
+    return data_ != 0;
+}
+
+// true once a journal found by open() turned out to be of this card
+bool CardFile::isResumed()
+{
+    return resumed_;
+}
+
+// true while a journal found by open() waits for the card's directory
+bool CardFile::isPending()
+{
+    return pending_;
+}
+
+QString CardFile::fileName()
+{
+    return name_;
+}
+
+QString CardFile::errorString()
+{
+    return error_;
+}
+
+int CardFile::frameCount()
+{
+    return count_;
+}
+
+bool CardFile::isComplete()
+{
+    return !pending_ && count_ == MemCard::FRAME_COUNT;
+}
+
+// Put the journalled frames into card, returns how many.
+int CardFile::load(MemCard *card)
+{
+    if ( !data_ || pending_ )
+        return 0;
+    int n = 0;
+    for (int i = 0; i < MemCard::FRAME_COUNT; ++i){
+        if ( !(present_[i / 8] & (1 << (i % 8))) )
+            continue;
+        card->insertFrame(Frame(i / 64, i % 64,
+                                (const char *)data_ + i * MemCard::FRAME_SIZE,
+                                MemCard::FRAME_SIZE));
+        ++n;
+    }
+    return n;
+}
+
+// Store a validated frame in place, then mark it present.
+void CardFile::writeFrame(const Frame &frame)
+{
+    if ( !data_ || !frame.isFull() || frame.addr() >= MemCard::CARD_SIZE )
+        return;
+    int i = frame.addr() / MemCard::FRAME_SIZE;
+    memcpy(data_ + frame.addr(), frame.constData(), MemCard::FRAME_SIZE);
+    uchar bit = 1 << (i % 8);
+    fresh_[i / 8] |= bit;
+    if ( !(present_[i / 8] & bit) ) {
+        present_[i / 8] |= bit;
+        ++count_;
+    }
+    if ( i >= 1 && i < CardDirectory::DIR_FRAMES )
+        this->checkCard();
+}
+
+// FNV-1a over directory frames 1..15 of a card image.
+quint32 CardFile::cardId(const uchar *image)
+{
+    quint32 h = 2166136261u;
+    for (int i = MemCard::FRAME_SIZE;
+         i < CardDirectory::DIR_FRAMES * MemCard::FRAME_SIZE; ++i){
+        h ^= image[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Once this dump has written directory frames 1..15, record the card id
+// and settle a pending journal: keep it if the id is the one it was
+// written for, else keep only the frames read since open().
+void CardFile::checkCard()
+{
+    for (int i = 1; i < CardDirectory::DIR_FRAMES; ++i)
+        if ( !(fresh_[i / 8] & (1 << (i % 8))) )
+            return;
+    uchar *head = present_ - HEADER_SIZE;
+    int flags = head[6] | head[7] << 8;
+    quint32 old_id = head[8] | head[9] << 8 | head[10] << 16
+            | quint32(head[11]) << 24;
+    quint32 id = CardFile::cardId(data_);
+    bool same = (flags & FLAG_CARD_ID) && old_id == id;
+    head[6] = uchar(flags | FLAG_CARD_ID);
+    head[8] = uchar(id);
+    head[9] = uchar(id >> 8);
+    head[10] = uchar(id >> 16);
+    head[11] = uchar(id >> 24);
+    if ( !pending_ )
+        return;
+    pending_ = false;
+    if ( same ) {
+        resumed_ = true;
+        emit sigResumed(count_);
+        return;
+    }
+    memcpy(present_, fresh_, sizeof fresh_);
+    count_ = countBits(present_);
+    emit sigCardChanged();
+}
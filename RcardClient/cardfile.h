@@ -0,0 +1,77 @@
+#ifndef CARDFILE_H
+#define CARDFILE_H
+
+#include <QFile>
+#include <QObject>
+
+#include "carddirectory.h"
+#include "frame.h"
+#include "memcard.h"
+
+/* A .mcr image being dumped, memory-mapped and written frame by frame
+ * into FILE.part, with a presence journal next to it (FILE.journal):
+ * | "RCJ2" | frame count, 16 bit LE | flags, 16 bit LE | card id, 32 bit LE |
+ * | one bit per frame[128] |
+ * A frame's data is stored before its journal bit, so the journal never
+ * claims more than the image holds. Both survive a crash or a lost
+ * reader. Once the image is complete, close() renames it over FILE and
+ * removes the journal; until then an existing FILE is left alone.
+ * The card id is a checksum of directory frames 1..15, recorded once a
+ * dump has read them. Opening an image that still has its journal keeps
+ * it pending: its frames count only when this dump's directory gives the
+ * same id (sigResumed), else only what this dump read is kept
+ * (sigCardChanged). A FILE.part without its journal is started over.
+ */
+class CardFile : public QObject
+{
+    Q_OBJECT
+public:
+    explicit CardFile(QObject *parent = 0);
+    ~CardFile();
+
+    enum {
+        MAGIC_SIZE = 4,
+        HEADER_SIZE = 12,
+        JOURNAL_SIZE = HEADER_SIZE + MemCard::FRAME_COUNT / 8,
+        FLAG_CARD_ID = 0x0001   // card id field is set
+    };
+
+    bool open(const QString &fileName);
+    bool close();
+    bool isOpen();
+    bool isResumed();
+    bool isPending();
+    QString fileName();
+    QString errorString();
+
+    int frameCount();
+    bool isComplete();
+    int load(MemCard *card);
+
+    static quint32 cardId(const uchar *image);
+
+signals:
+    void sigResumed(int frames);    // journal matches the card, load() it
+    void sigCardChanged();          // journal was of another card, dropped
+
+public slots:
+    void writeFrame(const Frame &frame);
+
+private:
+    bool fail(QFile &f);
+    bool openJournal(bool *resumed);
+    void checkCard();
+
+    QString name_;      // FILE, replaced once complete
+    QFile image_;       // FILE.part
+    QFile journal_;
+    uchar *data_;       // mapped image, CARD_SIZE bytes
+    uchar *present_;    // mapped journal bitmap
+    uchar fresh_[MemCard::FRAME_COUNT / 8];    // frames written since open()
+    int count_;
+    bool pending_;      // journal found, card not checked yet
+    bool resumed_;
+    QString error_;
+};
+
+#endif // CARDFILE_H
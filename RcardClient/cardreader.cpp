@@ -0,0 +1,723 @@
+#include "cardreader.h"
+#include "tracer.h"
+
+// A frame response is ~40 ms on the wire at 38400 baud,
+// plus the card access itself. Anything longer is a lost frame.
+#define FRAME_TIMEOUT_MS 250
+// give up a dump after this many timeouts without a frame in between
+#define DUMP_TIMEOUTS_MAX 10
+// Bursts kept outstanding while dumping and frames per burst. Enough
+// to cover the USB round trip, few enough that a stopped or restarted
+// dump does not leave much queued in the firmware.
+#define QUEUE_DEPTH 3
+#define BURST_FRAMES 16
+
+CardReader::CardReader(QObject *parent) : QObject(parent),
+    dev_(&port_),
+    baud_(QSerialPort::Baud38400),
+    tx_seq_(0),
+    last_seq_(0),
+    seq_ofs_(0),
+    id_seq_(0),
+    timeouts_(0),
+    resync_(false),
+    dumping_(false),
+    strict_(false),
+    dir_done_(false),
+    compress_(false),
+    mode_(0),
+    link_spi_(0),
+    link_baud_(0),
+    old_spi_(0),
+    old_baud_(0),
+    ackstat_(true),
+    ack_pending_(false),
+    sent_ns_(0),
+    frame_start_ns_(0),
+    await_first_(false)
+{
+    inflight_.fill(false, MemCard::FRAME_COUNT);
+    timer_.setSingleShot(true);
+    cool_timer_.setSingleShot(true);
+    clock_.start();
+    stats_.setBaudRate(baud_);
+
+    connect(dev_, SIGNAL(readyRead()),
+            this, SLOT(readPort()));
+
+    connect(&decoder_, SIGNAL(sigFrame(int,Frame,int,int)),
+            this, SLOT(onFrame(int,Frame,int,int)));
+    connect(&decoder_, SIGNAL(sigId(int,int)),
+            this, SLOT(onId(int,int)));
+    connect(&decoder_, SIGNAL(sigDelay(int,int)),
+            this, SLOT(onDelay(int,int)));
+    connect(&decoder_, SIGNAL(sigMode(int,int)),
+            this, SLOT(onMode(int,int)));
+    connect(&decoder_, SIGNAL(sigLink(int,int,int)),
+            this, SLOT(onLink(int,int,int)));
+    connect(&decoder_, SIGNAL(sigAckStat(int,QByteArray)),
+            this, SLOT(onAckStat(int,QByteArray)));
+    connect(&decoder_, SIGNAL(sigError(int,int)),
+            this, SLOT(onError(int,int)));
+
+    connect(&timer_, SIGNAL(timeout()),
+            this, SLOT(onTimeout()));
+    connect(&cool_timer_, SIGNAL(timeout()),
+            this, SLOT(requestNextFrame()));
+}
+
+QString CardReader::portName()
+{
+    if ( dev_ != &port_ )
+        return dev_->objectName();
+    return port_.portName();
+}
+
+void CardReader::setPortName(QString portName)
+{
+    if ( port_.portName() == portName )
+        return;
+    this->close();
+    port_.setPortName(portName);
+}
+
+void CardReader::setBaudRate(qint32 baud)
+{
+    baud_ = baud;
+    stats_.setBaudRate(baud_);
+    if ( port_.isOpen() )
+        port_.setBaudRate(baud_);
+}
+
+// Talk to dev instead of the serial port, 0 goes back to the port.
+void CardReader::setDevice(QIODevice *dev)
+{
+    if ( !dev )
+        dev = &port_;
+    if ( dev == dev_ )
+        return;
+    this->close();
+    disconnect(dev_, SIGNAL(readyRead()),
+               this, SLOT(readPort()));
+    dev_ = dev;
+    connect(dev_, SIGNAL(readyRead()),
+            this, SLOT(readPort()));
+}
+
+bool CardReader::open()
+{
+    if ( dev_->isOpen() )
+        return true;
+    if ( !dev_->open(QIODevice::ReadWrite) )
+        return false;
+
+    if ( dev_ == &port_ ) {
+        port_.setBaudRate(baud_);
+        // arduino defauts to 8-n-1
+        port_.setDataBits(QSerialPort::Data8);
+        port_.setParity(QSerialPort::NoParity);
+        port_.setStopBits(QSerialPort::OneStop);
+    }
+
+    // firmware resets on open, numbering starts over
+    decoder_.clear();
+    tx_seq_ = 0;
+    seq_ofs_ = 0;
+    mode_ = 0;
+    link_spi_ = 0;
+    link_baud_ = 0;
+    for (int i = 0; i < PacketDecoder::LINK_BAUDS; ++i)
+        if ( PacketDecoder::linkBaud(i) == baud_ )
+            link_baud_ = i;
+    old_spi_ = link_spi_;
+    old_baud_ = link_baud_;
+    ackstat_ = true;
+    ack_pending_ = false;
+    stats_.setBaudRate(baud_);
+    return true;
+}
+
+void CardReader::close()
+{
+    this->stopDump();
+    ack_pending_ = false;
+    if ( dev_->isOpen() )
+        dev_->close();
+}
+
+bool CardReader::isOpen()
+{
+    return dev_->isOpen();
+}
+
+QString CardReader::errorString()
+{
+    return dev_->errorString();
+}
+
+MemCard *CardReader::card()
+{
+    return &card_;
+}
+
+bool CardReader::isDumping()
+{
+    return dumping_;
+}
+
+const LinkStats *CardReader::stats()
+{
+    return &stats_;
+}
+
+/* A strict dump reads all 1024 frames. Otherwise the directory in
+ * block 0 is read first and free blocks are filled in, not read.
+ */
+void CardReader::setStrict(bool strict)
+{
+    strict_ = strict;
+}
+
+bool CardReader::isStrict()
+{
+    return strict_;
+}
+
+/* Ask the firmware to send frames RLE coded from the next dump on.
+ * Firmware without the M command answers it with an error and keeps
+ * sending plain frames, which is all the same to the decoder.
+ */
+void CardReader::setCompression(bool compress)
+{
+    compress_ = compress;
+}
+
+bool CardReader::isCompressing()
+{
+    return mode_ > 0 && (mode_ & PacketDecoder::MODE_RLE);
+}
+
+// L codes in effect, see PacketDecoder::linkSpiHz() and linkBaud()
+int CardReader::linkSpi()
+{
+    return link_spi_;
+}
+
+int CardReader::linkBaud()
+{
+    return link_baud_;
+}
+
+// frames given up by the last dump
+QList<int> CardReader::failedFrames()
+{
+    return retry_.givenUp();
+}
+
+void CardReader::resetStats()
+{
+    stats_.clear();
+}
+
+void CardReader::sendCmd(int cmd_enum, char msb, char lsb, quint16 count)
+{
+    if ( !this->open() ) {
+        emit sigLog("error open " + this->portName());
+        return;
+    }
+
+    char readcmd[] = {'R', msb, lsb};
+    char idcmd[] = {'S'};
+    char delaycmd[] = {'D', msb, lsb};
+    char burstcmd[] = {'B', msb, lsb, char(count >> 8), char(count)};
+    char modecmd[] = {'M', msb};
+    char linkcmd[] = {'L', msb, lsb};
+    char ackcmd[] = {'A', msb};
+
+    qint64 written = 0;
+    TraceScope trace("write", "cmd", "RSDBMLA?"[qBound(0, cmd_enum, 7)]);  // letter of the CMD
+    last_seq_ = tx_seq_++;
+    switch(cmd_enum){
+    case CMD_READ:
+        written = dev_->write(readcmd, sizeof readcmd);
+        break;
+    case CMD_ID:
+        written = dev_->write(idcmd, sizeof idcmd);
+        id_seq_ = last_seq_;
+        break;
+    case CMD_DELAY:
+        written = dev_->write(delaycmd, sizeof delaycmd);
+        break;
+    case CMD_BURST:
+        written = dev_->write(burstcmd, sizeof burstcmd);
+        break;
+    case CMD_MODE:
+        written = dev_->write(modecmd, sizeof modecmd);
+        break;
+    case CMD_LINK:
+        written = dev_->write(linkcmd, sizeof linkcmd);
+        break;
+    case CMD_ACKSTAT:
+        written = dev_->write(ackcmd, sizeof ackcmd);
+        break;
+    }
+
+    if (written < 0) {
+        emit sigLog("error write Serial." + dev_->errorString());
+        return;
+    }
+    ++stats_.commands;
+    stats_.tx_bytes += written;
+    sent_ns_ = frame_start_ns_ = clock_.nsecsElapsed();
+    await_first_ = true;
+}
+
+void CardReader::readFrame(int block, int frame)
+{
+    Frame f(block, frame);
+    this->sendCmd(CMD_READ, f.msb(), f.lsb());
+}
+
+void CardReader::readFrames(qint32 addr, qint32 count)
+{
+    quint32 sector = addr / Frame::SIZE;
+    this->sendCmd(CMD_BURST, sector >> 8, sector, count);
+    Burst b = { last_seq_, qint32(sector), count };
+    bursts_.append(b);
+    for (qint32 i = sector; i < qint32(sector) + count && i < MemCard::FRAME_COUNT; ++i)
+        inflight_.setBit(i);
+}
+
+void CardReader::readId()
+{
+    this->sendCmd(CMD_ID);
+}
+
+void CardReader::setDelay(int delay)
+{
+    this->sendCmd(CMD_DELAY, delay >> 8, delay);
+}
+
+/* Move the reader to other L codes. The port follows once the firmware
+ * confirms; the setting then holds only if the next S gets through, so
+ * readId() right after commits it, or dropLink() gives it up.
+ */
+void CardReader::setLink(int spi, int baud)
+{
+    this->sendCmd(CMD_LINK, spi, baud);
+}
+
+// Back to the codes of the last S. The firmware gets there by itself
+// once the probation of the L runs out.
+void CardReader::dropLink()
+{
+    link_spi_ = old_spi_;
+    this->setLineBaud(old_baud_);
+}
+
+void CardReader::setLineBaud(int code)
+{
+    if ( code == link_baud_ )
+        return;
+    link_baud_ = code;
+    stats_.setBaudRate(PacketDecoder::linkBaud(code));
+    if ( dev_ == &port_ && port_.isOpen() )
+        port_.setBaudRate(PacketDecoder::linkBaud(code));
+}
+
+/* Ask the firmware for the /ACK latencies it measured, one packet per
+ * phase, into stats(). clear starts its counts over after.
+ */
+void CardReader::readAckStats(bool clear)
+{
+    if ( !ackstat_ )
+        return;
+    this->sendCmd(CMD_ACKSTAT, clear ? PacketDecoder::ACK_CLEAR : 0);
+    ack_pending_ = true;
+}
+
+bool CardReader::isReadingAckStats()
+{
+    return ack_pending_;
+}
+
+void CardReader::startDump()
+{
+    // stats cover one dump, the busy clock runs while dumping
+    stats_.clear();
+    stats_.startClock();
+    requested_.fill(false, MemCard::FRAME_COUNT);
+    retry_.clear();
+    dir_done_ = strict_;
+
+    // sync sequence numbers in case the firmware was not reset
+    this->readId();
+    int flags = compress_ ? PacketDecoder::MODE_RLE : 0;
+    if ( mode_ >= 0 && mode_ != flags ) {
+        // frames asked for after this may already come coded
+        this->sendCmd(CMD_MODE, flags);
+        mode_ = flags;
+    }
+    dumping_ = true;
+    timeouts_ = 0;
+    resync_ = false;
+    this->requestNextFrame();
+}
+
+void CardReader::stopDump()
+{
+    dumping_ = false;
+    resync_ = false;
+    this->dropBursts();
+    timer_.stop();
+    cool_timer_.stop();
+    stats_.stopClock();
+}
+
+void CardReader::readPort()
+{
+    TraceScope trace("readPort", "bytes", dev_->bytesAvailable());
+    if ( await_first_ && dev_->bytesAvailable() > 0 ) {
+        stats_.first_byte_us.add((clock_.nsecsElapsed() - sent_ns_) / 1000);
+        await_first_ = false;
+    }
+    quint32 crc_errors = decoder_.crcErrors();
+    stats_.rx_bytes += decoder_.readFrom(dev_);
+    stats_.crc_errors += decoder_.crcErrors() - crc_errors;
+}
+
+void CardReader::onFrame(int seq, const Frame &frame, int status, int checksum)
+{
+    int sector = frame.addr() / Frame::SIZE;
+    // seq as numbered by this side
+    quint8 own_seq = seq - seq_ofs_;
+    bool in_burst = this->takeBurstFrame(own_seq, sector);
+
+    last_frame_ = frame;
+    TRACE_INSTANT("frame", "sector", sector);
+    this->countFrame(frame, status, checksum);
+    if ( status == 0x47
+         && (char)checksum == frame.checksum()
+         && frame.isFull()){
+        card_.insertFrame(frame);
+        if ( in_burst )
+            timeouts_ = 0;
+        retry_.succeed(sector);
+        emit sigFrameGot(frame);
+        emit sigProgress(card_.frameCount(), MemCard::FRAME_COUNT);
+    } else {
+        emit sigBadFrame(frame, status);
+        if ( dumping_ && in_burst )
+            this->failFrame(sector, RetryScheduler::reasonOf(status));
+    }
+
+    if ( dumping_ && resync_ )
+        timer_.start(FRAME_TIMEOUT_MS);     // stale bursts still coming
+    if ( !in_burst || !dumping_ )
+        return;  // not part of an outstanding burst
+    timer_.start(FRAME_TIMEOUT_MS);
+    this->requestNextFrame();
+}
+
+/* Account a frame against the outstanding bursts. The firmware answers
+ * them in order, so bursts before the frame's one are over and frames
+ * they or this one skipped were lost on the line. False if the frame
+ * belongs to no outstanding burst, e.g. a late one after a timeout.
+ */
+bool CardReader::takeBurstFrame(quint8 own_seq, int sector)
+{
+    int b = 0;
+    while ( b < bursts_.size() && bursts_.at(b).seq != own_seq )
+        ++b;
+    if ( b == bursts_.size() )
+        return false;
+    Burst &burst = bursts_[b];
+    if ( sector < burst.next || sector >= burst.next + burst.left )
+        return false;
+
+    for (int i = 0; i <= b; ++i){
+        Burst &lost = bursts_[i];
+        int end = i < b ? lost.next + lost.left : sector;
+        for (int s = lost.next; s < end; ++s){
+            inflight_.clearBit(s);
+            if ( dumping_ )
+                this->failFrame(s, RetryScheduler::FAIL_LOST);
+        }
+    }
+    burst.left -= sector + 1 - burst.next;
+    burst.next = sector + 1;
+    inflight_.clearBit(sector);
+    if ( burst.left == 0 )
+        ++b;
+    bursts_.erase(bursts_.begin(), bursts_.begin() + b);
+    return true;
+}
+
+// Forget the outstanding bursts, whatever still comes of them is late.
+void CardReader::dropBursts()
+{
+    bursts_.clear();
+    inflight_.fill(false);
+}
+
+void CardReader::onId(int seq, int version)
+{
+    // the firmware counts commands since its reset, follow its numbering
+    quint8 own_seq = seq - seq_ofs_;
+    seq_ofs_ += own_seq - id_seq_;
+    // the firmware heard the S, it keeps the link
+    old_spi_ = link_spi_;
+    old_baud_ = link_baud_;
+    emit sigId(version);
+    // the firmware answers in order, nothing from before the S is queued
+    if ( resync_ ) {
+        resync_ = false;
+        this->requestNextFrame();
+    }
+}
+
+void CardReader::onDelay(int seq, int delay)
+{
+    Q_UNUSED(seq);
+    emit sigDelay(delay);
+}
+
+void CardReader::onMode(int seq, int flags)
+{
+    Q_UNUSED(seq);
+    mode_ = flags;
+    emit sigMode(flags);
+}
+
+void CardReader::onLink(int seq, int spi, int baud)
+{
+    Q_UNUSED(seq);
+    // the answer came at the old rate, the firmware switched after it
+    link_spi_ = spi;
+    this->setLineBaud(baud);
+    emit sigLink(spi, baud);
+}
+
+static quint32 getBe(const QByteArray &p, int at, int n)
+{
+    quint32 v = 0;
+    for (int i = 0; i < n; ++i)
+        v = (v << 8) | quint8(p.at(at + i));
+    return v;
+}
+
+void CardReader::onAckStat(int seq, const QByteArray &payload)
+{
+    Q_UNUSED(seq);
+    int phase = quint8(payload.at(0));
+    if ( phase >= LinkStats::ACK_PHASES )
+        return;
+    quint64 hist[PacketDecoder::ACK_BUCKETS];
+    for (int i = 0; i < PacketDecoder::ACK_BUCKETS; ++i)
+        hist[i] = getBe(payload, 19 + 2 * i, 2);
+    stats_.ack_timeout_us[phase] = getBe(payload, 1, 4);
+    stats_.ack_timeouts[phase] = getBe(payload, 9, 2);
+    stats_.ack_us[phase].load(hist, PacketDecoder::ACK_BUCKETS,
+                              getBe(payload, 5, 4), getBe(payload, 15, 4),
+                              getBe(payload, 11, 2), getBe(payload, 13, 2));
+    // the phases come in order, the last one completes an A
+    if ( ack_pending_ && phase == LinkStats::ACK_PHASES - 1 ) {
+        ack_pending_ = false;
+        emit sigAckStats();
+    }
+}
+
+void CardReader::onError(int seq, int cmd)
+{
+    Q_UNUSED(seq);
+    if ( cmd == 'M' ) {
+        // older firmware, stay with plain frames until reopened
+        mode_ = -1;
+        emit sigLog("firmware does not compress, reading plain frames");
+    }
+    if ( cmd == 'A' ) {
+        ackstat_ = false;
+        emit sigLog("firmware keeps no /ACK statistics");
+        if ( ack_pending_ ) {
+            ack_pending_ = false;
+            emit sigAckStats();
+        }
+    }
+    emit sigError(cmd);
+}
+
+void CardReader::onTimeout()
+{
+    // frame did not complete in time, ask for the missing ones again
+    emit sigTimeout(last_frame_);
+    ++stats_.timeouts;
+    TRACE_INSTANT("timeout", "sector", last_frame_.addr() / Frame::SIZE);
+    if ( !bursts_.isEmpty() )
+        this->failFrame(bursts_.first().next, RetryScheduler::FAIL_TIMEOUT);
+    // the firmware may have lost its queue or still work through it,
+    // an S answered tells which; only then ask again
+    this->dropBursts();
+    if ( ++timeouts_ >= DUMP_TIMEOUTS_MAX ) {
+        this->finishDump(false);
+        return;
+    }
+    resync_ = true;
+    this->readId();
+    timer_.start(FRAME_TIMEOUT_MS);
+}
+
+// Top up the outstanding bursts with the next runs of missing frames.
+void CardReader::requestNextFrame()
+{
+    if ( !dumping_ || resync_ )
+        return;
+
+    if ( !dir_done_ && CardDirectory::isRead(&card_) ) {
+        dir_done_ = true;
+        this->skipFreeBlocks();
+    }
+    if ( card_.isFull() ){
+        this->finishDump(true);
+        return;
+    }
+
+    while ( bursts_.size() < QUEUE_DEPTH ) {
+        qint32 count = 0;
+        qint64 wake_ms = -1;
+        qint32 addr = this->nextRun(&count, &wake_ms);
+        if ( addr < 0 ) {
+            if ( !bursts_.isEmpty() )
+                break;  // see what the outstanding ones bring
+            if ( wake_ms < 0 ) {
+                // only given up frames left
+                this->finishDump(false);
+                return;
+            }
+            timer_.stop();
+            cool_timer_.start(qMax(qint64(0), wake_ms - clock_.elapsed()));
+            return;
+        }
+        // the directory goes first, it decides what else to read
+        if ( !dir_done_ ) {
+            if ( addr / Frame::SIZE >= CardDirectory::DIR_FRAMES && !bursts_.isEmpty() )
+                break;
+            if ( addr / Frame::SIZE < CardDirectory::DIR_FRAMES )
+                count = qMin(count, CardDirectory::DIR_FRAMES - addr / Frame::SIZE);
+        }
+        count = qMin(count, BURST_FRAMES);
+        for (int i = addr / Frame::SIZE; i < addr / Frame::SIZE + count; ++i){
+            if ( requested_.testBit(i) )
+                ++stats_.retries;
+            requested_.setBit(i);
+        }
+        TRACE_INSTANT("request", "frames", count);
+        this->readFrames(addr, count);
+        if ( !timer_.isActive() )
+            timer_.start(FRAME_TIMEOUT_MS);
+    }
+}
+
+/* First run of missing frames that may be asked for now. Without failed
+ * or outstanding frames that is simply the first gap of the card.
+ * Otherwise frames that cool down, were given up or are already asked
+ * for are skipped and end a run; if no frame is ready, wake_ms gets the
+ * earliest time one will be, or stays -1.
+ */
+qint32 CardReader::nextRun(qint32 *count, qint64 *wake_ms)
+{
+    if ( !retry_.hasHolds() && bursts_.isEmpty() ) {
+        qint32 addr = card_.needFrameAtAddr();
+        *count = card_.missingFramesFrom(addr);
+        return addr;
+    }
+
+    qint64 now = clock_.elapsed();
+    int first = -1;
+    *count = 0;
+    for (int i = 0; i < MemCard::FRAME_COUNT; ++i){
+        bool missing = !card_.hasFrameAtAddr(i * Frame::SIZE)
+                && !inflight_.testBit(i);
+        qint64 ready = missing ? retry_.readyAt(i) : -1;
+        if ( missing && ready >= 0 && ready <= now ) {
+            if ( first < 0 )
+                first = i;
+            ++*count;
+            continue;
+        }
+        if ( first >= 0 )
+            break;
+        if ( ready > now && (*wake_ms < 0 || ready < *wake_ms) )
+            *wake_ms = ready;
+    }
+    return first < 0 ? -1 : first * Frame::SIZE;
+}
+
+// Fill the blocks the directory calls free with the empty pattern.
+void CardReader::skipFreeBlocks()
+{
+    if ( !dir_.parse(&card_) ) {
+        emit sigLog("no card directory, reading every block");
+        return;
+    }
+    int skipped = 0;
+    for (int b = 1; b < CardDirectory::BLOCKS; ++b){
+        if ( !dir_.isFree(b) )
+            continue;
+        for (int f = 0; f < CardDirectory::FRAMES_PER_BLOCK; ++f){
+            Frame e = CardDirectory::emptyFrame(b, f);
+            if ( card_.hasFrameAtAddr(e.addr()) )
+                continue;
+            card_.insertFrame(e);
+            emit sigFrameFilled(e);
+            ++skipped;
+        }
+    }
+    stats_.frames_skipped += skipped;
+    emit sigLog(QString("directory: %1 of %2 blocks in use, %3 frames skipped")
+                .arg(dir_.usedBlocks()).arg(CardDirectory::BLOCKS - 1).arg(skipped));
+    emit sigProgress(card_.frameCount(), MemCard::FRAME_COUNT);
+}
+
+void CardReader::failFrame(int sector, RetryScheduler::REASON why)
+{
+    if ( !retry_.fail(sector, why, clock_.elapsed()) )
+        return;
+    ++stats_.given_up;
+    TRACE_INSTANT("give up", "sector", sector);
+    emit sigFrameFailed(sector, why, retry_.attempts(sector));
+}
+
+void CardReader::finishDump(bool ok)
+{
+    this->stopDump();
+    // what the card took per byte during this dump, the next starts over
+    this->readAckStats(true);
+    emit sigDumpDone(ok);
+}
+
+void CardReader::countFrame(const Frame &frame, int status, int checksum)
+{
+    qint64 now = clock_.nsecsElapsed();
+    stats_.frame_us.add((now - frame_start_ns_) / 1000);
+    frame_start_ns_ = now;
+
+    switch ( (quint8)status ) {
+    case 0x47:
+        if ( (char)checksum == frame.checksum() && frame.isFull() ) {
+            ++stats_.frames_ok;
+            return;
+        }
+        ++stats_.checksum_errors;
+        break;
+    case 0x4E:
+        ++stats_.status_4e;
+        break;
+    case 0xFF:
+        ++stats_.status_ff;
+        break;
+    default:
+        ++stats_.status_other;
+        break;
+    }
+    ++stats_.frames_bad;
+}
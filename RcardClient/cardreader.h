@@ -0,0 +1,159 @@
+#ifndef CARDREADER_H
+#define CARDREADER_H
+
+#include <QBitArray>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QSerialPort>
+#include <QTimer>
+
+#include "carddirectory.h"
+#include "linkstats.h"
+#include "memcard.h"
+#include "packetdecoder.h"
+#include "retryscheduler.h"
+
+/* One Arduino reader on one serial port: sends commands, decodes the
+ * responses and drives a full-card dump into its MemCard. The firmware
+ * queues commands, so a dump keeps a few bursts outstanding and the
+ * reader never waits for the host between them. After a timeout an S
+ * goes out first, and no new burst until it is answered: by then the
+ * firmware is through whatever it still had queued.
+ * Any other QIODevice speaking the same protocol, like SimDevice,
+ * can stand in for the port. Needs QtCore and QtSerialPort only.
+ */
+class CardReader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit CardReader(QObject *parent = 0);
+
+    enum CMD {
+        CMD_READ,
+        CMD_ID,
+        CMD_DELAY,
+        CMD_BURST,
+        CMD_MODE,
+        CMD_LINK,
+        CMD_ACKSTAT
+    };
+
+    QString portName();
+    void setPortName(QString portName);
+    void setBaudRate(qint32 baud);
+    void setDevice(QIODevice *dev);
+    bool open();
+    void close();
+    bool isOpen();
+    QString errorString();
+
+    MemCard *card();
+    bool isDumping();
+    void setStrict(bool strict);
+    bool isStrict();
+    void setCompression(bool compress);
+    bool isCompressing();
+    int linkSpi();
+    int linkBaud();
+    bool isReadingAckStats();
+    const LinkStats *stats();
+    QList<int> failedFrames();
+
+signals:
+    void sigFrameGot(const Frame &frame);
+    void sigFrameFilled(const Frame &frame);
+    void sigBadFrame(const Frame &frame, int status);
+    void sigId(int version);
+    void sigDelay(int delay);
+    void sigMode(int flags);
+    void sigLink(int spi, int baud);
+    void sigError(int cmd);
+    void sigTimeout(const Frame &last);
+    void sigFrameFailed(int sector, int reason, int attempts);
+    void sigProgress(int frames, int total);
+    void sigDumpDone(bool ok);
+    void sigAckStats();     // readAckStats() answered, or no answer coming
+    void sigLog(QString text);
+
+public slots:
+    void sendCmd(int cmd_enum, char msb=0, char lsb=0, quint16 count=0);
+    void readFrame(int block, int frame);
+    void readFrames(qint32 addr, qint32 count);
+    void readId();
+    void setDelay(int delay);
+    void setLink(int spi, int baud);
+    void readAckStats(bool clear = false);
+    void dropLink();
+    void startDump();
+    void stopDump();
+    void resetStats();
+
+private slots:
+    void readPort();
+    void onFrame(int seq, const Frame &frame, int status, int checksum);
+    void onId(int seq, int version);
+    void onDelay(int seq, int delay);
+    void onMode(int seq, int flags);
+    void onLink(int seq, int spi, int baud);
+    void onAckStat(int seq, const QByteArray &payload);
+    void onError(int seq, int cmd);
+    void onTimeout();
+    void requestNextFrame();
+
+private:
+    void finishDump(bool ok);
+    void countFrame(const Frame &frame, int status, int checksum);
+    void failFrame(int sector, RetryScheduler::REASON why);
+    qint32 nextRun(qint32 *count, qint64 *wake_ms);
+    void skipFreeBlocks();
+    bool takeBurstFrame(quint8 own_seq, int sector);
+    void dropBursts();
+    void setLineBaud(int code);
+
+    QSerialPort port_;
+    QIODevice *dev_;        // port_ or the device standing in for it
+    qint32 baud_;           // the firmware's after reset
+    PacketDecoder decoder_;
+    MemCard card_;
+    Frame last_frame_;
+
+    quint8 tx_seq_;         // sequence number of the next command
+    quint8 last_seq_;       // sequence number of the last command sent
+    quint8 seq_ofs_;        // firmware numbering - own numbering
+    quint8 id_seq_;
+
+    struct Burst {
+        quint8 seq;         // own sequence number of the B command
+        qint32 next;        // sector it is due to send next
+        qint32 left;        // frames still to come
+    };
+    QList<Burst> bursts_;   // outstanding, in the order they are answered
+    QBitArray inflight_;    // frames asked for by bursts_
+
+    QTimer timer_;          // per-frame timeout while dumping
+    QTimer cool_timer_;     // all missing frames cooling down, wait for one
+    RetryScheduler retry_;
+    int timeouts_;          // in a row
+    bool resync_;           // S sent after a timeout, no bursts until answered
+    bool dumping_;
+    bool strict_;           // read every frame, not only the used blocks
+    bool dir_done_;         // directory read and free blocks filled in
+    bool compress_;         // ask the firmware for RLE frames
+    int mode_;              // M flags last sent, -1 if the firmware has no M
+    int link_spi_;          // L codes in effect
+    int link_baud_;
+    int old_spi_;           // L codes last confirmed by an S
+    int old_baud_;
+    bool ackstat_;          // false if the firmware has no A
+    bool ack_pending_;      // A sent, its last PKT_ACKSTAT not in yet
+    CardDirectory dir_;
+
+    LinkStats stats_;
+    QElapsedTimer clock_;   // time base of the latencies below
+    qint64 sent_ns_;        // last command written
+    qint64 frame_start_ns_; // last command or frame, whichever is later
+    bool await_first_;      // no byte back since the last command
+    QBitArray requested_;   // frames asked for during this dump
+};
+
+#endif // CARDREADER_H
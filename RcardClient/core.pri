@@ -0,0 +1,38 @@
+# GUI-free core: serial protocol, Frame, MemCard and the dump engine.
+# Shared by RcardClient and the command-line tools. The wire protocol
+# itself (CRC, PackBits, packet constants, retry limits) is the C one
+# of rcard in the directory above.
+
+QT       += core serialport
+CONFIG   += c++11
+
+INCLUDEPATH += $$PWD $$PWD/..
+DEPENDPATH += $$PWD $$PWD/..
+
+SOURCES += $$PWD/frame.cpp \
+    $$PWD/memcard.cpp \
+    $$PWD/packetdecoder.cpp \
+    $$PWD/ringbuffer.cpp \
+    $$PWD/cardreader.cpp \
+    $$PWD/simdevice.cpp \
+    $$PWD/linkstats.cpp \
+    $$PWD/tracer.cpp \
+    $$PWD/retryscheduler.cpp \
+    $$PWD/cardfile.cpp \
+    $$PWD/carddirectory.cpp \
+    $$PWD/linktuner.cpp \
+    $$PWD/../psx_proto.c
+
+HEADERS += $$PWD/frame.h \
+    $$PWD/memcard.h \
+    $$PWD/packetdecoder.h \
+    $$PWD/ringbuffer.h \
+    $$PWD/cardreader.h \
+    $$PWD/simdevice.h \
+    $$PWD/linkstats.h \
+    $$PWD/tracer.h \
+    $$PWD/retryscheduler.h \
+    $$PWD/cardfile.h \
+    $$PWD/carddirectory.h \
+    $$PWD/linktuner.h \
+    $$PWD/../psx_proto.h
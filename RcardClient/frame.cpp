@@ -1,101 +1,120 @@
 #include "frame.h"
 
-Frame::Frame(QObject *parent) : QObject(parent),
-    msb_(0), lsb_(0), data_(QByteArray())
+#include <string.h>
+
+Frame::Frame() :
+    sector_(0), size_(0), sum_(0)
 {
 
 }
 
-Frame::Frame(unsigned int block, unsigned int frame, QByteArray data, QObject *parent) : QObject(parent),
-    msb_(0), lsb_(0), data_(QByteArray())
+Frame::Frame(unsigned int block, unsigned int frame, const char *data, int len) :
+    sector_(0), size_(0), sum_(0)
 {
     this->setIndex(block, frame);
-    this->appendData(data);
-}
-
-Frame::Frame(Frame &other)
-{
-    msb_ = other.msb();
-    lsb_ = other.lsb();
-    data_ = other.data();
-    sum_ = other.checksum();
-    addr_ = other.addr();
+    this->appendData(data, len);
 }
 
-char Frame::checksum()
+char Frame::checksum() const
 {
     return sum_;
 }
 
-QString Frame::checksumHex()
+QString Frame::checksumHex() const
 {
     char s = this->checksum();
     QByteArray a(&s, 1);
     return QString(a.toHex());
 }
 
-bool Frame::isFull()
+bool Frame::isFull() const
 {
-    return data_.size() == 128;
+    return size_ == SIZE;
 }
 
-bool Frame::isEmpty()
+bool Frame::isEmpty() const
 {
-    return data_.size() == 0;
+    return size_ == 0;
 }
 
-QString Frame::dataHex()
+QString Frame::dataHex() const
 {
-    return QString ( data_.toHex()).toUpper();
+    return QString ( QByteArray::fromRawData(constData(), size_).toHex()).toUpper();
 }
 
-QString Frame::indexString()
+QString Frame::indexString() const
 {
-    return QString::number(block_) + "," + QString::number(frame_);
+    return QString::number(block()) + "," + QString::number(frame());
 }
 
-unsigned int Frame::block()
+unsigned int Frame::block() const
 {
-    return block_;
+    return sector_ / 64;
 }
 
-unsigned int Frame::frame()
+unsigned int Frame::frame() const
 {
-    return frame_;
+    return sector_ % 64;
 }
 
-char Frame::msb()
+char Frame::msb() const
 {
-    return msb_;
+    return sector_ >> 8;
 }
 
-char Frame::lsb()
+char Frame::lsb() const
 {
-    return lsb_;
+    return sector_;
 }
 
-QByteArray Frame::data()
+const char *Frame::constData() const
 {
-    return data_;
+    return reinterpret_cast<const char *>(data_.data());
 }
 
-unsigned long Frame::addr()
+QByteArray Frame::data() const
 {
-    return addr_;
+    return QByteArray(constData(), size_);
 }
 
-int Frame::appendData(QByteArray data)
+unsigned long Frame::addr() const
 {
+    return sector_ * SIZE;
+}
+
+uint8_t Frame::xorBytes(const uint8_t *p, int len)
+{
+    // eight bytes at a time, then fold the word
+    uint64_t w = 0;
     int i = 0;
-    for (; i< data.size(); ++i){
-        if ( data_.size() < 128) {
-            data_.append(data.at(i));
-            sum_ ^= data.at(i);
-        } else {
-            return i;
-        }
+    for (; i + 8 <= len; i += 8){
+        uint64_t v;
+        memcpy(&v, p + i, 8);
+        w ^= v;
     }
-    return i;
+    w ^= w >> 32;
+    w ^= w >> 16;
+    w ^= w >> 8;
+    uint8_t x = w;
+    for (; i < len; ++i)
+        x ^= p[i];
+    return x;
+}
+
+int Frame::appendData(const char *data, int len)
+{
+    int n = qMin(len, SIZE - size_);
+    if ( n <= 0 )
+        return 0;
+    memcpy(data_.data() + size_, data, n);
+    sum_ ^= xorBytes(data_.data() + size_, n);
+    size_ += n;
+    return n;
+}
+
+int Frame::appendData(const QByteArray &data)
+{
+    return appendData(data.constData(), data.size());
 }
 
 void Frame::setIndex(unsigned int block, unsigned int frame)
@@ -103,26 +122,20 @@ void Frame::setIndex(unsigned int block, unsigned int frame)
     if ( block > 15 || frame > 63) return;
     /* block 0 - 15 , each 8KB*/
     /* frame 0 - 63 , each 128 B */
-    block_ = block;
-    frame_= frame;
-    addr_ = 8 * 1024 * block + 128 * frame;
-
-    msb_ = addr_;
-    sum_ ^= msb_;
-    lsb_ = (addr_>>8);
-    sum_ ^= lsb_;
+    // the card is addressed by sector (frame) number 0 - 0x3FF
+    sum_ ^= msb() ^ lsb();
+    sector_ = block * 64 + frame;
+    sum_ ^= msb() ^ lsb();
 }
 
 void Frame::clear()
 {
-    msb_ = lsb_ = sum_ = 0;
-    data_.clear();
+    sector_ = 0;
+    size_ = sum_ = 0;
 }
 
 void Frame::setAddress(unsigned long addr)
 {
-    block_ = addr / (64 * 128);
-    frame_ = (addr % (64 *128)) / 128;
-    this->setIndex(block_, frame_);
+    this->setIndex(addr / (64 * 128),
+                   (addr % (64 *128)) / 128);
 }
-
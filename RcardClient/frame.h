@@ -1,46 +1,56 @@
 #ifndef FRAME_H
 #define FRAME_H
 
-#include <QObject>
+#include <QByteArray>
+#include <QMetaType>
+#include <QString>
+#include <array>
+#include <stdint.h>
 
-class Frame : public QObject
+/* One 128 byte frame of the card and its MSB ^ LSB ^ data checksum.
+ * Plain value type, copy it around freely.
+ */
+class Frame
 {
-    Q_OBJECT
 public:
-    explicit Frame(QObject *parent = 0);
-    explicit Frame( unsigned int block,
-                    unsigned int frame,
-                    QByteArray data,
-                    QObject *parent = 0);
-    explicit Frame( Frame & other);
-    char checksum();
-    QString checksumHex();
-    bool isFull();
-    bool isEmpty();
-    QString dataHex();
-    QString indexString();
-
-    unsigned int block();
-    unsigned int frame();
-    char msb();
-    char lsb();
-    QByteArray data();
-    unsigned long addr();
-signals:
-
-public slots:
-    int appendData(QByteArray data);
+    enum { SIZE = 128 };
+
+    Frame();
+    Frame( unsigned int block,
+           unsigned int frame,
+           const char *data = 0,
+           int len = 0);
+    char checksum() const;
+    QString checksumHex() const;
+    bool isFull() const;
+    bool isEmpty() const;
+    QString dataHex() const;
+    QString indexString() const;
+
+    unsigned int block() const;
+    unsigned int frame() const;
+    char msb() const;
+    char lsb() const;
+    const char *constData() const;
+    QByteArray data() const;
+    unsigned long addr() const;
+
+    int appendData(const char *data, int len);
+    int appendData(const QByteArray &data);
     void setIndex(unsigned int block, unsigned int frame);
     void clear();
     void setAddress(unsigned long addr);
+
+    static uint8_t xorBytes(const uint8_t *p, int len);
+
 private:
-    unsigned int block_;
-    unsigned int frame_;
-    char msb_;
-    char lsb_;
-    QByteArray data_;
-    char sum_;
-    unsigned long addr_;
+    uint16_t sector_;
+    uint8_t size_;
+    uint8_t sum_;
+    std::array<uint8_t, SIZE> data_;
 };
 
+Q_DECLARE_TYPEINFO(Frame, Q_PRIMITIVE_TYPE);
+Q_DECLARE_METATYPE(Frame)
+
 #endif // FRAME_H
@@ -0,0 +1,283 @@
+#include "linkstats.h"
+
+#include <string.h>
+
+Histogram::Histogram()
+{
+    this->clear();
+}
+
+void Histogram::add(qint64 us)
+{
+    if ( us < 0 )
+        us = 0;
+    int i = 0;
+    while ( i < BUCKETS - 1 && (us >> i) )
+        ++i;
+    ++buckets_[i];
+    if ( count_ == 0 || us < min_ )
+        min_ = us;
+    if ( us > max_ )
+        max_ = us;
+    sum_ += us;
+    ++count_;
+}
+
+// Take over a histogram counted elsewhere with the same buckets, like
+// the firmware's /ACK latencies. Buckets beyond BUCKETS are dropped.
+void Histogram::load(const quint64 *buckets, int n, quint64 count, qint64 sum,
+                     qint64 min, qint64 max)
+{
+    this->clear();
+    for (int i = 0; i < n && i < BUCKETS; ++i)
+        buckets_[i] = buckets[i];
+    count_ = count;
+    sum_ = sum;
+    min_ = count ? min : 0;
+    max_ = max;
+}
+
+void Histogram::clear()
+{
+    memset(buckets_, 0, sizeof buckets_);
+    count_ = 0;
+    sum_ = 0;
+    min_ = 0;
+    max_ = 0;
+}
+
+quint64 Histogram::count() const
+{
+    return count_;
+}
+
+qint64 Histogram::min() const
+{
+    return min_;
+}
+
+qint64 Histogram::max() const
+{
+    return max_;
+}
+
+double Histogram::mean() const
+{
+    return count_ ? double(sum_) / count_ : 0.0;
+}
+
+qint64 Histogram::percentile(double p) const
+{
+    if ( count_ == 0 )
+        return 0;
+    quint64 rank = quint64(p / 100.0 * count_ + 0.5);
+    if ( rank < 1 )
+        rank = 1;
+    quint64 seen = 0;
+    for (int i = 0; i < BUCKETS; ++i){
+        seen += buckets_[i];
+        if ( seen >= rank )
+            return qMin(i ? (qint64(1) << i) - 1 : 0, max_);
+    }
+    return max_;
+}
+
+QJsonObject Histogram::toJson() const
+{
+    QJsonObject o;
+    o["count"] = double(count_);
+    o["min_us"] = double(min_);
+    o["mean_us"] = this->mean();
+    o["p50_us"] = double(this->percentile(50));
+    o["p90_us"] = double(this->percentile(90));
+    o["p99_us"] = double(this->percentile(99));
+    o["max_us"] = double(max_);
+    // upper bound in us -> count, empty buckets left out
+    QJsonObject b;
+    for (int i = 0; i < BUCKETS; ++i)
+        if ( buckets_[i] )
+            b[QString::number(i ? (qint64(1) << i) - 1 : 0)] = double(buckets_[i]);
+    o["buckets"] = b;
+    return o;
+}
+
+LinkStats::LinkStats() :
+    baud_(0)
+{
+    this->clear();
+}
+
+void LinkStats::clear()
+{
+    commands = 0;
+    tx_bytes = 0;
+    rx_bytes = 0;
+    frames_ok = 0;
+    frames_bad = 0;
+    checksum_errors = 0;
+    status_4e = 0;
+    status_ff = 0;
+    status_other = 0;
+    crc_errors = 0;
+    timeouts = 0;
+    retries = 0;
+    given_up = 0;
+    frames_skipped = 0;
+    first_byte_us.clear();
+    frame_us.clear();
+    for (int i = 0; i < ACK_PHASES; ++i){
+        ack_us[i].clear();
+        ack_timeouts[i] = 0;
+        ack_timeout_us[i] = 0;
+    }
+    busy_ns_ = 0;
+    if ( clock_.isValid() )
+        clock_.restart();
+}
+
+const char *LinkStats::ackPhaseName(int phase)
+{
+    static const char *names[ACK_PHASES] = { "hdr", "addr", "data" };
+    return phase >= 0 && phase < ACK_PHASES ? names[phase] : "?";
+}
+
+void LinkStats::setBaudRate(qint32 baud)
+{
+    baud_ = baud;
+}
+
+void LinkStats::startClock()
+{
+    if ( !clock_.isValid() )
+        clock_.start();
+}
+
+void LinkStats::stopClock()
+{
+    if ( !clock_.isValid() )
+        return;
+    busy_ns_ += clock_.nsecsElapsed();
+    clock_.invalidate();
+}
+
+qint64 LinkStats::busyMs() const
+{
+    qint64 ns = busy_ns_;
+    if ( clock_.isValid() )
+        ns += clock_.nsecsElapsed();
+    return ns / 1000000;
+}
+
+double LinkStats::framesPerSec() const
+{
+    qint64 ms = this->busyMs();
+    return ms ? frames_ok * 1000.0 / ms : 0.0;
+}
+
+double LinkStats::bytesPerSec() const
+{
+    qint64 ms = this->busyMs();
+    return ms ? rx_bytes * 1000.0 / ms : 0.0;
+}
+
+double LinkStats::wireMs() const
+{
+    return baud_ ? (rx_bytes + tx_bytes) * 10 * 1000.0 / baud_ : 0.0;
+}
+
+// share of the busy time the line was carrying bytes, in either
+// direction; the UART is full duplex so this can exceed 1 in theory
+double LinkStats::utilisation() const
+{
+    qint64 ms = this->busyMs();
+    return ms ? this->wireMs() / ms : 0.0;
+}
+
+qint64 LinkStats::etaMs(int frames_left) const
+{
+    double fps = this->framesPerSec();
+    if ( frames_left < 0 || fps <= 0 )
+        return -1;
+    return qint64(frames_left * 1000.0 / fps);
+}
+
+QString LinkStats::summary(int frames_left) const
+{
+    QString s;
+    s += QString("%1 frames/s  %2 B/s  link %3%\n")
+            .arg(this->framesPerSec(), 0, 'f', 1)
+            .arg(this->bytesPerSec(), 0, 'f', 0)
+            .arg(this->utilisation() * 100, 0, 'f', 0);
+    s += QString("busy %1 s  wire %2 s  wait %3 s")
+            .arg(this->busyMs() / 1000.0, 0, 'f', 1)
+            .arg(this->wireMs() / 1000.0, 0, 'f', 1)
+            .arg(qMax(0.0, this->busyMs() - this->wireMs()) / 1000.0, 0, 'f', 1);
+    qint64 eta = this->etaMs(frames_left);
+    if ( eta >= 0 )
+        s += QString("  ETA %1 s").arg(eta / 1000.0, 0, 'f', 0);
+    s += QString("\nframes %1 ok  %2 bad  %3 skipped\n")
+            .arg(frames_ok).arg(frames_bad).arg(frames_skipped);
+    s += QString("csum %1  4E %2  FF %3  other %4\n")
+            .arg(checksum_errors).arg(status_4e).arg(status_ff).arg(status_other);
+    s += QString("timeouts %1  retries %2  given up %3  crc %4\n")
+            .arg(timeouts).arg(retries).arg(given_up).arg(crc_errors);
+    s += QString("first byte p50 %1 p99 %2 max %3 ms\n")
+            .arg(first_byte_us.percentile(50) / 1000.0, 0, 'f', 1)
+            .arg(first_byte_us.percentile(99) / 1000.0, 0, 'f', 1)
+            .arg(first_byte_us.max() / 1000.0, 0, 'f', 1);
+    s += QString("frame      p50 %1 p99 %2 max %3 ms")
+            .arg(frame_us.percentile(50) / 1000.0, 0, 'f', 1)
+            .arg(frame_us.percentile(99) / 1000.0, 0, 'f', 1)
+            .arg(frame_us.max() / 1000.0, 0, 'f', 1);
+    for (int i = 0; i < ACK_PHASES; ++i){
+        if ( !ack_us[i].count() && !ack_timeouts[i] )
+            continue;
+        s += QString("\nack %1 p50 %2 p99 %3 max %4 us  %5 timeouts (%6 us)")
+                .arg(QString(ackPhaseName(i)), -4)
+                .arg(ack_us[i].percentile(50))
+                .arg(ack_us[i].percentile(99))
+                .arg(ack_us[i].max())
+                .arg(ack_timeouts[i])
+                .arg(ack_timeout_us[i]);
+    }
+    return s;
+}
+
+QJsonObject LinkStats::toJson() const
+{
+    QJsonObject o;
+    o["baud"] = baud_;
+    o["busy_ms"] = double(this->busyMs());
+    o["wire_ms"] = this->wireMs();
+    o["utilisation"] = this->utilisation();
+    o["frames_per_sec"] = this->framesPerSec();
+    o["bytes_per_sec"] = this->bytesPerSec();
+    o["commands"] = double(commands);
+    o["tx_bytes"] = double(tx_bytes);
+    o["rx_bytes"] = double(rx_bytes);
+    o["frames_ok"] = double(frames_ok);
+    o["frames_bad"] = double(frames_bad);
+    o["checksum_errors"] = double(checksum_errors);
+    o["status_4e"] = double(status_4e);
+    o["status_ff"] = double(status_ff);
+    o["status_other"] = double(status_other);
+    o["crc_errors"] = double(crc_errors);
+    o["timeouts"] = double(timeouts);
+    o["retries"] = double(retries);
+    o["given_up"] = double(given_up);
+    o["frames_skipped"] = double(frames_skipped);
+    o["first_byte"] = first_byte_us.toJson();
+    o["frame"] = frame_us.toJson();
+    QJsonObject ack;
+    for (int i = 0; i < ACK_PHASES; ++i){
+        if ( !ack_us[i].count() && !ack_timeouts[i] )
+            continue;
+        QJsonObject a = ack_us[i].toJson();
+        a["timeouts"] = double(ack_timeouts[i]);
+        a["timeout_us"] = double(ack_timeout_us[i]);
+        ack[ackPhaseName(i)] = a;
+    }
+    if ( !ack.isEmpty() )
+        o["ack"] = ack;
+    return o;
+}
@@ -0,0 +1,95 @@
+#ifndef LINKSTATS_H
+#define LINKSTATS_H
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QString>
+
+/* Latency histogram with power of two buckets: bucket i counts the
+ * values in [2^(i-1), 2^i) microseconds, bucket 0 counts zeroes.
+ * Percentiles are bucket upper bounds, clamped to the largest value seen.
+ */
+class Histogram
+{
+public:
+    enum { BUCKETS = 32 };
+
+    Histogram();
+
+    void add(qint64 us);
+    void load(const quint64 *buckets, int n, quint64 count, qint64 sum,
+              qint64 min, qint64 max);
+    void clear();
+    quint64 count() const;
+    qint64 min() const;
+    qint64 max() const;
+    double mean() const;
+    qint64 percentile(double p) const;
+    QJsonObject toJson() const;
+
+private:
+    quint64 buckets_[BUCKETS];
+    quint64 count_;
+    qint64 sum_;
+    qint64 min_;
+    qint64 max_;
+};
+
+/* Counters and histograms of one reader link, filled in by CardReader.
+ * Time on the wire is estimated from the byte count and the baud rate
+ * (10 bits per byte), the rest of the busy time is spent waiting on the
+ * reader and the card.
+ */
+class LinkStats
+{
+public:
+    LinkStats();
+
+    void clear();
+    void setBaudRate(qint32 baud);
+    void startClock();
+    void stopClock();
+    qint64 busyMs() const;
+
+    double framesPerSec() const;
+    double bytesPerSec() const;
+    double wireMs() const;
+    double utilisation() const;
+    qint64 etaMs(int frames_left) const;
+
+    QString summary(int frames_left = -1) const;
+    QJsonObject toJson() const;
+
+    quint64 commands;
+    quint64 tx_bytes;
+    quint64 rx_bytes;
+    quint64 frames_ok;
+    quint64 frames_bad;
+    quint64 checksum_errors;    // status 47 but data does not match its checksum
+    quint64 status_4e;          // card reported a bad checksum
+    quint64 status_ff;          // card did not answer, or bad sector
+    quint64 status_other;
+    quint64 crc_errors;         // packets dropped by the decoder
+    quint64 timeouts;
+    quint64 retries;            // frames requested again during a dump
+    quint64 given_up;           // frames the retry scheduler gave up on
+    quint64 frames_skipped;     // free blocks filled in, not read
+
+    Histogram first_byte_us;    // command written to first byte back
+    Histogram frame_us;         // command or previous frame to frame done
+
+    // /ACK latencies the reader measured, per phase of a read: header,
+    // address, data. Fetched from the firmware at the end of a dump.
+    enum { ACK_PHASES = 3 };
+    static const char *ackPhaseName(int phase);
+    Histogram ack_us[ACK_PHASES];
+    quint64 ack_timeouts[ACK_PHASES];
+    qint64 ack_timeout_us[ACK_PHASES];  // in effect in the reader
+
+private:
+    qint32 baud_;
+    QElapsedTimer clock_;
+    qint64 busy_ns_;            // closed intervals of startClock/stopClock
+};
+
+#endif // LINKSTATS_H
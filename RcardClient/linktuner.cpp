@@ -0,0 +1,252 @@
+#include "linktuner.h"
+
+#include <QSettings>
+
+LinkTuner::LinkTuner(CardReader *reader, QObject *parent) : QObject(parent),
+    reader_(reader),
+    state_(ST_IDLE),
+    stepping_(false),
+    spi_done_(false),
+    spi_(0),
+    baud_(0),
+    good_(0),
+    bad_(0)
+{
+    timer_.setSingleShot(true);
+
+    connect(reader_, SIGNAL(sigLink(int,int)),
+            this, SLOT(onLink(int,int)));
+    connect(reader_, SIGNAL(sigFrameGot(Frame)),
+            this, SLOT(onFrameGot(Frame)));
+    connect(reader_, SIGNAL(sigBadFrame(Frame,int)),
+            this, SLOT(onBadFrame(Frame,int)));
+    connect(reader_, SIGNAL(sigId(int)),
+            this, SLOT(onId(int)));
+    connect(reader_, SIGNAL(sigError(int)),
+            this, SLOT(onError(int)));
+    connect(&timer_, SIGNAL(timeout()),
+            this, SLOT(onTimeout()));
+}
+
+bool LinkTuner::isRunning()
+{
+    return state_ != ST_IDLE;
+}
+
+// Port names may hold slashes, which QSettings takes for groups.
+static QString linkKey(QString portName)
+{
+    return "link/" + portName.replace('/', '_');
+}
+
+bool LinkTuner::saved(QString portName, int *spi, int *baud)
+{
+    QSettings settings("rcard", "RcardClient");
+    QString key = linkKey(portName);
+    if ( !settings.contains(key + "/spi") )
+        return false;
+    *spi = settings.value(key + "/spi").toInt();
+    *baud = settings.value(key + "/baud").toInt();
+    return *spi > 0 || *baud > 0;
+}
+
+void LinkTuner::save(QString portName, int spi, int baud)
+{
+    QSettings settings("rcard", "RcardClient");
+    QString key = linkKey(portName);
+    settings.setValue(key + "/spi", spi);
+    settings.setValue(key + "/baud", baud);
+}
+
+// Step up from the current link as far as it reads clean.
+void LinkTuner::tune()
+{
+    if ( state_ != ST_IDLE || reader_->isDumping() )
+        return;
+    stepping_ = true;
+    spi_done_ = false;
+    this->nextStep();
+}
+
+// Try one setting, e.g. the saved one after the reader was reset.
+void LinkTuner::apply(int spi, int baud)
+{
+    if ( state_ != ST_IDLE || reader_->isDumping() )
+        return;
+    if ( spi == reader_->linkSpi() && baud == reader_->linkBaud() )
+        return;
+    stepping_ = false;
+    this->tryLink(spi, baud);
+}
+
+void LinkTuner::stop()
+{
+    if ( state_ == ST_IDLE )
+        return;
+    // leave the reader at a setting both sides agree on
+    if ( state_ == ST_LINK || state_ == ST_TEST || state_ == ST_KEEP ) {
+        stepping_ = false;
+        this->drop();
+        return;
+    }
+    if ( state_ == ST_DROP_WAIT )
+        return;     // on the way back already
+    this->finish();
+}
+
+void LinkTuner::nextStep()
+{
+    int spi = reader_->linkSpi();
+    int baud = reader_->linkBaud();
+    if ( !spi_done_ && spi + 1 < PacketDecoder::LINK_SPIS ) {
+        this->tryLink(spi + 1, baud);
+        return;
+    }
+    spi_done_ = true;
+    if ( baud + 1 < PacketDecoder::LINK_BAUDS ) {
+        this->tryLink(spi, baud + 1);
+        return;
+    }
+    this->finish();
+}
+
+void LinkTuner::tryLink(int spi, int baud)
+{
+    spi_ = spi;
+    baud_ = baud;
+    state_ = ST_LINK;
+    emit sigLog("link: trying " + this->linkName(spi, baud));
+    reader_->setLink(spi, baud);
+    timer_.start(ANSWER_MS);
+}
+
+void LinkTuner::onLink(int spi, int baud)
+{
+    if ( state_ != ST_LINK || spi != spi_ || baud != baud_ )
+        return;
+    state_ = ST_TEST;
+    good_ = 0;
+    bad_ = 0;
+    reader_->readFrames(0, TEST_FRAMES);
+    timer_.start(TEST_MS);
+}
+
+void LinkTuner::onFrameGot(const Frame &frame)
+{
+    if ( state_ != ST_TEST || frame.addr() / Frame::SIZE >= TEST_FRAMES )
+        return;
+    ++good_;
+    if ( good_ + bad_ == TEST_FRAMES )
+        this->testDone();
+}
+
+void LinkTuner::onBadFrame(const Frame &frame, int status)
+{
+    Q_UNUSED(status);
+    if ( state_ != ST_TEST || frame.addr() / Frame::SIZE >= TEST_FRAMES )
+        return;
+    ++bad_;
+    if ( good_ + bad_ == TEST_FRAMES )
+        this->testDone();
+}
+
+void LinkTuner::testDone()
+{
+    if ( good_ < TEST_FRAMES ) {
+        emit sigLog(QString("link: %1 of %2 test frames good")
+                    .arg(good_).arg(TEST_FRAMES));
+        this->drop();
+        return;
+    }
+    // the S is what makes the firmware keep it
+    state_ = ST_KEEP;
+    reader_->readId();
+    timer_.start(ANSWER_MS);
+}
+
+void LinkTuner::onId(int version)
+{
+    Q_UNUSED(version);
+    if ( state_ == ST_KEEP ) {
+        emit sigLog("link: kept " + this->linkName(spi_, baud_));
+        if ( stepping_ )
+            this->nextStep();
+        else
+            this->finish();
+    } else if ( state_ == ST_DROP ) {
+        // this knob is as fast as it goes, try the next one
+        if ( stepping_ && !spi_done_ ) {
+            spi_done_ = true;
+            this->nextStep();
+        } else {
+            this->finish();
+        }
+    }
+}
+
+void LinkTuner::onError(int cmd)
+{
+    if ( state_ != ST_LINK || cmd != 'L' )
+        return;
+    emit sigLog("link: firmware cannot switch its link");
+    this->finish();
+}
+
+void LinkTuner::drop()
+{
+    emit sigLog("link: dropped " + this->linkName(spi_, baud_));
+    // whatever the test burst still brings is of no use
+    reader_->stopDump();
+    reader_->dropLink();
+    state_ = ST_DROP_WAIT;
+    timer_.start(PacketDecoder::LINK_PROBATION_MS + ANSWER_MS);
+}
+
+void LinkTuner::onTimeout()
+{
+    switch ( state_ ) {
+    case ST_IDLE:
+        break;
+    case ST_LINK:
+        // the answer may be what got lost, let a switch run out
+        emit sigLog("link: no answer to L");
+        stepping_ = false;
+        this->drop();
+        break;
+    case ST_TEST:
+        this->testDone();
+        break;
+    case ST_KEEP:
+        this->drop();
+        break;
+    case ST_DROP_WAIT:
+        state_ = ST_DROP;
+        reader_->readId();
+        timer_.start(ANSWER_MS);
+        break;
+    case ST_DROP:
+        emit sigLog("link: reader lost, reopen the port");
+        stepping_ = false;
+        this->finish();
+        break;
+    }
+}
+
+void LinkTuner::finish()
+{
+    timer_.stop();
+    state_ = ST_IDLE;
+    int spi = reader_->linkSpi();
+    int baud = reader_->linkBaud();
+    if ( stepping_ )
+        LinkTuner::save(reader_->portName(), spi, baud);
+    emit sigLog("link: " + this->linkName(spi, baud));
+    emit sigDone(spi, baud);
+}
+
+QString LinkTuner::linkName(int spi, int baud)
+{
+    return QString("SPI %1 kHz, %2 baud")
+            .arg(PacketDecoder::linkSpiHz(spi) / 1000)
+            .arg(PacketDecoder::linkBaud(baud));
+}
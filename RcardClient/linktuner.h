@@ -0,0 +1,78 @@
+#ifndef LINKTUNER_H
+#define LINKTUNER_H
+
+#include <QObject>
+#include <QTimer>
+
+#include "cardreader.h"
+
+/* Finds the fastest link a reader reads clean at. Steps the SPI clock up
+ * first, then the baud rate, one L code at a time: each step reads the
+ * first TEST_FRAMES frames and is kept with an S only if all of them
+ * come back good. A failed step is dropped on both sides, the firmware
+ * undoing it once its probation runs out, and ends stepping that knob.
+ * The result is remembered per port in QSettings.
+ */
+class LinkTuner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LinkTuner(CardReader *reader, QObject *parent = 0);
+
+    enum {
+        TEST_FRAMES = 8,
+        ANSWER_MS = 500,        // for the L and S answers
+        TEST_MS = 2000          // for the test frames at 38400 baud
+    };
+
+    bool isRunning();
+
+    static bool saved(QString portName, int *spi, int *baud);
+    static void save(QString portName, int spi, int baud);
+
+signals:
+    void sigDone(int spi, int baud);    // L codes the reader ended up at
+    void sigLog(QString text);
+
+public slots:
+    void tune();
+    void apply(int spi, int baud);
+    void stop();
+
+private slots:
+    void onLink(int spi, int baud);
+    void onFrameGot(const Frame &frame);
+    void onBadFrame(const Frame &frame, int status);
+    void onId(int version);
+    void onError(int cmd);
+    void onTimeout();
+
+private:
+    enum STATE {
+        ST_IDLE,
+        ST_LINK,        // L sent
+        ST_TEST,        // test frames asked for
+        ST_KEEP,        // S sent at the new setting
+        ST_DROP_WAIT,   // back at the old setting, firmware on probation
+        ST_DROP         // S sent at the old setting
+    };
+
+    void nextStep();
+    void tryLink(int spi, int baud);
+    void testDone();
+    void drop();
+    void finish();
+    QString linkName(int spi, int baud);
+
+    CardReader *reader_;
+    QTimer timer_;
+    STATE state_;
+    bool stepping_;     // tune(), not a single apply()
+    bool spi_done_;     // SPI clock at its best, stepping the baud rate
+    int spi_;           // L codes being tried
+    int baud_;
+    int good_;          // test frames back
+    int bad_;
+};
+
+#endif // LINKTUNER_H
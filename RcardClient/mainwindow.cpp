@@ -1,9 +1,18 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 
+#include <QJsonDocument>
+
+#include "tracer.h"
+
+#define STATS_INTERVAL_MS 500
+// the Arduino resets on open and misses what comes before it is up
+#define RESET_WAIT_MS 2000
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::MainWindow)
+    ui(new Ui::MainWindow),
+    tuner_(&reader_)
 {
     ui->setupUi(this);
     foreach( QSerialPortInfo i, QSerialPortInfo::availablePorts()){
@@ -14,14 +23,45 @@ MainWindow::MainWindow(QWidget *parent) :
         ui->gpPorts->layout()->addWidget(w);
     }
 
-    connect(&port_, SIGNAL(readyRead()),
-            this, SLOT(readPort()));
-
-    connect(&rcard_timer_, SIGNAL(timeout()),
-            this, SLOT(onRcardTimer()));
-
-    connect(this, SIGNAL(sigFrameGot()),
-            this, SLOT(saveFrame()));
+    connect(&reader_, SIGNAL(sigFrameGot(Frame)),
+            this, SLOT(onFrameGot(Frame)));
+    connect(&reader_, SIGNAL(sigBadFrame(Frame,int)),
+            this, SLOT(onBadFrame(Frame,int)));
+    connect(&reader_, SIGNAL(sigId(int)),
+            this, SLOT(onId(int)));
+    connect(&reader_, SIGNAL(sigDelay(int)),
+            this, SLOT(onDelay(int)));
+    connect(&reader_, SIGNAL(sigMode(int)),
+            this, SLOT(onMode(int)));
+    connect(&reader_, SIGNAL(sigLink(int,int)),
+            this, SLOT(onLink(int,int)));
+    connect(&reader_, SIGNAL(sigError(int)),
+            this, SLOT(onError(int)));
+    connect(&reader_, SIGNAL(sigTimeout(Frame)),
+            this, SLOT(onTimeout(Frame)));
+    connect(&reader_, SIGNAL(sigFrameFailed(int,int,int)),
+            this, SLOT(onFrameFailed(int,int,int)));
+    connect(&reader_, SIGNAL(sigDumpDone(bool)),
+            this, SLOT(onDumpDone(bool)));
+    connect(&reader_, SIGNAL(sigLog(QString)),
+            this, SLOT(addText(QString)));
+    connect(&reader_, SIGNAL(sigFrameGot(Frame)),
+            &file_, SLOT(writeFrame(Frame)));
+    connect(&tuner_, SIGNAL(sigDone(int,int)),
+            this, SLOT(onLink(int,int)));
+    connect(&tuner_, SIGNAL(sigLog(QString)),
+            this, SLOT(addText(QString)));
+    connect(&reader_, SIGNAL(sigFrameFilled(Frame)),
+            &file_, SLOT(writeFrame(Frame)));
+    connect(&file_, SIGNAL(sigResumed(int)),
+            this, SLOT(onFileResumed(int)));
+    connect(&file_, SIGNAL(sigCardChanged()),
+            this, SLOT(onCardChanged()));
+
+    connect(&stats_timer_, SIGNAL(timeout()),
+            this, SLOT(updateStats()));
+    stats_timer_.start(STATS_INTERVAL_MS);
+    this->updateStats();
 
     // auto select if only one serial port
     if ( all_porots_.length() == 1 ){
@@ -38,9 +78,6 @@ MainWindow::~MainWindow()
 
 void MainWindow::choosePort()
 {
-    if (port_.isOpen())
-        port_.close();
-
     foreach(QRadioButton *w, all_porots_){
         if(w->isChecked()){
             this->setPort(w->text());
@@ -49,75 +86,11 @@ void MainWindow::choosePort()
     }
 }
 
-void MainWindow::readPort()
-{
-    QByteArray bytes = port_.readAll();
-    QString text = QString(bytes.toHex());
-    this->addText(text.toUpper());
-
-    int i;
-    switch ( last_cmd_ ) {
-    case CMD_READ:
-        if ( frame_dbg_.isEmpty() ) {
-            // skip header
-            bytes = bytes.mid(11);
-        }
-        i = frame_dbg_.appendData(bytes) ;
-        if ( i < bytes.size() ){
-            // get remote check sum
-            char checksum = bytes.at(i);
-            char status = bytes.at(i+1);
-            if ( status == 0x47
-                 && checksum == frame_dbg_.checksum()
-                 && frame_dbg_.isFull()){
-                emit sigFrameGot();
-                this->addText("got frame "
-                              + frame_dbg_.indexString());
-                this->addText(frame_dbg_.dataHex());
-            }
-        }
-        break;
-    case CMD_ID:
-        break;
-    }
-}
-
-void MainWindow::sendCmd(int cmd_enum, char msb, char lsb)
-{
-    if (!port_.isOpen())
-        this->openPort(port_.portName());
-
-    char readcmd[] = {'R', msb, lsb};
-    char idcmd[] = {'S'};
-    char delaycmd[] = {'D', msb, lsb};
-
-    switch(cmd_enum){
-    case CMD_READ:
-        port_.write(readcmd, sizeof readcmd);
-        last_cmd_ = CMD_READ;
-        break;
-    case CMD_ID:
-        port_.write(idcmd, sizeof idcmd);
-        last_cmd_ = CMD_ID;
-        break;
-    case CMD_DELAY:
-        port_.write(delaycmd, sizeof delaycmd);
-        last_cmd_ = CMD_DELAY;
-        break;
-    }
-
-    if (port_.error() != QSerialPort::NoError)
-        this->addText("error write Serial."+ port_.errorString());
-
-}
-
 void MainWindow::readFrame(int block, int frame)
 {
     this->addText("readFrame " + QString::number(block)
                   + " , " + QString::number(frame));
-    frame_dbg_.clear();
-    frame_dbg_.setIndex(block,frame);
-    this->sendCmd(CMD_READ, frame_dbg_.msb(), frame_dbg_.lsb());
+    reader_.readFrame(block, frame);
 }
 
 void MainWindow::on_chooseFileBtn_clicked()
@@ -125,7 +98,8 @@ void MainWindow::on_chooseFileBtn_clicked()
     QString fn = openSaveFile();
     if ( fn != ui->fileName->text() )
     ui->fileName->setText(fn);
-    card_.clear();
+    file_.close();
+    reader_.card()->clear();
 }
 
 QString MainWindow::openSaveFile()
@@ -139,46 +113,35 @@ QString MainWindow::openSaveFile()
     return fn;
 }
 
-void MainWindow::setPortParameters()
-{
-    port_.setBaudRate(QSerialPort::Baud38400);
-    // arduino defauts to 8-n-1
-    port_.setDataBits(QSerialPort::Data8);
-    port_.setParity(QSerialPort::NoParity);
-    port_.setStopBits(QSerialPort::OneStop);
-}
-
 void MainWindow::setPort(QString portName)
 {
-    port_.setPortName(portName);
+    reader_.setPortName(portName);
+    ui->portToggle->setChecked(false);
     this->statusBar()->showMessage(portName);
 }
 
 void MainWindow::openPort(QString portName)
 {
-    if ( port_.portName() != portName) {
-        if ( port_.isOpen()) {
-            port_.close();
-        }
+    if ( !portName.isEmpty() )
         this->setPort( portName );
-    }
-    if ( port_.isOpen() )
+    if ( reader_.isOpen() )
         return;
-    if (port_.open(QIODevice::ReadWrite)){  // open
-        this->setPortParameters();
-        this->addText(port_.portName() + " opened.");
+    if (reader_.open()){  // open
+        this->addText(reader_.portName() + " opened.");
         ui->portToggle->setChecked(true);
+        this->onLink(reader_.linkSpi(), reader_.linkBaud());
+        QTimer::singleShot(RESET_WAIT_MS, this, SLOT(applySavedLink()));
     } else {
-        this->addText("error open " + port_.portName());
+        this->addText("error open " + reader_.portName());
         return;
     }
 }
 
 void MainWindow::closePort()
 {
-    if (port_.isOpen()){
-        port_.close();
-        this->addText(port_.portName() + " closed.");
+    if (reader_.isOpen()){
+        reader_.close();
+        this->addText(reader_.portName() + " closed.");
     }
     ui->portToggle->setChecked(false);
 }
@@ -197,7 +160,7 @@ QString MainWindow::char2Hex(char c)
 void MainWindow::on_portToggle_toggled(bool checked)
 {
     if (checked) {
-        this->openPort(port_.portName());
+        this->openPort();
     } else {
         this->closePort();
     }
@@ -205,7 +168,7 @@ void MainWindow::on_portToggle_toggled(bool checked)
 
 void MainWindow::on_idButton_clicked()
 {
-    this->sendCmd(CMD_ID);
+    reader_.readId();
 }
 
 void MainWindow::on_readFrameBtn_clicked()
@@ -216,49 +179,152 @@ void MainWindow::on_readFrameBtn_clicked()
 
 void MainWindow::on_setDelayBtn_clicked()
 {
-    unsigned long d = ui->delayValue->value();
-    char msb = d >> 8;
-    char lsb = d;
-    this->sendCmd(CMD_DELAY, msb, lsb);
+    reader_.setDelay(ui->delayValue->value());
 }
 
 void MainWindow::on_saveCardButton_clicked()
 {
-    rcard_timer_.start(1000);
+    if ( tuner_.isRunning() ) {
+        this->addText("wait for the link tuning to finish");
+        return;
+    }
+    QString fn = ui->fileName->text();
+    if ( !file_.isOpen() || file_.fileName() != fn ) {
+        if ( !file_.open(fn) ) {
+            this->addText("error open " + file_.errorString());
+            return;
+        }
+        // a broken off dump is carried on once the directory matches
+        reader_.card()->clear();
+        if ( file_.isPending() )
+            this->addText("journal found for " + fn
+                          + ", resuming if the card's directory matches");
+    }
+    reader_.startDump();
 }
 
-void MainWindow::onRcardTimer()
+void MainWindow::onFileResumed(int frames)
 {
-    rcard_timer_.stop();
-    qint32 addr;
-    if ( !card_.isFull() ){
-        // which frame is need ?
-        addr  = card_.needFrameAtAddr();
-        // set frame
-        if ( 0 != frame_dbg_.addr() - addr){
-            frame_dbg_.clear();
-            frame_dbg_.setAddress(addr);
-        }
-        // read frame
-        this->readFrame(frame_dbg_.block(),
-                        frame_dbg_.frame());
+    file_.load(reader_.card());
+    this->addText("resuming " + file_.fileName() + ", " + QString::number(frames)
+                  + " frames already there");
+}
 
-        rcard_timer_.start(1000);
-    } else {
-        saveCard2File();
+void MainWindow::onCardChanged()
+{
+    this->addText("journal of " + file_.fileName()
+                  + " is from another card, starting over");
+}
+
+void MainWindow::on_strictToggle_toggled(bool checked)
+{
+    reader_.setStrict(checked);
+}
+
+void MainWindow::on_compressToggle_toggled(bool checked)
+{
+    reader_.setCompression(checked);
+}
+
+void MainWindow::on_tuneLinkBtn_clicked()
+{
+    this->openPort();
+    if ( reader_.isDumping() ) {
+        this->addText("stop reading before tuning the link");
+        return;
     }
+    tuner_.tune();
+}
+
+// Go back to the link tuned for this port before, the reset undid it.
+void MainWindow::applySavedLink()
+{
+    int spi, baud;
+    if ( !reader_.isOpen() || reader_.isDumping()
+         || !LinkTuner::saved(reader_.portName(), &spi, &baud) )
+        return;
+    tuner_.apply(spi, baud);
+}
+
+void MainWindow::onFrameGot(const Frame &frame)
+{
+    this->addText("got frame "
+                  + frame.indexString());
+    this->addText(frame.dataHex());
+}
+
+void MainWindow::onBadFrame(const Frame &frame, int status)
+{
+    this->addText("bad frame " + frame.indexString()
+                  + " status " + char2Hex(status));
+}
+
+void MainWindow::onId(int version)
+{
+    this->addText("rcard protocol " + QString::number(version));
+}
+
+void MainWindow::onDelay(int delay)
+{
+    this->addText("delay " + QString::number(delay));
+}
+
+void MainWindow::onMode(int flags)
+{
+    this->addText("mode " + char2Hex(flags));
+}
+
+void MainWindow::onLink(int spi, int baud)
+{
+    ui->linkLabel->setText(QString("Link: SPI %1 kHz, %2 baud")
+                           .arg(PacketDecoder::linkSpiHz(spi) / 1000)
+                           .arg(PacketDecoder::linkBaud(baud)));
+}
+
+void MainWindow::onError(int cmd)
+{
+    this->addText("error cmd " + char2Hex(cmd));
+}
+
+void MainWindow::onTimeout(const Frame &last)
+{
+    this->addText("timeout frame " + last.indexString());
+}
+
+void MainWindow::onFrameFailed(int sector, int reason, int attempts)
+{
+    Frame f(sector / 64, sector % 64);
+    this->addText("giving up frame " + f.indexString() + ": "
+                  + RetryScheduler::reasonName(reason) + " after "
+                  + QString::number(attempts) + " attempts");
 }
 
-void MainWindow::saveFrame()
+void MainWindow::onDumpDone(bool ok)
 {
-    card_.insertFrame(frame_dbg_);
+    if ( ok )
+        this->saveCard2File();
+    else if ( !reader_.failedFrames().isEmpty() )
+        this->addText("dump failed, "
+                      + QString::number(reader_.failedFrames().size())
+                      + " frames unreadable");
+    else
+        this->addText("dump failed, reader not responding");
 }
 
 void MainWindow::saveCard2File()
 {
-    QFile f(ui->fileName);
+    if ( file_.isOpen() ) {
+        // frames are already in FILE.part, closing puts it in place
+        QString fn = file_.fileName();
+        if ( file_.close() )
+            this->addText(fn + " saved.");
+        else
+            this->addText("error save " + file_.errorString());
+        return;
+    }
+    QFile f(ui->fileName->text());
     if (f.open(QIODevice::WriteOnly)){
-        f.write(card_.data());
+        f.write(reader_.card()->data());
         f.close();
         this->addText(f.fileName() + " saved.");
     }
@@ -266,5 +332,62 @@ void MainWindow::saveCard2File()
 
 void MainWindow::on_stopReadButton_clicked()
 {
-    rcard_timer_.stop();
+    reader_.stopDump();
+}
+
+void MainWindow::on_resetStatsBtn_clicked()
+{
+    reader_.resetStats();
+    this->updateStats();
+}
+
+void MainWindow::on_exportStatsBtn_clicked()
+{
+    QString fn = QFileDialog::getSaveFileName(this,
+                                              tr("Export statistics"),
+                                              QDir::homePath(),
+                                              tr("JSON (*.json)"));
+    if ( fn.isEmpty() )
+        return;
+    QJsonObject o = reader_.stats()->toJson();
+    o["port"] = reader_.portName();
+    o["frames_on_card"] = reader_.card()->frameCount();
+    QFile f(fn);
+    if (f.open(QIODevice::WriteOnly)){
+        f.write(QJsonDocument(o).toJson());
+        f.close();
+        this->addText(f.fileName() + " saved.");
+    } else {
+        this->addText("error write " + fn + ": " + f.errorString());
+    }
+}
+
+void MainWindow::on_traceToggle_toggled(bool checked)
+{
+    if ( checked ) {
+        Tracer::clear();
+        Tracer::setEnabled(true);
+        this->addText("tracing");
+        return;
+    }
+    Tracer::setEnabled(false);
+    QString fn = QFileDialog::getSaveFileName(this,
+                                              tr("Save trace"),
+                                              QDir::homePath(),
+                                              tr("Chrome trace (*.json)"));
+    if ( fn.isEmpty() )
+        return;
+    QString error;
+    if ( Tracer::write(fn, &error) )
+        this->addText(fn + " saved.");
+    else
+        this->addText("error write " + fn + ": " + error);
+}
+
+void MainWindow::updateStats()
+{
+    int left = -1;
+    if ( reader_.isDumping() )
+        left = MemCard::FRAME_COUNT - reader_.card()->frameCount();
+    ui->statsText->setText(reader_.stats()->summary(left));
 }
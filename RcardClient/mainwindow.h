@@ -3,14 +3,15 @@
 
 #include <QMainWindow>
 #include <QSerialPortInfo>
-#include <QSerialPort>
 #include <QRadioButton>
 #include <QFileDialog>
 #include <QTime>
 #include <QTimer>
 #include <QDebug>
 
-#include "memcard.h"
+#include "cardfile.h"
+#include "cardreader.h"
+#include "linktuner.h"
 
 namespace Ui {
 class MainWindow;
@@ -24,19 +25,8 @@ public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
 
-    enum CMD {
-        CMD_READ,
-        CMD_ID,
-        CMD_DELAY
-    };
-
-signals:
-    void sigFrameGot();
-
 private slots:
     void choosePort();
-    void readPort();
-    void sendCmd(int cmd_enum, char msb=0, char lsb=0);
     void readFrame(int block, int frame);
 
     void on_chooseFileBtn_clicked();
@@ -51,27 +41,46 @@ private slots:
 
     void on_saveCardButton_clicked();
 
-    void onRcardTimer();
-    void saveFrame();
+    void on_strictToggle_toggled(bool checked);
+
+    void on_compressToggle_toggled(bool checked);
+
+    void on_tuneLinkBtn_clicked();
+
+    void onFrameGot(const Frame &frame);
+    void onBadFrame(const Frame &frame, int status);
+    void onId(int version);
+    void onDelay(int delay);
+    void onMode(int flags);
+    void onLink(int spi, int baud);
+    void applySavedLink();
+    void onError(int cmd);
+    void onTimeout(const Frame &last);
+    void onFrameFailed(int sector, int reason, int attempts);
+    void onDumpDone(bool ok);
+    void onFileResumed(int frames);
+    void onCardChanged();
     void saveCard2File();
     void on_stopReadButton_clicked();
+    void on_resetStatsBtn_clicked();
+    void on_exportStatsBtn_clicked();
+    void on_traceToggle_toggled(bool checked);
+    void updateStats();
+    void addText(QString text);
 
 private:
     QString openSaveFile();
-    void setPortParameters();
     void setPort(QString portName);
     void openPort(QString portName = QString());
     void closePort();
-    void addText(QString text);
     QString char2Hex(char c);
     Ui::MainWindow *ui;
-    QSerialPort port_;
     QList<QRadioButton*> all_porots_;
-    int last_cmd_;
 
-    Frame frame_dbg_;
-    MemCard card_;
-    QTimer rcard_timer_;
+    CardReader reader_;
+    LinkTuner tuner_;
+    CardFile file_;         // image being dumped, written as frames arrive
+    QTimer stats_timer_;
 };
 
 #endif // MAINWINDOW_H
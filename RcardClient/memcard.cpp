@@ -1,58 +1,79 @@
 #include "memcard.h"
 
-MemCard::MemCard(QObject *parent) : QObject(parent)
-{
+#include <QtAlgorithms>
+#include <string.h>
 
+MemCard::MemCard(QObject *parent) : QObject(parent),
+    data_(CARD_SIZE, 0x00),
+    count_(0)
+{
+    memset(present_, 0, sizeof present_);
 }
 
 qint32 MemCard::needFrameAtAddr()
 {
-    quint32 addr;
-    for (int b =0; b< 16; ++b){
-        for (int f = 0; f< 64; ++f){
-            addr = b * 64 * 128 + f * 128;
-            if ( !frames_.contains(addr)){
-                return addr;
-            }
-        }
+    for (int w = 0; w < FRAME_COUNT / 64; ++w){
+        quint64 missing = ~present_[w];
+        if ( missing )
+            return (w * 64 + qCountTrailingZeroBits(missing)) * FRAME_SIZE;
     }
     return -1;  // full
 }
 
-void MemCard::insertFrame(Frame &f)
+qint32 MemCard::missingFramesFrom(qint32 addr)
+{
+    qint32 n = 0;
+    int i = addr / FRAME_SIZE;
+    while ( i < FRAME_COUNT ){
+        int b = i % 64;
+        quint64 present = present_[i / 64] >> b;
+        if ( present )
+            return n + qCountTrailingZeroBits(present);
+        n += 64 - b;
+        i += 64 - b;
+    }
+    return n;
+}
+
+bool MemCard::hasFrameAtAddr(qint32 addr)
 {
-    frames_.insert(f.addr(), new Frame(&f));
-    if (isFull())
-        emit sigFull();
+    int i = addr / FRAME_SIZE;
+    return present_[i / 64] & (Q_UINT64_C(1) << (i % 64));
+}
+
+void MemCard::insertFrame(const Frame &f)
+{
+    if ( !f.isFull() || f.addr() >= CARD_SIZE )
+        return;
+    int i = f.addr() / FRAME_SIZE;
+    memcpy(data_.data() + f.addr(), f.constData(), FRAME_SIZE);
+    if ( !hasFrameAtAddr(f.addr()) ){
+        present_[i / 64] |= Q_UINT64_C(1) << (i % 64);
+        ++count_;
+        if (isFull())
+            emit sigFull();
+    }
 }
 
 bool MemCard::isFull()
 {
-    if ( this->needFrameAtAddr() < 0 )
-        return true;
-    else
-        return false;
+    return count_ == FRAME_COUNT;
+}
+
+int MemCard::frameCount()
+{
+    return count_;
 }
 
 QByteArray MemCard::data()
 {
-    QByteArray data;
-    quint32 addr;
-    for (int b =0; b< 16; ++b){
-        for (int f = 0; f< 64; ++f){
-            addr = b * 64 * 128 + f * 128;
-            if ( !frames_.contains(addr)){
-                data.append(frames_.value(addr)->data());
-            } else {
-                data.append(QByteArray(128,0x00));
-            }
-        }
-    }
-    return data;
+    // implicitly shared, no copy
+    return data_;
 }
 
 void MemCard::clear()
 {
-    frames_.clear();
+    data_.fill(0x00);
+    memset(present_, 0, sizeof present_);
+    count_ = 0;
 }
-
@@ -2,7 +2,7 @@
 #define MEMCARD_H
 
 #include <QObject>
-#include <QHash>
+#include <QByteArray>
 #include "frame.h"
 
 class MemCard : public QObject
@@ -10,9 +10,19 @@ class MemCard : public QObject
     Q_OBJECT
 public:
     explicit MemCard(QObject *parent = 0);
+
+    enum {
+        FRAME_SIZE = 128,
+        FRAME_COUNT = 16 * 64,
+        CARD_SIZE = FRAME_SIZE * FRAME_COUNT
+    };
+
     qint32 needFrameAtAddr();
-    void insertFrame(Frame &f);
+    qint32 missingFramesFrom(qint32 addr);
+    bool hasFrameAtAddr(qint32 addr);
+    void insertFrame(const Frame &f);
     bool isFull();
+    int frameCount();
     QByteArray data();
 signals:
     void sigFull();
@@ -20,7 +30,9 @@ signals:
 public slots:
     void clear();
 private:
-    QHash< quint32, Frame* > frames_;
+    QByteArray data_;                   // whole card image, missing frames are 0
+    quint64 present_[FRAME_COUNT / 64]; // one bit per frame
+    int count_;
 };
 
 #endif // MEMCARD_H
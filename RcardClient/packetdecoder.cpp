@@ -0,0 +1,253 @@
+#include "packetdecoder.h"
+
+#include <string.h>
+
+PacketDecoder::PacketDecoder(QObject *parent) : QObject(parent),
+    pos_(0),
+    state_(ST_SYNC0),
+    crc_(0xFFFF),
+    rx_crc_(0),
+    type_(0),
+    seq_(0),
+    len_(0),
+    got_(0),
+    code_len_(0),
+    crc_errors_(0)
+{
+    memset(head_, 0, sizeof head_);
+}
+
+// Thin wrappers around psx_proto.c, the coders the C tools use too.
+quint16 PacketDecoder::crc16(quint16 crc, const char *data, int len)
+{
+    return psx_crc16(crc, (const uint8_t *)data, len);
+}
+
+int PacketDecoder::rleEncode(const char *in, int len, char *out, int max)
+{
+    return psx_rle_encode((const uint8_t *)in, len, (uint8_t *)out, max);
+}
+
+int PacketDecoder::rleDecode(const char *in, int len, char *out, int max)
+{
+    return psx_rle_decode((const uint8_t *)in, len, (uint8_t *)out, max);
+}
+
+qint32 PacketDecoder::linkSpiHz(int code)
+{
+    return psx_link_spi_hz[qBound(0, code, LINK_SPIS - 1)];
+}
+
+qint32 PacketDecoder::linkBaud(int code)
+{
+    return psx_link_baud[qBound(0, code, LINK_BAUDS - 1)];
+}
+
+quint32 PacketDecoder::crcErrors()
+{
+    return crc_errors_;
+}
+
+// Read everything available on dev directly into the ring and parse it.
+qint64 PacketDecoder::readFrom(QIODevice *dev)
+{
+    qint64 total = 0;
+    for (;;) {
+        int room;
+        char *w = ring_.writePtr(&room);
+        if ( room == 0 )
+            break;
+        qint64 n = dev->read(w, room);
+        if ( n <= 0 )
+            break;
+        ring_.commit(n);
+        total += n;
+        this->parse();
+    }
+    return total;
+}
+
+void PacketDecoder::feed(const char *data, int len)
+{
+    while ( len > 0 ) {
+        int room;
+        char *w = ring_.writePtr(&room);
+        int n = qMin(room, len);
+        memcpy(w, data, n);
+        ring_.commit(n);
+        data += n;
+        len -= n;
+        this->parse();
+    }
+}
+
+void PacketDecoder::clear()
+{
+    ring_.clear();
+    pos_ = 0;
+    state_ = ST_SYNC0;
+}
+
+void PacketDecoder::parse()
+{
+    while ( pos_ < ring_.size() ) {
+        if ( state_ == ST_PAYLOAD ) {
+            // take as much of the payload as is contiguous
+            int n;
+            const char *p = ring_.readPtr(pos_, &n);
+            n = qMin(n, len_ - got_);
+            crc_ = crc16(crc_, p, n);
+            this->takePayload(p, n);
+            pos_ += n;
+            if ( got_ == len_ )
+                state_ = ST_CRC0;
+            continue;
+        }
+
+        uchar c = ring_.at(pos_++);
+        switch ( state_ ) {
+        case ST_SYNC0:
+            if ( c == SYNC0 ) {
+                state_ = ST_SYNC1;
+                break;
+            }
+            // nothing is pending before a sync, drop it right away
+            ring_.consume(1);
+            pos_ = 0;
+            break;
+        case ST_SYNC1:
+            if ( c != SYNC1 ) {
+                this->resync();
+                break;
+            }
+            crc_ = 0xFFFF;
+            state_ = ST_VER;
+            break;
+        case ST_VER:
+            if ( c != VERSION ) {
+                this->resync();
+                break;
+            }
+            crc_ = crc16(crc_, (const char *)&c, 1);
+            state_ = ST_TYPE;
+            break;
+        case ST_TYPE:
+            type_ = c;
+            crc_ = crc16(crc_, (const char *)&c, 1);
+            state_ = ST_SEQ;
+            break;
+        case ST_SEQ:
+            seq_ = c;
+            crc_ = crc16(crc_, (const char *)&c, 1);
+            state_ = ST_LEN;
+            break;
+        case ST_LEN:
+            len_ = c;
+            got_ = 0;
+            code_len_ = 0;
+            frame_.clear();
+            crc_ = crc16(crc_, (const char *)&c, 1);
+            state_ = len_ ? ST_PAYLOAD : ST_CRC0;
+            break;
+        case ST_CRC0:
+            rx_crc_ = c;
+            state_ = ST_CRC1;
+            break;
+        case ST_CRC1:
+            rx_crc_ |= c << 8;
+            if ( rx_crc_ != crc_ ) {
+                ++crc_errors_;
+                this->resync();
+                break;
+            }
+            // the packet is complete, release it before anyone reacts
+            ring_.consume(pos_);
+            pos_ = 0;
+            state_ = ST_SYNC0;
+            this->emitPacket();
+            break;
+        case ST_PAYLOAD:
+            break;
+        }
+    }
+}
+
+void PacketDecoder::takePayload(const char *p, int n)
+{
+    // the first four bytes (three of a PKT_FRAME_RLE) are header
+    // fields of every packet type, the rest is frame data or, up to the
+    // size of a frame, kept in code_
+    quint8 head_len = type_ == PKT_FRAME_RLE ? 3 : sizeof head_;
+    while ( n > 0 && got_ < head_len ) {
+        head_[got_++] = *p++;
+        --n;
+        if ( got_ == 2 && (type_ == PKT_FRAME || type_ == PKT_FRAME_RLE) )
+            frame_.setAddress((((head_[0] << 8) | head_[1]) & 0x3FF) * Frame::SIZE);
+    }
+    if ( n > 0 ) {
+        if ( type_ == PKT_FRAME )
+            frame_.appendData(p, n);
+        if ( type_ != PKT_FRAME ) {
+            // the code is shorter than a frame, more is not ours
+            int k = qMin(n, (int)sizeof code_ - code_len_);
+            memcpy(code_ + code_len_, p, k);
+            code_len_ += k;
+        }
+        got_ += n;
+    }
+}
+
+void PacketDecoder::emitPacket()
+{
+    switch ( type_ ) {
+    case PKT_FRAME:
+        if ( len_ == 4 + Frame::SIZE )
+            emit sigFrame(seq_, frame_, (char)head_[2], (char)head_[3]);
+        break;
+    case PKT_FRAME_RLE:
+        if ( len_ > 3 && len_ - 3 == code_len_ ) {
+            char data[Frame::SIZE];
+            if ( rleDecode(code_, code_len_, data, sizeof data) != Frame::SIZE )
+                break;
+            frame_.appendData(data, Frame::SIZE);
+            char checksum = frame_.checksum();
+            if ( head_[0] & RLE_BAD_CHECKSUM )
+                checksum = ~checksum;
+            emit sigFrame(seq_, frame_, (char)head_[2], checksum);
+        }
+        break;
+    case PKT_ID:
+        emit sigId(seq_, len_ > 0 ? head_[0] : 0);
+        break;
+    case PKT_DELAY:
+        if ( len_ >= 2 )
+            emit sigDelay(seq_, (head_[0] << 8) | head_[1]);
+        break;
+    case PKT_MODE:
+        emit sigMode(seq_, len_ > 0 ? head_[0] : 0);
+        break;
+    case PKT_LINK:
+        if ( len_ >= 2 )
+            emit sigLink(seq_, head_[0], head_[1]);
+        break;
+    case PKT_ACKSTAT:
+        if ( len_ >= ACKSTAT_SIZE ) {
+            QByteArray payload((const char *)head_, sizeof head_);
+            payload.append(code_, code_len_);
+            emit sigAckStat(seq_, payload);
+        }
+        break;
+    case PKT_ERROR:
+        emit sigError(seq_, len_ > 0 ? head_[0] : 0);
+        break;
+    }
+}
+
+// Not a packet after all. Look for the next sync right after the
+// first byte of the rejected one, the rest may still hold a packet.
+void PacketDecoder::resync()
+{
+    ring_.consume(1);
+    pos_ = 0;
+    state_ = ST_SYNC0;
+}
@@ -0,0 +1,122 @@
+#ifndef PACKETDECODER_H
+#define PACKETDECODER_H
+
+#include <QObject>
+#include <QIODevice>
+#include "frame.h"
+#include "psx_proto.h"
+#include "ringbuffer.h"
+
+/* Streaming decoder for the response packets of the firmware, see
+ * psx_proto.h for the format; CRC and PackBits are the C ones.
+ *
+ * Bytes are read from the device straight into a ring buffer and parsed
+ * in place by a resumable state machine, so chunks may be split anywhere.
+ * A packet failing its CRC is dropped and the search for the next sync
+ * restarts right after its first byte.
+ *
+ * PKT_FRAME_RLE is handed on as an ordinary frame; the checksum the
+ * device found bad is passed inverted so the receiver sees the mismatch
+ * as before.
+ *
+ * PKT_LINK answers L spi baud, the codes index linkSpiHz()/linkBaud().
+ * PKT_ACKSTAT is handed on as the raw payload.
+ */
+class PacketDecoder : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PacketDecoder(QObject *parent = 0);
+
+    enum {
+        SYNC0 = PSX_PKT_SYNC0,
+        SYNC1 = PSX_PKT_SYNC1,
+        VERSION = PSX_PKT_VERSION,
+        HEADER_SIZE = PSX_PKT_HEADER,
+        CRC_SIZE = PSX_PKT_CRC
+    };
+
+    enum TYPE {
+        PKT_FRAME = PSX_PKT_FRAME,
+        PKT_ID = PSX_PKT_ID,
+        PKT_DELAY = PSX_PKT_DELAY,
+        PKT_MODE = PSX_PKT_MODE,
+        PKT_FRAME_RLE = PSX_PKT_FRAME_RLE,
+        PKT_LINK = PSX_PKT_LINK,
+        PKT_ACKSTAT = PSX_PKT_ACKSTAT,
+        PKT_ERROR = PSX_PKT_ERROR
+    };
+
+    enum MODE {
+        MODE_RLE = PSX_MODE_RLE,
+        RLE_BAD_CHECKSUM = PSX_RLE_BAD_CHECKSUM
+    };
+
+    enum ACK {
+        ACK_CLEAR = PSX_ACK_CLEAR,
+        ACK_BUCKETS = PSX_ACK_BUCKETS,
+        ACKSTAT_SIZE = PSX_ACKSTAT_LEN
+    };
+
+    enum LINK {
+        LINK_SPIS = PSX_LINK_SPIS,
+        LINK_BAUDS = PSX_LINK_BAUDS,
+        LINK_PROBATION_MS = PSX_LINK_PROBATION  // L undone unless an S follows in time
+    };
+
+    static quint16 crc16(quint16 crc, const char *data, int len);
+    static int rleEncode(const char *in, int len, char *out, int max);
+    static int rleDecode(const char *in, int len, char *out, int max);
+    static qint32 linkSpiHz(int code);
+    static qint32 linkBaud(int code);
+    quint32 crcErrors();
+
+signals:
+    void sigFrame(int seq, const Frame &frame, int status, int checksum);
+    void sigId(int seq, int version);
+    void sigDelay(int seq, int delay);
+    void sigMode(int seq, int flags);
+    void sigLink(int seq, int spi, int baud);
+    void sigAckStat(int seq, const QByteArray &payload);
+    void sigError(int seq, int cmd);
+
+public slots:
+    qint64 readFrom(QIODevice *dev);
+    void feed(const char *data, int len);
+    void clear();
+
+private:
+    enum STATE {
+        ST_SYNC0,
+        ST_SYNC1,
+        ST_VER,
+        ST_TYPE,
+        ST_SEQ,
+        ST_LEN,
+        ST_PAYLOAD,
+        ST_CRC0,
+        ST_CRC1
+    };
+
+    void parse();
+    void takePayload(const char *p, int n);
+    void emitPacket();
+    void resync();
+
+    RingBuffer ring_;
+    int pos_;           // parse position, relative to the ring start
+    STATE state_;
+    quint16 crc_;
+    quint16 rx_crc_;
+    quint8 type_;
+    quint8 seq_;
+    quint8 len_;
+    quint8 got_;        // payload bytes taken
+    quint8 head_[4];    // first payload bytes
+    char code_[Frame::SIZE];    // RLE code of a PKT_FRAME_RLE, rest of others
+    int code_len_;
+    Frame frame_;
+    quint32 crc_errors_;
+};
+
+#endif // PACKETDECODER_H
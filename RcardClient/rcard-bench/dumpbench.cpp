@@ -0,0 +1,184 @@
+#include "dumpbench.h"
+
+#include <QDateTime>
+#include <algorithm>
+
+// as in rcard-dump, the Arduino needs ~2 s after the port is opened
+#define PROBE_INTERVAL_MS 250
+#define PROBES_MAX 20
+
+DumpBench::DumpBench(QObject *parent) : QObject(parent),
+    rounds_(5),
+    round_(0),
+    probes_(0),
+    started_(false),
+    round_start_ns_(0),
+    last_ns_(0),
+    total_ns_(0),
+    frames_(0),
+    bad_(0),
+    timeouts_(0)
+{
+    sim_.setObjectName("sim");
+    reader_.setDevice(&sim_);
+    // every frame, so the dump can be compared with the image
+    reader_.setStrict(true);
+
+    connect(&reader_, SIGNAL(sigId(int)),
+            this, SLOT(onId(int)));
+    connect(&reader_, SIGNAL(sigFrameGot(Frame)),
+            this, SLOT(onFrameGot(Frame)));
+    connect(&reader_, SIGNAL(sigBadFrame(Frame,int)),
+            this, SLOT(onBadFrame(Frame,int)));
+    connect(&reader_, SIGNAL(sigTimeout(Frame)),
+            this, SLOT(onTimeout(Frame)));
+    connect(&reader_, SIGNAL(sigDumpDone(bool)),
+            this, SLOT(onDumpDone(bool)));
+
+    connect(&probe_timer_, SIGNAL(timeout()),
+            this, SLOT(probe()));
+}
+
+void DumpBench::setPortName(QString portName)
+{
+    port_name_ = portName;
+    reader_.setDevice(portName.isEmpty() ? &sim_ : 0);
+    if ( !portName.isEmpty() )
+        reader_.setPortName(portName);
+}
+
+void DumpBench::setBaudRate(qint32 baud)
+{
+    reader_.setBaudRate(baud);
+}
+
+void DumpBench::setCompression(bool compress)
+{
+    reader_.setCompression(compress);
+}
+
+void DumpBench::setImage(const QByteArray &image)
+{
+    image_ = image;
+    sim_.setImage(image);
+}
+
+void DumpBench::setRounds(int rounds)
+{
+    rounds_ = rounds;
+}
+
+void DumpBench::start()
+{
+    if ( !reader_.open() ) {
+        this->finish("open " + reader_.portName() + ": " + reader_.errorString());
+        return;
+    }
+    this->probe();
+    probe_timer_.start(PROBE_INTERVAL_MS);
+}
+
+void DumpBench::probe()
+{
+    if ( ++probes_ > PROBES_MAX ) {
+        this->finish("no reader on " + reader_.portName());
+        return;
+    }
+    reader_.readId();
+}
+
+void DumpBench::onId(int version)
+{
+    Q_UNUSED(version);
+    if ( started_ )
+        return;
+    started_ = true;
+    probe_timer_.stop();
+    elapsed_.start();
+    this->startRound();
+}
+
+void DumpBench::startRound()
+{
+    reader_.card()->clear();
+    round_start_ns_ = last_ns_ = elapsed_.nsecsElapsed();
+    reader_.startDump();
+}
+
+void DumpBench::onFrameGot(const Frame &frame)
+{
+    Q_UNUSED(frame);
+    qint64 now = elapsed_.nsecsElapsed();
+    gaps_.append(now - last_ns_);
+    last_ns_ = now;
+    ++frames_;
+}
+
+void DumpBench::onBadFrame(const Frame &frame, int status)
+{
+    Q_UNUSED(frame);
+    Q_UNUSED(status);
+    ++bad_;
+}
+
+void DumpBench::onTimeout(const Frame &last)
+{
+    Q_UNUSED(last);
+    ++timeouts_;
+}
+
+void DumpBench::onDumpDone(bool ok)
+{
+    total_ns_ += elapsed_.nsecsElapsed() - round_start_ns_;
+    if ( !ok ) {
+        this->finish("reader stopped answering");
+        return;
+    }
+    if ( !image_.isEmpty() && reader_.card()->data() != image_ ) {
+        this->finish("card differs from image");
+        return;
+    }
+    if ( ++round_ < rounds_ )
+        this->startRound();
+    else
+        this->finish(QString());
+}
+
+void DumpBench::finish(QString error)
+{
+    probe_timer_.stop();
+    reader_.close();
+    error_ = error;
+    emit sigFinished();
+}
+
+QJsonObject DumpBench::result()
+{
+    QJsonObject r;
+    r["name"] = "client-dump";
+    r["link"] = port_name_.isEmpty() ? "sim" : port_name_;
+    r["ok"] = error_.isEmpty();
+    if ( !error_.isEmpty() )
+        r["error"] = error_;
+    r["ops"] = round_;
+    r["frames"] = frames_;
+    r["bad_frames"] = bad_;
+    r["timeouts"] = timeouts_;
+    r["compressed"] = reader_.isCompressing();
+    // stats cover the last round only
+    r["rx_bytes_last"] = double(reader_.stats()->rx_bytes);
+    double s = total_ns_ / 1e9;
+    r["seconds"] = s;
+    r["frames_per_sec"] = s > 0 ? frames_ / s : 0.0;
+
+    QVector<qint64> g = gaps_;
+    QJsonObject lat;
+    if ( !g.isEmpty() ) {
+        std::sort(g.begin(), g.end());
+        lat["p50"] = g.at(g.size() / 2) / 1e6;
+        lat["p99"] = g.at(g.size() * 99 / 100) / 1e6;
+        lat["max"] = g.last() / 1e6;
+    }
+    r["latency_ms"] = lat;
+    return r;
+}
@@ -0,0 +1,71 @@
+#ifndef DUMPBENCH_H
+#define DUMPBENCH_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QTimer>
+#include <QVector>
+
+#include "cardreader.h"
+#include "simdevice.h"
+
+/* Whole-card dumps through CardReader, timed from the first command
+ * to the last frame. Runs on a SimDevice unless given a port, e.g. a
+ * reader or rcard-emu. Per-frame latency is the time between two good
+ * frames, so timeouts and retries show as p99 and max.
+ */
+class DumpBench : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DumpBench(QObject *parent = 0);
+
+    void setPortName(QString portName);
+    void setBaudRate(qint32 baud);
+    void setImage(const QByteArray &image);
+    void setRounds(int rounds);
+    void setCompression(bool compress);
+
+    QJsonObject result();
+
+signals:
+    void sigFinished();
+
+public slots:
+    void start();
+
+private slots:
+    void probe();
+    void onId(int version);
+    void onFrameGot(const Frame &frame);
+    void onBadFrame(const Frame &frame, int status);
+    void onTimeout(const Frame &last);
+    void onDumpDone(bool ok);
+
+private:
+    void startRound();
+    void finish(QString error);
+
+    SimDevice sim_;
+    CardReader reader_;
+    QByteArray image_;
+    QString port_name_;
+    QString error_;
+    int rounds_;
+    int round_;
+    int probes_;
+    bool started_;
+    QTimer probe_timer_;
+
+    QElapsedTimer elapsed_;
+    qint64 round_start_ns_;
+    qint64 last_ns_;
+    qint64 total_ns_;
+    QVector<qint64> gaps_;      // ns between good frames
+    int frames_;
+    int bad_;
+    int timeouts_;
+};
+
+#endif // DUMPBENCH_H
@@ -0,0 +1,237 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <stdio.h>
+
+#include "dumpbench.h"
+#include "frame.h"
+#include "memcard.h"
+#include "tracer.h"
+
+// keeps the compiler from dropping the measured work
+static volatile int sink;
+
+// same generator as the C rcard-bench, so both use the same image
+static QByteArray testImage()
+{
+    QByteArray img(MemCard::CARD_SIZE, 0);
+    quint32 x = 0x2545f491;
+    for (int i = 0; i < img.size(); i++){
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        img[i] = char(x);
+    }
+    return img;
+}
+
+static QJsonObject result(const char *name, qint64 ops, qint64 ns)
+{
+    QJsonObject r;
+    r["name"] = name;
+    r["ops"] = ops;
+    r["ns_per_op"] = double(ns) / ops;
+    printf("%-28s %10lld %12.1f\n", name, (long long)ops, double(ns) / ops);
+    return r;
+}
+
+static QJsonObject benchAppend(const QByteArray &img, int chunk, int ops)
+{
+    QElapsedTimer t;
+    Frame f;
+    const char *p = img.constData();
+    t.start();
+    for (int i = 0; i < ops; i++){
+        f.clear();
+        for (int n = 0; n < Frame::SIZE; n += chunk)
+            f.appendData(p + n, chunk);
+        sink += f.checksum();
+        p = img.constData() + (i & (MemCard::FRAME_COUNT - 1)) * Frame::SIZE;
+    }
+    return result(chunk == Frame::SIZE ? "frame-append" : "frame-append-32",
+                  ops, t.nsecsElapsed());
+}
+
+// what a dump does per frame: insert it, then look for the next one
+static QJsonObject benchFill(const QByteArray &img, int rounds)
+{
+    QVector<Frame> frames;
+    for (int i = 0; i < MemCard::FRAME_COUNT; i++)
+        frames.append(Frame(i / 64, i % 64,
+                            img.constData() + i * Frame::SIZE, Frame::SIZE));
+    MemCard card;
+    QElapsedTimer t;
+    qint64 ns = 0;
+    for (int r = 0; r < rounds; r++){
+        card.clear();
+        t.start();
+        foreach (const Frame &f, frames){
+            card.insertFrame(f);
+            qint32 next = card.needFrameAtAddr();
+            if ( next >= 0 )
+                sink += card.missingFramesFrom(next);
+        }
+        ns += t.nsecsElapsed();
+    }
+    return result("card-insert-next", qint64(rounds) * MemCard::FRAME_COUNT, ns);
+}
+
+// worst case scan: only the last frame is missing
+static QJsonObject benchNeed(const QByteArray &img, int ops)
+{
+    MemCard card;
+    for (int i = 0; i < MemCard::FRAME_COUNT - 1; i++)
+        card.insertFrame(Frame(i / 64, i % 64,
+                               img.constData() + i * Frame::SIZE, Frame::SIZE));
+    QElapsedTimer t;
+    t.start();
+    for (int i = 0; i < ops; i++)
+        sink += card.needFrameAtAddr();
+    return result("card-need-last", ops, t.nsecsElapsed());
+}
+
+static QJsonObject benchData(int ops)
+{
+    MemCard card;
+    QElapsedTimer t;
+    t.start();
+    for (int i = 0; i < ops; i++){
+        QByteArray d = card.data();
+        sink += d.constData()[i & (MemCard::CARD_SIZE - 1)];
+    }
+    return result("card-data", ops, t.nsecsElapsed());
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("rcard-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+                "Benchmark the client: frame and card bookkeeping, then\n"
+                "whole-card dumps through CardReader, on a simulated reader\n"
+                "unless a port is given.");
+    parser.addHelpOption();
+    QCommandLineOption jsonOpt(QStringList() << "j" << "json",
+                               "Also write the results to file as JSON.", "file");
+    QCommandLineOption portOpt(QStringList() << "p" << "port",
+                               "Dump from this reader, e.g. an rcard-emu pty.", "port");
+    QCommandLineOption baudOpt(QStringList() << "b" << "baud",
+                               "Serial baud rate.", "baud", "38400");
+    QCommandLineOption imageOpt(QStringList() << "i" << "image",
+                                "Card image for the simulated reader.", "file");
+    QCommandLineOption roundsOpt(QStringList() << "r" << "rounds",
+                                 "Whole-card dumps to time.", "n", "5");
+    QCommandLineOption noDumpOpt(QStringList() << "n" << "no-dump",
+                                 "Only run the bookkeeping benchmarks.");
+    QCommandLineOption compressOpt(QStringList() << "z" << "compress",
+                                   "Ask the reader for RLE coded frames.");
+    QCommandLineOption traceOpt(QStringList() << "t" << "trace",
+                                "Record a timeline of the dumps to file\n"
+                                "as Chrome trace event JSON.", "file");
+    parser.addOption(jsonOpt);
+    parser.addOption(portOpt);
+    parser.addOption(baudOpt);
+    parser.addOption(imageOpt);
+    parser.addOption(roundsOpt);
+    parser.addOption(noDumpOpt);
+    parser.addOption(compressOpt);
+    parser.addOption(traceOpt);
+    parser.process(a);
+
+    bool ok = false;
+    qint32 baud = parser.value(baudOpt).toInt(&ok);
+    int rounds = ok ? parser.value(roundsOpt).toInt(&ok) : 0;
+    if ( !ok || rounds < 1 ) {
+        fputs(qPrintable(parser.helpText()), stderr);
+        return 1;
+    }
+
+    QByteArray img = testImage();
+    if ( parser.isSet(imageOpt) ) {
+        QFile f(parser.value(imageOpt));
+        if ( !f.open(QIODevice::ReadOnly) ) {
+            fprintf(stderr, "%s: %s\n", qPrintable(f.fileName()),
+                    qPrintable(f.errorString()));
+            return 1;
+        }
+        img = f.readAll();
+        if ( img.size() != MemCard::CARD_SIZE ) {
+            fprintf(stderr, "%s: not a %d byte card image\n",
+                    qPrintable(f.fileName()), int(MemCard::CARD_SIZE));
+            return 1;
+        }
+    }
+
+    QJsonArray results;
+    printf("%-28s %10s %12s\n", "benchmark", "ops", "ns/op");
+    results.append(benchAppend(img, Frame::SIZE, 1000000));
+    results.append(benchAppend(img, 32, 1000000));
+    results.append(benchFill(img, 200));
+    results.append(benchNeed(img, 1000000));
+    results.append(benchData(100000));
+
+    int ret = 0;
+    if ( !parser.isSet(noDumpOpt) ) {
+        DumpBench d;
+        d.setRounds(rounds);
+        d.setBaudRate(baud);
+        d.setCompression(parser.isSet(compressOpt));
+        if ( parser.isSet(portOpt) )
+            d.setPortName(parser.value(portOpt));
+        else
+            d.setImage(img);
+        QObject::connect(&d, SIGNAL(sigFinished()),
+                         &a, SLOT(quit()));
+        QMetaObject::invokeMethod(&d, "start", Qt::QueuedConnection);
+        Tracer::setEnabled(parser.isSet(traceOpt));
+        a.exec();
+        Tracer::setEnabled(false);
+
+        QJsonObject r = d.result();
+        QJsonObject lat = r["latency_ms"].toObject();
+        printf("\n%-28s %6s %10s %8s %8s %8s %6s %8s\n", "dump", "ops", "frames/s",
+               "p50 ms", "p99 ms", "max ms", "bad", "timeouts");
+        printf("%-28s %6d %10.1f %8.3f %8.3f %8.3f %6d %8d\n",
+               qPrintable(r["link"].toString()), r["ops"].toInt(),
+               r["frames_per_sec"].toDouble(), lat["p50"].toDouble(),
+               lat["p99"].toDouble(), lat["max"].toDouble(),
+               r["bad_frames"].toInt(), r["timeouts"].toInt());
+        if ( !r["ok"].toBool() ) {
+            fprintf(stderr, "dump: %s\n", qPrintable(r["error"].toString()));
+            ret = 3;
+        }
+        results.append(r);
+    }
+
+    if ( parser.isSet(traceOpt) ) {
+        QString error;
+        if ( !Tracer::write(parser.value(traceOpt), &error) ) {
+            fprintf(stderr, "%s: %s\n", qPrintable(parser.value(traceOpt)),
+                    qPrintable(error));
+            return 5;
+        }
+    }
+
+    if ( parser.isSet(jsonOpt) ) {
+        QJsonObject doc;
+        doc["tool"] = "rcard-bench";
+        doc["side"] = "client";
+        doc["time"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+        doc["results"] = results;
+        QFile f(parser.value(jsonOpt));
+        if ( !f.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+             f.write(QJsonDocument(doc).toJson()) < 0 ) {
+            fprintf(stderr, "%s: %s\n", qPrintable(f.fileName()),
+                    qPrintable(f.errorString()));
+            return 5;
+        }
+    }
+    return ret;
+}
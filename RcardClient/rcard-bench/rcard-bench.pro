@@ -0,0 +1,21 @@
+#-------------------------------------------------
+#
+# rcard-bench: client side benchmarks
+#
+#-------------------------------------------------
+
+QT       += core serialport
+QT       -= gui
+
+TARGET = rcard-bench
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+include(../core.pri)
+
+SOURCES += main.cpp \
+    dumpbench.cpp
+
+HEADERS += dumpbench.h
@@ -0,0 +1,319 @@
+#include "dumper.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QStringList>
+#include <stdio.h>
+#include <string.h>
+
+// the Arduino resets when the port is opened, its bootloader
+// takes up to 2 s before the sketch answers
+#define PROBE_INTERVAL_MS 250
+#define PROBES_MAX 20
+// for the /ACK statistics the reader sends after a dump
+#define ACK_STATS_MS 1000
+// port name of a simulated reader, followed by its card image
+#define SIM_PREFIX "sim:"
+
+Dumper::Dumper(QObject *parent) : QObject(parent),
+    verify_(false),
+    progress_(false),
+    started_(false),
+    finished_(false),
+    stats_wait_(false),
+    code_(EXIT_OK),
+    probes_(0),
+    out_(stdout)
+{
+    connect(&reader_, SIGNAL(sigId(int)),
+            this, SLOT(onId(int)));
+    connect(&reader_, SIGNAL(sigProgress(int,int)),
+            this, SLOT(onProgress(int,int)));
+    connect(&reader_, SIGNAL(sigBadFrame(Frame,int)),
+            this, SLOT(onBadFrame(Frame,int)));
+    connect(&reader_, SIGNAL(sigTimeout(Frame)),
+            this, SLOT(onTimeout(Frame)));
+    connect(&reader_, SIGNAL(sigFrameFailed(int,int,int)),
+            this, SLOT(onFrameFailed(int,int,int)));
+    connect(&reader_, SIGNAL(sigDumpDone(bool)),
+            this, SLOT(onDumpDone(bool)));
+    connect(&reader_, SIGNAL(sigAckStats()),
+            this, SLOT(onAckStats()));
+    connect(&reader_, SIGNAL(sigFrameGot(Frame)),
+            &file_, SLOT(writeFrame(Frame)));
+    connect(&reader_, SIGNAL(sigFrameFilled(Frame)),
+            &file_, SLOT(writeFrame(Frame)));
+    connect(&file_, SIGNAL(sigResumed(int)),
+            this, SLOT(onFileResumed(int)));
+    connect(&file_, SIGNAL(sigCardChanged()),
+            this, SLOT(onCardChanged()));
+
+    connect(&probe_timer_, SIGNAL(timeout()),
+            this, SLOT(probe()));
+    stats_timer_.setSingleShot(true);
+    connect(&stats_timer_, SIGNAL(timeout()),
+            this, SLOT(onAckStats()));
+}
+
+void Dumper::setPortName(QString portName)
+{
+    if ( portName.startsWith(SIM_PREFIX) ) {
+        // a missing image shows up as an open error in start()
+        sim_.setObjectName(portName);
+        sim_.loadImage(portName.mid(strlen(SIM_PREFIX)));
+        reader_.setDevice(&sim_);
+        return;
+    }
+    reader_.setDevice(0);
+    reader_.setPortName(portName);
+}
+
+void Dumper::setBaudRate(qint32 baud)
+{
+    reader_.setBaudRate(baud);
+}
+
+void Dumper::setFileName(QString fileName)
+{
+    file_name_ = fileName;
+}
+
+void Dumper::setVerify(bool verify)
+{
+    verify_ = verify;
+}
+
+void Dumper::setStrict(bool strict)
+{
+    reader_.setStrict(strict);
+}
+
+void Dumper::setCompression(bool compress)
+{
+    reader_.setCompression(compress);
+}
+
+void Dumper::setProgress(bool progress)
+{
+    progress_ = progress;
+}
+
+QString Dumper::portName()
+{
+    return reader_.portName();
+}
+
+int Dumper::frames()
+{
+    return reader_.card()->frameCount();
+}
+
+bool Dumper::isFinished()
+{
+    return finished_;
+}
+
+int Dumper::exitCode()
+{
+    return code_;
+}
+
+QJsonObject Dumper::stats()
+{
+    QJsonObject o = reader_.stats()->toJson();
+    o["port"] = reader_.portName();
+    o["file"] = file_name_;
+    o["exit_code"] = code_;
+    o["frames_on_card"] = this->frames();
+    QJsonArray failed;
+    foreach (int sector, reader_.failedFrames())
+        failed.append(sector);
+    o["failed_frames"] = failed;
+    return o;
+}
+
+// start an output line, tagged with the port for multi-reader runs
+QTextStream &Dumper::line(const char *what)
+{
+    return out_ << what << " port=" << reader_.portName();
+}
+
+void Dumper::start()
+{
+    elapsed_.start();
+    if ( verify_ ) {
+        // free blocks of the file need not hold the empty pattern
+        reader_.setStrict(true);
+    } else {
+        if ( !file_.open(file_name_) ) {
+            this->finish(EXIT_FILE, "write " + file_.errorString());
+            return;
+        }
+        // its frames count once the card's directory matches
+        if ( file_.isPending() && progress_ )
+            this->line("journal") << " pending" << endl;
+    }
+    if ( !reader_.open() ) {
+        this->finish(EXIT_NO_READER, "open " + reader_.portName()
+                     + ": " + reader_.errorString());
+        return;
+    }
+    this->probe();
+    probe_timer_.start(PROBE_INTERVAL_MS);
+}
+
+void Dumper::probe()
+{
+    if ( ++probes_ > PROBES_MAX ) {
+        this->finish(EXIT_NO_READER, "no reader on " + reader_.portName());
+        return;
+    }
+    reader_.readId();
+}
+
+void Dumper::onId(int version)
+{
+    if ( started_ )
+        return;
+    started_ = true;
+    probe_timer_.stop();
+    if ( progress_ )
+        this->line("reader") << " protocol=" << version << endl;
+    reader_.startDump();
+}
+
+void Dumper::onProgress(int frames, int total)
+{
+    if ( !progress_ )
+        return;
+    qint64 ms = elapsed_.elapsed();
+    this->line("progress") << " frames=" << frames
+         << " total=" << total
+         << " elapsed_ms=" << ms
+         << " fps=" << (ms ? frames * 1000.0 / ms : 0.0) << endl;
+}
+
+void Dumper::onBadFrame(const Frame &frame, int status)
+{
+    if ( progress_ )
+        this->line("bad") << " frame=" << frame.addr() / Frame::SIZE
+             << " status=" << QString::number((uchar)status, 16) << endl;
+}
+
+void Dumper::onTimeout(const Frame &last)
+{
+    if ( progress_ )
+        this->line("timeout") << " frame=" << last.addr() / Frame::SIZE << endl;
+}
+
+void Dumper::onFrameFailed(int sector, int reason, int attempts)
+{
+    if ( progress_ )
+        this->line("failed") << " frame=" << sector
+             << " reason=\"" << RetryScheduler::reasonName(reason) << "\""
+             << " attempts=" << attempts << endl;
+}
+
+// /ACK statistics in, or given up on: finish what finish() held back
+void Dumper::onAckStats()
+{
+    if ( stats_wait_ && !finished_ )
+        this->finish(code_, what_);
+}
+
+void Dumper::onFileResumed(int frames)
+{
+    file_.load(reader_.card());
+    if ( progress_ )
+        this->line("resume") << " frames=" << frames << endl;
+}
+
+void Dumper::onCardChanged()
+{
+    if ( progress_ )
+        this->line("journal") << " other_card=1" << endl;
+}
+
+void Dumper::onDumpDone(bool ok)
+{
+    QList<int> failed = reader_.failedFrames();
+    if ( !ok && !failed.isEmpty() ) {
+        QStringList l;
+        foreach (int sector, failed)
+            l.append(QString::number(sector));
+        this->finish(EXIT_DUMP_FAILED, QString::number(failed.size())
+                     + " frames unreadable: " + l.join(" "));
+        return;
+    }
+    if ( !ok ) {
+        this->finish(EXIT_DUMP_FAILED, "reader stopped answering");
+        return;
+    }
+    int code = verify_ ? this->verifyFile() : this->writeFile();
+    if ( code == EXIT_OK )
+        this->finish(code, verify_ ? "verified" : "saved");
+}
+
+// frames went into FILE.part as they came, closing puts it in place
+int Dumper::writeFile()
+{
+    if ( !file_.isComplete() ) {
+        this->finish(EXIT_FILE, "write " + file_name_ + ": incomplete");
+        return EXIT_FILE;
+    }
+    if ( !file_.close() ) {
+        this->finish(EXIT_FILE, "write " + file_.errorString());
+        return EXIT_FILE;
+    }
+    return EXIT_OK;
+}
+
+int Dumper::verifyFile()
+{
+    QFile f(file_name_);
+    if ( !f.open(QIODevice::ReadOnly) ) {
+        this->finish(EXIT_FILE, "read " + file_name_ + ": " + f.errorString());
+        return EXIT_FILE;
+    }
+    QByteArray image = f.read(MemCard::CARD_SIZE);
+    QByteArray card = reader_.card()->data();
+    int bad = 0;
+    for (int i = 0; i < MemCard::FRAME_COUNT; ++i){
+        int ofs = i * MemCard::FRAME_SIZE;
+        if ( image.size() < ofs + MemCard::FRAME_SIZE
+             || memcmp(image.constData() + ofs,
+                       card.constData() + ofs, MemCard::FRAME_SIZE) ) {
+            if ( progress_ )
+                this->line("mismatch") << " frame=" << i << endl;
+            ++bad;
+        }
+    }
+    if ( bad ) {
+        this->finish(EXIT_MISMATCH, QString::number(bad) + " frames differ");
+        return EXIT_MISMATCH;
+    }
+    return EXIT_OK;
+}
+
+void Dumper::finish(int code, QString what)
+{
+    if ( reader_.isReadingAckStats() && !stats_wait_ ) {
+        // the answer to the A of finishDump() is still on its way
+        stats_wait_ = true;
+        code_ = code;
+        what_ = what;
+        stats_timer_.start(ACK_STATS_MS);
+        return;
+    }
+    stats_timer_.stop();
+    probe_timer_.stop();
+    reader_.close();
+    file_.close();
+    finished_ = true;
+    code_ = code;
+    this->line("result") << " status=" << (code == EXIT_OK ? "ok" : "error")
+         << " code=" << code
+         << " elapsed_ms=" << elapsed_.elapsed()
+         << " msg=\"" << what << "\"" << endl;
+    emit sigFinished(code);
+}
@@ -0,0 +1,88 @@
+#ifndef DUMPER_H
+#define DUMPER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QTimer>
+
+#include "cardfile.h"
+#include "cardreader.h"
+#include "simdevice.h"
+
+/* Runs one dump or verify job on a CardReader and quits the
+ * application with one of the EXIT codes.
+ */
+class Dumper : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Dumper(QObject *parent = 0);
+
+    enum EXIT {
+        EXIT_OK = 0,
+        EXIT_USAGE = 1,
+        EXIT_NO_READER = 2,     // port cannot be opened or reader silent
+        EXIT_DUMP_FAILED = 3,   // reader stopped answering during the dump
+        EXIT_MISMATCH = 4,      // verify: card differs from the file
+        EXIT_FILE = 5           // file cannot be read or written
+    };
+
+    void setPortName(QString portName);
+    void setBaudRate(qint32 baud);
+    void setFileName(QString fileName);
+    void setVerify(bool verify);
+    void setStrict(bool strict);
+    void setCompression(bool compress);
+    void setProgress(bool progress);
+
+    QString portName();
+    int frames();
+    bool isFinished();
+    int exitCode();
+    QJsonObject stats();
+
+signals:
+    void sigFinished(int code);
+
+public slots:
+    void start();
+
+private slots:
+    void probe();
+    void onId(int version);
+    void onProgress(int frames, int total);
+    void onBadFrame(const Frame &frame, int status);
+    void onTimeout(const Frame &last);
+    void onFrameFailed(int sector, int reason, int attempts);
+    void onDumpDone(bool ok);
+    void onAckStats();
+    void onFileResumed(int frames);
+    void onCardChanged();
+
+private:
+    void finish(int code, QString what);
+    QTextStream &line(const char *what);
+    int writeFile();
+    int verifyFile();
+
+    SimDevice sim_;         // stands in for the port of a sim: reader
+    CardReader reader_;
+    CardFile file_;         // dump target, resumed if it has a journal
+    QString file_name_;
+    bool verify_;
+    bool progress_;
+    bool started_;
+    bool finished_;
+    bool stats_wait_;       // finish() waiting for the /ACK statistics
+    int code_;
+    QString what_;          // result message held back meanwhile
+    int probes_;
+    QTimer probe_timer_;
+    QTimer stats_timer_;
+    QElapsedTimer elapsed_;
+    QTextStream out_;
+};
+
+#endif // DUMPER_H
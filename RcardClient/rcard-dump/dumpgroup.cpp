@@ -0,0 +1,102 @@
+#include "dumpgroup.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <stdio.h>
+
+#define STATUS_INTERVAL_MS 1000
+
+DumpGroup::DumpGroup(QObject *parent) : QObject(parent),
+    progress_(false),
+    out_(stdout)
+{
+    connect(&status_timer_, SIGNAL(timeout()),
+            this, SLOT(printStatus()));
+}
+
+DumpGroup::~DumpGroup()
+{
+    qDeleteAll(dumpers_);
+}
+
+Dumper *DumpGroup::addDumper()
+{
+    Dumper *d = new Dumper();
+    dumpers_.append(d);
+    connect(d, SIGNAL(sigFinished(int)),
+            this, SLOT(onFinished(int)));
+    return d;
+}
+
+void DumpGroup::setProgress(bool progress)
+{
+    progress_ = progress;
+}
+
+void DumpGroup::setStatsFile(QString fileName)
+{
+    stats_file_ = fileName;
+}
+
+void DumpGroup::start()
+{
+    elapsed_.start();
+    if ( progress_ )
+        status_timer_.start(STATUS_INTERVAL_MS);
+    foreach (Dumper *d, dumpers_)
+        d->start();
+}
+
+void DumpGroup::onFinished(int code)
+{
+    Q_UNUSED(code);
+    int worst = Dumper::EXIT_OK;
+    foreach (Dumper *d, dumpers_){
+        if ( !d->isFinished() )
+            return;
+        worst = qMax(worst, d->exitCode());
+    }
+    status_timer_.stop();
+    if ( progress_ )
+        this->printStatus();
+    if ( !stats_file_.isEmpty() )
+        this->writeStats();
+    emit sigFinished(worst);
+}
+
+void DumpGroup::printStatus()
+{
+    int frames = 0;
+    int running = 0;
+    foreach (Dumper *d, dumpers_){
+        frames += d->frames();
+        if ( !d->isFinished() )
+            ++running;
+    }
+    qint64 ms = elapsed_.elapsed();
+    out_ << "status readers=" << dumpers_.size()
+         << " running=" << running
+         << " frames=" << frames
+         << " total=" << dumpers_.size() * MemCard::FRAME_COUNT
+         << " elapsed_ms=" << ms
+         << " fps=" << (ms ? frames * 1000.0 / ms : 0.0) << endl;
+}
+
+// one object per reader, same layout as the RcardClient export
+void DumpGroup::writeStats()
+{
+    QJsonArray readers;
+    foreach (Dumper *d, dumpers_)
+        readers.append(d->stats());
+    QJsonObject o;
+    o["elapsed_ms"] = double(elapsed_.elapsed());
+    o["readers"] = readers;
+
+    QSaveFile f(stats_file_);
+    if ( !f.open(QIODevice::WriteOnly)
+         || f.write(QJsonDocument(o).toJson()) < 0
+         || !f.commit() )
+        fprintf(stderr, "write %s: %s\n", qPrintable(stats_file_),
+                qPrintable(f.errorString()));
+}
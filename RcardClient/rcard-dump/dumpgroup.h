@@ -0,0 +1,48 @@
+#ifndef DUMPGROUP_H
+#define DUMPGROUP_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QList>
+#include <QTextStream>
+#include <QTimer>
+
+#include "dumper.h"
+
+/* Runs several Dumpers, one per reader, side by side on the one event
+ * loop and reports their combined progress. Finishes with the worst
+ * exit code once every reader is done.
+ */
+class DumpGroup : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DumpGroup(QObject *parent = 0);
+    ~DumpGroup();
+
+    Dumper *addDumper();
+    void setProgress(bool progress);
+    void setStatsFile(QString fileName);
+
+signals:
+    void sigFinished(int code);
+
+public slots:
+    void start();
+
+private slots:
+    void onFinished(int code);
+    void printStatus();
+
+private:
+    void writeStats();
+
+    QList<Dumper*> dumpers_;
+    bool progress_;
+    QString stats_file_;
+    QTimer status_timer_;
+    QElapsedTimer elapsed_;
+    QTextStream out_;
+};
+
+#endif // DUMPGROUP_H
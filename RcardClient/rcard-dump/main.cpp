@@ -0,0 +1,90 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <stdio.h>
+
+#include "dumpgroup.h"
+#include "tracer.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("rcard-dump");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+                "Dump PS1 memory cards through rcard Arduino readers.\n"
+                "Give one port and file pair per reader, all readers run at once.\n"
+                "Frames go into the file as they arrive, listed in FILE.journal;\n"
+                "running again on a file that still has its journal resumes it.\n"
+                "Exit codes: 0 ok, 1 usage, 2 no reader, 3 dump failed,\n"
+                "4 verify mismatch, 5 file error.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("port", "Serial port of the reader, e.g. ttyACM0,\n"
+                                 "or sim:IMAGE for a simulated reader holding IMAGE.");
+    parser.addPositionalArgument("file", "Memory card image (.mcr).");
+    parser.addPositionalArgument("[port file...]", "More readers.");
+    QCommandLineOption verifyOpt(QStringList() << "c" << "verify",
+                                 "Compare the card with file instead of writing it.");
+    QCommandLineOption strictOpt(QStringList() << "a" << "all",
+                                 "Read every frame. By default blocks the card's\n"
+                                 "directory marks free are filled in, not read.");
+    QCommandLineOption compressOpt(QStringList() << "z" << "compress",
+                                   "Have the readers send frames RLE coded, where\n"
+                                   "their firmware supports it.");
+    QCommandLineOption baudOpt(QStringList() << "b" << "baud",
+                               "Serial baud rate.", "baud", "38400");
+    QCommandLineOption progressOpt(QStringList() << "p" << "progress",
+                                   "Print machine-readable progress lines.");
+    QCommandLineOption statsOpt(QStringList() << "s" << "stats",
+                                "Write link statistics of every reader to file as JSON.",
+                                "file");
+    QCommandLineOption traceOpt(QStringList() << "t" << "trace",
+                                "Record a timeline of the serial traffic to file\n"
+                                "as Chrome trace event JSON.", "file");
+    parser.addOption(verifyOpt);
+    parser.addOption(strictOpt);
+    parser.addOption(compressOpt);
+    parser.addOption(baudOpt);
+    parser.addOption(progressOpt);
+    parser.addOption(statsOpt);
+    parser.addOption(traceOpt);
+    parser.process(a);
+
+    const QStringList args = parser.positionalArguments();
+    bool ok = false;
+    qint32 baud = parser.value(baudOpt).toInt(&ok);
+    if ( args.isEmpty() || args.size() % 2 || !ok ) {
+        fputs(qPrintable(parser.helpText()), stderr);
+        return Dumper::EXIT_USAGE;
+    }
+
+    DumpGroup g;
+    g.setProgress(parser.isSet(progressOpt));
+    g.setStatsFile(parser.value(statsOpt));
+    for (int i = 0; i < args.size(); i += 2){
+        Dumper *d = g.addDumper();
+        d->setPortName(args.at(i));
+        d->setFileName(args.at(i + 1));
+        d->setBaudRate(baud);
+        d->setVerify(parser.isSet(verifyOpt));
+        d->setStrict(parser.isSet(strictOpt));
+        d->setCompression(parser.isSet(compressOpt));
+        d->setProgress(parser.isSet(progressOpt));
+    }
+    QObject::connect(&g, &DumpGroup::sigFinished,
+                     &QCoreApplication::exit);
+    QMetaObject::invokeMethod(&g, "start", Qt::QueuedConnection);
+
+    Tracer::setEnabled(parser.isSet(traceOpt));
+    int code = a.exec();
+    if ( parser.isSet(traceOpt) ) {
+        QString error;
+        Tracer::setEnabled(false);
+        if ( !Tracer::write(parser.value(traceOpt), &error) ) {
+            fprintf(stderr, "write %s: %s\n", qPrintable(parser.value(traceOpt)),
+                    qPrintable(error));
+            code = qMax(code, int(Dumper::EXIT_FILE));
+        }
+    }
+    return code;
+}
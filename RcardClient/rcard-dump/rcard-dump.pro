@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# rcard-dump: headless memory card dumper
+#
+#-------------------------------------------------
+
+QT       += core serialport
+QT       -= gui
+
+TARGET = rcard-dump
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+include(../core.pri)
+
+SOURCES += main.cpp \
+    dumper.cpp \
+    dumpgroup.cpp
+
+HEADERS += dumper.h \
+    dumpgroup.h
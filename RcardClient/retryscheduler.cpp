@@ -0,0 +1,102 @@
+#include "retryscheduler.h"
+
+// first retry immediately, then 10, 20, 40 .. ms
+#define BACKOFF_BASE_MS 10
+#define BACKOFF_MAX_MS 320
+
+RetryScheduler::RetryScheduler() :
+    entries_(FRAME_COUNT),
+    holds_(0)
+{
+    this->clear();
+}
+
+RetryScheduler::REASON RetryScheduler::reasonOf(int status)
+{
+    switch ( (quint8)status ) {
+    case 0x47: return FAIL_CHECKSUM;
+    case 0x4E: return FAIL_CARD_CHECKSUM;
+    case 0xFF: return FAIL_BAD_SECTOR;
+    default: return FAIL_STATUS;
+    }
+}
+
+const char *RetryScheduler::reasonName(int reason)
+{
+    return psx_fail_name(reason);
+}
+
+// Returns true when this failure was the frame's last attempt.
+bool RetryScheduler::fail(int sector, REASON why, qint64 now_ms)
+{
+    if ( sector < 0 || sector >= FRAME_COUNT )
+        return false;
+    Entry &e = entries_[sector];
+    if ( e.given_up )
+        return false;
+    if ( e.attempts == 0 )
+        ++holds_;
+    ++e.attempts;
+    e.reason = why;
+    if ( e.attempts >= psx_retry_limit[why] ) {
+        e.given_up = true;
+        return true;
+    }
+    qint64 backoff = 0;
+    if ( e.attempts > 1 )
+        backoff = qMin(qint64(BACKOFF_BASE_MS) << (e.attempts - 2),
+                       qint64(BACKOFF_MAX_MS));
+    e.ready_ms = now_ms + backoff;
+    return false;
+}
+
+void RetryScheduler::succeed(int sector)
+{
+    if ( sector < 0 || sector >= FRAME_COUNT )
+        return;
+    Entry &e = entries_[sector];
+    if ( e.attempts )
+        --holds_;
+    e.attempts = 0;
+    e.given_up = false;
+    e.ready_ms = 0;
+}
+
+void RetryScheduler::clear()
+{
+    Entry e = { 0, 0, false, 0 };
+    entries_.fill(e);
+    holds_ = 0;
+}
+
+// false while no frame has failed, the dump can take runs as they come
+bool RetryScheduler::hasHolds() const
+{
+    return holds_ > 0;
+}
+
+// when the frame may be asked for, -1 once given up
+qint64 RetryScheduler::readyAt(int sector) const
+{
+    const Entry &e = entries_.at(sector);
+    return e.given_up ? -1 : e.ready_ms;
+}
+
+int RetryScheduler::attempts(int sector) const
+{
+    return entries_.at(sector).attempts;
+}
+
+RetryScheduler::REASON RetryScheduler::reason(int sector) const
+{
+    return REASON(entries_.at(sector).reason);
+}
+
+QList<int> RetryScheduler::givenUp() const
+{
+    QList<int> l;
+    for (int i = 0; i < FRAME_COUNT; ++i)
+        if ( entries_.at(i).given_up )
+            l.append(i);
+    return l;
+}
@@ -0,0 +1,58 @@
+#ifndef RETRYSCHEDULER_H
+#define RETRYSCHEDULER_H
+
+#include <QList>
+#include <QVector>
+
+#include "psx_proto.h"
+
+/* Per-frame retry bookkeeping of a dump. A failed frame may be asked for
+ * again right away the first time, after that it cools down for a backoff
+ * that doubles with every failure, so the dump moves on to other frames
+ * meanwhile. After its reason's attempt limit, psx_retry_limit as in the
+ * C tools, the frame is given up and reported instead of being retried
+ * forever. Times are in ms.
+ */
+class RetryScheduler
+{
+public:
+    enum REASON {
+        FAIL_TIMEOUT = PSX_FAIL_TIMEOUT,
+        FAIL_CHECKSUM = PSX_FAIL_CHECKSUM,
+        FAIL_CARD_CHECKSUM = PSX_FAIL_CARD_CHECKSUM,
+        FAIL_BAD_SECTOR = PSX_FAIL_BAD_SECTOR,
+        FAIL_STATUS = PSX_FAIL_STATUS,
+        FAIL_LOST = PSX_FAIL_LOST,
+        FAIL_REASONS = PSX_FAIL_REASONS
+    };
+
+    enum { FRAME_COUNT = 1024 };
+
+    RetryScheduler();
+
+    static REASON reasonOf(int status);
+    static const char *reasonName(int reason);
+
+    bool fail(int sector, REASON why, qint64 now_ms);
+    void succeed(int sector);
+    void clear();
+
+    bool hasHolds() const;
+    qint64 readyAt(int sector) const;
+    int attempts(int sector) const;
+    REASON reason(int sector) const;
+    QList<int> givenUp() const;
+
+private:
+    struct Entry {
+        quint8 attempts;    // failures so far, 0 = never failed
+        quint8 reason;      // of the last failure
+        bool given_up;
+        qint64 ready_ms;    // not before this
+    };
+
+    QVector<Entry> entries_;
+    int holds_;             // entries with attempts > 0
+};
+
+#endif // RETRYSCHEDULER_H
@@ -0,0 +1,53 @@
+#include "ringbuffer.h"
+
+RingBuffer::RingBuffer() :
+    head_(0), tail_(0)
+{
+
+}
+
+int RingBuffer::size() const
+{
+    return head_ - tail_;
+}
+
+int RingBuffer::room() const
+{
+    return CAPACITY - size();
+}
+
+char RingBuffer::at(int i) const
+{
+    return buf_[(tail_ + i) & (CAPACITY - 1)];
+}
+
+// pointer to byte i, *contiguous bytes can be read from there
+const char *RingBuffer::readPtr(int i, int *contiguous) const
+{
+    quint32 p = (tail_ + i) & (CAPACITY - 1);
+    *contiguous = qMin<int>(size() - i, CAPACITY - p);
+    return buf_ + p;
+}
+
+// pointer to free space, *contiguous bytes can be written there
+char *RingBuffer::writePtr(int *contiguous)
+{
+    quint32 p = head_ & (CAPACITY - 1);
+    *contiguous = qMin<int>(room(), CAPACITY - p);
+    return buf_ + p;
+}
+
+void RingBuffer::commit(int n)
+{
+    head_ += n;
+}
+
+void RingBuffer::consume(int n)
+{
+    tail_ += n;
+}
+
+void RingBuffer::clear()
+{
+    head_ = tail_ = 0;
+}
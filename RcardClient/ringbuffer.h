@@ -0,0 +1,31 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <QtGlobal>
+
+/* Fixed size byte ring, filled in place by the reader
+ * and consumed in place by the parser.
+ */
+class RingBuffer
+{
+public:
+    enum { CAPACITY = 4096 };   // power of 2
+
+    RingBuffer();
+
+    int size() const;
+    int room() const;
+    char at(int i) const;
+    const char *readPtr(int i, int *contiguous) const;
+    char *writePtr(int *contiguous);
+    void commit(int n);
+    void consume(int n);
+    void clear();
+
+private:
+    char buf_[CAPACITY];
+    quint32 head_;  // write position, free running
+    quint32 tail_;  // read position, free running
+};
+
+#endif // RINGBUFFER_H
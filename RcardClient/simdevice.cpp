@@ -0,0 +1,247 @@
+#include "simdevice.h"
+
+#include <QFile>
+#include <string.h>
+
+#include "memcard.h"
+#include "packetdecoder.h"
+
+SimDevice::SimDevice(QObject *parent) : QIODevice(parent),
+    seq_(0),
+    delay_(1000),
+    mode_(0),
+    announced_(false)
+{
+    this->setDelay(delay_);
+}
+
+// D sets the /ACK timeouts of all phases, the address one 6 times longer
+void SimDevice::setDelay(quint16 delay)
+{
+    delay_ = delay;
+    for (int phase = 0; phase < LinkStats::ACK_PHASES; ++phase)
+        ack_timeout_[phase] = phase == 1 ? 6 * delay : delay;
+}
+
+bool SimDevice::setImage(const QByteArray &image)
+{
+    if ( image.size() != MemCard::CARD_SIZE )
+        return false;
+    image_ = image;
+    return true;
+}
+
+bool SimDevice::loadImage(const QString &fileName)
+{
+    QFile f(fileName);
+    if ( !f.open(QIODevice::ReadOnly) ) {
+        this->setErrorString(f.errorString());
+        return false;
+    }
+    if ( !this->setImage(f.readAll()) ) {
+        this->setErrorString(fileName + " is not a memory card image");
+        return false;
+    }
+    return true;
+}
+
+bool SimDevice::open(OpenMode mode)
+{
+    if ( image_.isEmpty() ) {
+        this->setErrorString("no card image");
+        return false;
+    }
+    // like the Arduino, start over on open
+    cmd_.clear();
+    out_.clear();
+    seq_ = 0;
+    mode_ = 0;
+    this->setDelay(1000);
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+bool SimDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 SimDevice::bytesAvailable() const
+{
+    return out_.size() + QIODevice::bytesAvailable();
+}
+
+qint64 SimDevice::readData(char *data, qint64 maxlen)
+{
+    int n = qMin<qint64>(maxlen, out_.size());
+    memcpy(data, out_.constData(), n);
+    out_.remove(0, n);
+    return n;
+}
+
+qint64 SimDevice::writeData(const char *data, qint64 len)
+{
+    cmd_.append(data, len);
+    while ( !cmd_.isEmpty() ) {
+        int used = this->parseCmd();
+        if ( used == 0 )
+            break;
+        cmd_.remove(0, used);
+    }
+    if ( !out_.isEmpty() && !announced_ ) {
+        // answer from the event loop, as a serial port would
+        announced_ = true;
+        QMetaObject::invokeMethod(this, "announce", Qt::QueuedConnection);
+    }
+    return len;
+}
+
+void SimDevice::announce()
+{
+    announced_ = false;
+    if ( !out_.isEmpty() )
+        emit readyRead();
+}
+
+// Same as parseCmd() of rcard.ino: bytes used, 0 when incomplete.
+int SimDevice::parseCmd()
+{
+    const uchar *c = (const uchar *)cmd_.constData();
+    int len = cmd_.size();
+    int used = 1;
+
+    switch ( c[0] ) {
+    default:
+        this->packet(PacketDecoder::PKT_ERROR, cmd_.constData(), 1);
+        break;
+    case 'R':
+        if ( len < 3 )
+            return 0;
+        this->frame((c[1] << 8) | c[2]);
+        used = 3;
+        break;
+    case 'B': {
+        if ( len < 5 )
+            return 0;
+        int sector = (c[1] << 8) | c[2];
+        int count = (c[3] << 8) | c[4];
+        for (; count > 0 && sector < MemCard::FRAME_COUNT; --count, ++sector)
+            this->frame(sector);
+        used = 5;
+        break;
+    }
+    case 'D': {
+        if ( len < 3 )
+            return 0;
+        this->setDelay((c[1] << 8) | c[2]);
+        char d[] = { char(delay_ >> 8), char(delay_) };
+        this->packet(PacketDecoder::PKT_DELAY, d, sizeof d);
+        used = 3;
+        break;
+    }
+    case 'S': {
+        char v = PacketDecoder::VERSION;
+        this->packet(PacketDecoder::PKT_ID, &v, 1);
+        break;
+    }
+    case 'M': {
+        if ( len < 2 )
+            return 0;
+        mode_ = c[1] & PacketDecoder::MODE_RLE;
+        char m = mode_;
+        this->packet(PacketDecoder::PKT_MODE, &m, 1);
+        used = 2;
+        break;
+    }
+    case 'L': {
+        // no line to speed up, any setting reads clean
+        if ( len < 3 )
+            return 0;
+        used = 3;
+        if ( c[1] >= PacketDecoder::LINK_SPIS || c[2] >= PacketDecoder::LINK_BAUDS ) {
+            this->packet(PacketDecoder::PKT_ERROR, cmd_.constData(), 1);
+            break;
+        }
+        this->packet(PacketDecoder::PKT_LINK, cmd_.constData() + 1, 2);
+        break;
+    }
+    case 'A': {
+        // no card to time, no acks counted
+        if ( len < 2 )
+            return 0;
+        used = 2;
+        for (int phase = 0; phase < LinkStats::ACK_PHASES; ++phase)
+            this->ackStat(phase);
+        break;
+    }
+    case 'T': {
+        // T phase MSB LSB, answered with the phase's statistics
+        if ( len < 4 )
+            return 0;
+        used = 4;
+        if ( c[1] >= LinkStats::ACK_PHASES ) {
+            this->packet(PacketDecoder::PKT_ERROR, cmd_.constData(), 1);
+            break;
+        }
+        ack_timeout_[c[1]] = (c[2] << 8) | c[3];
+        this->ackStat(c[1]);
+        break;
+    }
+    }
+    ++seq_;
+    return used;
+}
+
+void SimDevice::packet(quint8 type, const char *payload, int len)
+{
+    char head[] = { char(PacketDecoder::SYNC0), char(PacketDecoder::SYNC1),
+                    char(PacketDecoder::VERSION), char(type), char(seq_), char(len) };
+    quint16 crc = PacketDecoder::crc16(0xFFFF, head + 2, 4);
+    crc = PacketDecoder::crc16(crc, payload, len);
+    out_.append(head, sizeof head);
+    out_.append(payload, len);
+    out_.append(char(crc));
+    out_.append(char(crc >> 8));
+}
+
+// PKT_ACKSTAT of a card that never had to be timed: counts all zero
+void SimDevice::ackStat(int phase)
+{
+    char p[PacketDecoder::ACKSTAT_SIZE];
+    memset(p, 0, sizeof p);
+    p[0] = phase;
+    for (int i = 0; i < 4; ++i)
+        p[1 + i] = char(ack_timeout_[phase] >> (24 - 8 * i));
+    p[11] = p[12] = char(0xFF);     // min of none
+    this->packet(PacketDecoder::PKT_ACKSTAT, p, sizeof p);
+}
+
+void SimDevice::frame(quint16 sector)
+{
+    char p[4 + MemCard::FRAME_SIZE];
+    p[0] = sector >> 8;
+    p[1] = sector;
+    if ( sector < MemCard::FRAME_COUNT ) {
+        const char *d = image_.constData() + sector * MemCard::FRAME_SIZE;
+        char sum = p[0] ^ p[1];
+        for (int i = 0; i < MemCard::FRAME_SIZE; ++i)
+            sum ^= d[i];
+        p[2] = 0x47;
+        p[3] = sum;
+        memcpy(p + 4, d, MemCard::FRAME_SIZE);
+        if ( mode_ & PacketDecoder::MODE_RLE ) {
+            // the checksum was computed from this very data, never bad
+            char z[3 + MemCard::FRAME_SIZE];
+            int n = PacketDecoder::rleEncode(d, MemCard::FRAME_SIZE,
+                                             z + 3, MemCard::FRAME_SIZE);
+            if ( n ) {
+                memcpy(z, p, 3);
+                this->packet(PacketDecoder::PKT_FRAME_RLE, z, 3 + n);
+                return;
+            }
+        }
+    } else {
+        // bad sector, the card aborts after the confirmed address
+        memset(p + 2, 0xFF, sizeof p - 2);
+    }
+    this->packet(PacketDecoder::PKT_FRAME, p, sizeof p);
+}
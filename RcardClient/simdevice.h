@@ -0,0 +1,50 @@
+#ifndef SIMDEVICE_H
+#define SIMDEVICE_H
+
+#include <QIODevice>
+#include <QByteArray>
+
+#include "linkstats.h"
+
+/* In-memory stand-in for the Arduino reader. Takes the R/B/D/S/M/L/A/T commands
+ * written to it and answers with the firmware's packets, reading frames
+ * from a card image. Lets CardReader run without a reader or a card.
+ */
+class SimDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    explicit SimDevice(QObject *parent = 0);
+
+    bool setImage(const QByteArray &image);
+    bool loadImage(const QString &fileName);
+
+    bool open(OpenMode mode);
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxlen);
+    qint64 writeData(const char *data, qint64 len);
+
+private slots:
+    void announce();
+
+private:
+    int parseCmd();
+    void packet(quint8 type, const char *payload, int len);
+    void frame(quint16 sector);
+    void ackStat(int phase);
+    void setDelay(quint16 delay);
+
+    QByteArray image_;
+    QByteArray cmd_;        // command bytes not yet complete
+    QByteArray out_;        // answers not yet read
+    quint8 seq_;            // commands since "reset"
+    quint16 delay_;
+    quint32 ack_timeout_[LinkStats::ACK_PHASES];    // usec, D or T
+    quint8 mode_;           // M flags
+    bool announced_;        // readyRead queued
+};
+
+#endif // SIMDEVICE_H
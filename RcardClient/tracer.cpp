@@ -0,0 +1,127 @@
+#include "tracer.h"
+
+#include <QAtomicPointer>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QSaveFile>
+#include <QTextStream>
+
+namespace {
+
+struct Event {
+    qint64 ns;
+    const char *name;
+    const char *arg_name;
+    qint64 arg;
+    char ph;
+};
+
+struct Buffer {
+    Buffer *next;
+    int tid;
+    QAtomicInt n;           // events recorded, published with release
+    quint64 dropped;
+    Event ev[Tracer::EVENTS];
+};
+
+QAtomicPointer<Buffer> buffers;     // every thread's buffer
+QAtomicInt next_tid(1);
+QElapsedTimer clock_base;           // started before the first enable
+thread_local Buffer *own = 0;
+
+Buffer *newBuffer()
+{
+    Buffer *b = new Buffer();
+    b->tid = next_tid.fetchAndAddRelaxed(1);
+    b->dropped = 0;
+    Buffer *head;
+    do {
+        head = buffers.loadAcquire();
+        b->next = head;
+    } while ( !buffers.testAndSetRelease(head, b) );
+    return b;
+}
+
+}
+
+QAtomicInt Tracer::enabled_(0);
+
+void Tracer::setEnabled(bool on)
+{
+    if ( on && !clock_base.isValid() )
+        clock_base.start();
+    enabled_.store(on);
+}
+
+void Tracer::event(char ph, const char *name, const char *arg_name, qint64 arg)
+{
+    Buffer *b = own;
+    if ( !b )
+        b = own = newBuffer();
+    int n = b->n.load();
+    if ( n == EVENTS ) {
+        ++b->dropped;
+        return;
+    }
+    Event &ev = b->ev[n];
+    ev.ns = clock_base.nsecsElapsed();
+    ev.name = name;
+    ev.arg_name = arg_name;
+    ev.arg = arg;
+    ev.ph = ph;
+    b->n.storeRelease(n + 1);
+}
+
+bool Tracer::write(const QString &fileName, QString *error)
+{
+    QSaveFile f(fileName);
+    if ( !f.open(QIODevice::WriteOnly) ) {
+        if ( error )
+            *error = f.errorString();
+        return false;
+    }
+    QTextStream out(&f);
+    qint64 pid = QCoreApplication::applicationPid();
+    quint64 dropped = 0;
+    const char *sep = "";
+
+    out << "{\"traceEvents\":[\n";
+    for (Buffer *b = buffers.loadAcquire(); b; b = b->next){
+        int n = b->n.loadAcquire();
+        for (int i = 0; i < n; ++i){
+            const Event &ev = b->ev[i];
+            // ts in microseconds, instants are scoped to their thread
+            out << sep << "{\"name\":\"" << ev.name
+                << "\",\"ph\":\"" << ev.ph
+                << "\",\"ts\":" << ev.ns / 1000 << '.'
+                << QString::number(ev.ns % 1000).rightJustified(3, '0')
+                << ",\"pid\":" << pid
+                << ",\"tid\":" << b->tid;
+            if ( ev.ph == 'i' )
+                out << ",\"s\":\"t\"";
+            if ( ev.arg_name )
+                out << ",\"args\":{\"" << ev.arg_name << "\":" << ev.arg << "}";
+            out << "}";
+            sep = ",\n";
+        }
+        dropped += b->dropped;
+    }
+    out << "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":\""
+        << dropped << "\"}}\n";
+    out.flush();
+
+    if ( !f.commit() ) {
+        if ( error )
+            *error = f.errorString();
+        return false;
+    }
+    return true;
+}
+
+void Tracer::clear()
+{
+    for (Buffer *b = buffers.loadAcquire(); b; b = b->next){
+        b->n.storeRelease(0);
+        b->dropped = 0;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QAtomicInt>
+#include <QString>
+
+/* Timeline tracing in the Chrome trace event format, for chrome://tracing
+ * or ui.perfetto.dev, like psx_trace.h on the rcard side. Each thread
+ * records into a buffer of its own without locks, buffers are chained
+ * into a global list on the first event of their thread. Off by default,
+ * a disabled event is one relaxed load and a branch.
+ *
+ * Names must be string literals, only the pointer is kept.
+ */
+class Tracer
+{
+public:
+    enum { EVENTS = 65536 };    // per thread, later events are dropped
+
+    static bool isEnabled() { return enabled_.load(); }
+    static void setEnabled(bool on);
+    static void event(char ph, const char *name,
+                      const char *arg_name = 0, qint64 arg = 0);
+
+    // both need every thread to have stopped recording
+    static bool write(const QString &fileName, QString *error = 0);
+    static void clear();
+
+private:
+    static QAtomicInt enabled_;
+};
+
+#define TRACE(ph, name, arg_name, arg) \
+    do { \
+        if ( Tracer::isEnabled() ) \
+            Tracer::event(ph, name, arg_name, arg); \
+    } while (0)
+
+#define TRACE_BEGIN(name, arg_name, arg) TRACE('B', name, arg_name, arg)
+#define TRACE_END(name, arg_name, arg) TRACE('E', name, arg_name, arg)
+#define TRACE_INSTANT(name, arg_name, arg) TRACE('i', name, arg_name, arg)
+
+/* BEGIN now, END when it goes out of scope. */
+class TraceScope
+{
+public:
+    TraceScope(const char *name, const char *arg_name = 0, qint64 arg = 0) :
+        name_(name), on_(Tracer::isEnabled())
+    {
+        if ( on_ )
+            Tracer::event('B', name, arg_name, arg);
+    }
+    ~TraceScope()
+    {
+        if ( on_ )
+            Tracer::event('E', name_);
+    }
+
+private:
+    const char *name_;
+    bool on_;   // ends what it began, even if tracing was turned off since
+};
+
+#endif // TRACER_H
@@ -37,6 +37,7 @@
 */
 
 #include "Arduino.h"
+#include <util/crc16.h>
 
 //Memory Card Responses
 //0x47 - Good
@@ -61,12 +62,154 @@ unsigned long SPI_XFER_BYTE_DELAY_MAX  =   1000; // micro seconds
 #define SPI_ATT_DELAY    16 // micro seconds
 
 #define FRAME_BUF_SIZE (10 + 128 + 2 + 8)
+
+// Response packets to the host:
+// | A5 | 5A | VER | TYPE | SEQ | LEN | payload[LEN] | CRC lo | CRC hi |
+// CRC-16/CCITT (reflected, init FFFF) over VER .. payload.
+// SEQ is the sequence number of the command being answered,
+// counting every command received since reset. It is the ID the host
+// matches answers to its requests by: commands are queued, see
+// cmdring, and answered strictly in order.
+#define PKT_SYNC0 0xA5
+#define PKT_SYNC1 0x5A
+#define PKT_VERSION 1
+
+#define PKT_FRAME 0x01 // MSB LSB status checksum data[128]
+#define PKT_ID    0x02 // protocol version
+#define PKT_DELAY 0x03 // delay MSB LSB
+#define PKT_MODE  0x04 // mode flags now in effect
+#define PKT_FRAME_RLE 0x05 // MSB (|80h checksum bad) LSB status code[], see rle_encode()
+#define PKT_LINK  0x06 // SPI clock and baud codes now in effect
+#define PKT_ACKSTAT 0x07 // ACK statistics of one phase, see ack_send()
+#define PKT_ERROR 0x7F // offending command byte
+
+// M command flags, off after reset
+#define MODE_RLE 0x01   // send frames as PKT_FRAME_RLE when that is shorter
+#define RLE_BAD_CHECKSUM 0x80
+
+// A command flags
+#define ACK_CLEAR 0x01  // statistics start over after the answer
 // SPI example
 // SPI.beginTransaction(SPISettings(14000000, MSBFIRST, SPI_MODE0));
 //If other libraries use SPI from interrupts, they will be prevented from accessing SPI until you call SPI.endTransaction(). Your settings remain in effect for the duration of your "transaction". You should attempt to minimize the time between before you call SPI.endTransaction(), for best compatibility if your program is used together with other libraries which use SPI.
 //With most SPI devices, after SPI.beginTransaction(), you will write the slave select pin LOW, call SPI.transfer() any number of times to transfer data, then write the SS pin HIGH, and finally call SPI.endTransaction().
 
-boolean f_psx_ack = false;
+volatile boolean f_psx_ack = false;
+byte mode = 0;
+
+byte cmd_seq = 0;
+uint16_t pkt_crc;
+
+// Packets are built in one of two slots and handed to Serial only as
+// far as its TX buffer has room, so nothing here waits for the UART.
+// The UART data register empty interrupt of the core drains one slot
+// while the next frame is clocked from the card into the other.
+#define PKT_MAX (6 + 4 + 128 + 2)
+byte txb[2][PKT_MAX];
+byte txlen[2];    // bytes in the slot, 0 while free or being built
+byte txpos;       // bytes of slot txq already handed to Serial
+byte txq = 0;     // slot being sent
+byte txw = 0;     // slot being built
+byte pkt_n;
+
+// Commands are taken off Serial as they come, also while a frame is
+// being read, and wait here until the ones before them are done. The
+// host may keep several requests outstanding, the next one starts as
+// soon as the last is out of the card.
+#define CMDRING_SIZE 64   // power of two, at most 128
+byte cmdring[CMDRING_SIZE];
+byte cmd_head = 0;        // next byte to parse, free running
+byte cmd_tail = 0;        // next byte to store, free running
+
+byte cmd_count() {
+  return (byte)(cmd_tail - cmd_head);
+}
+
+byte cmd_peek(byte i) {
+  return cmdring[(byte)(cmd_head + i) & (CMDRING_SIZE - 1)];
+}
+
+void rx_pump() {
+  while ( cmd_count() < CMDRING_SIZE && Serial.available() > 0 ) {
+    cmdring[cmd_tail++ & (CMDRING_SIZE - 1)] = Serial.read();
+  }
+}
+
+void tx_pump() {
+  while ( txlen[txq] ) {
+    int room = Serial.availableForWrite();
+    while ( room-- > 0 && txpos < txlen[txq] ) {
+      Serial.write(txb[txq][txpos++]);
+    }
+    if ( txpos < txlen[txq] ) return;
+    txlen[txq] = 0;
+    txpos = 0;
+    txq ^= 1;
+  }
+}
+
+// L command: SPI clock and baud rate as indices into these, 0 after
+// reset. A new setting is kept only if an S command comes in within
+// LINK_PROBATION_MS, else the sketch goes back to the one before, so a
+// host that no longer hears it just has to wait.
+const unsigned long link_bauds[] = { 38400, 57600, 115200, 500000, 1000000 };
+#define LINK_BAUDS 5
+#define LINK_SPIS 4       // fosc/128, /64, /32, /16: 125, 250, 500 kHz, 1 MHz
+#define LINK_PROBATION_MS 2000
+byte link_spi = 0;
+byte link_baud = 0;
+byte link_old_spi, link_old_baud;
+boolean link_probation = false;
+unsigned long link_t0;
+
+boolean link_expired() {
+  return link_probation && millis() - link_t0 >= LINK_PROBATION_MS;
+}
+
+void pkt_write(byte b) {
+  pkt_crc = _crc_ccitt_update(pkt_crc, b);
+  txb[txw][pkt_n++] = b;
+}
+
+void pkt_begin(byte type, byte len) {
+  while ( txlen[txw] ) { // both slots full, wait for one
+    tx_pump();
+    rx_pump();
+  }
+  txb[txw][0] = PKT_SYNC0;
+  txb[txw][1] = PKT_SYNC1;
+  pkt_n = 2;
+  pkt_crc = 0xFFFF;
+  pkt_write(PKT_VERSION);
+  pkt_write(type);
+  pkt_write(cmd_seq);
+  pkt_write(len);
+}
+
+void pkt_end() {
+  txb[txw][pkt_n++] = pkt_crc & 0xFF;
+  txb[txw][pkt_n++] = pkt_crc >> 8;
+  txlen[txw] = pkt_n;
+  txw ^= 1;
+  tx_pump();
+}
+
+void link_apply(byte spi, byte baud) {
+  const byte spr[LINK_SPIS] = { (1 << SPR1) | (1 << SPR0), (1 << SPR1), (1 << SPR1), (1 << SPR0) };
+  SPCR = (SPCR & ~((1 << SPR1) | (1 << SPR0))) | spr[spi];
+  if ( spi == 2 ) SPSR |= (1 << SPI2X); else SPSR &= ~(1 << SPI2X);
+  link_spi = spi;
+
+  if ( baud == link_baud ) return;
+  while ( txlen[0] || txlen[1] ) tx_pump(); // the answer goes out at the old rate
+  Serial.flush();
+  // commands the host sent behind the L came at the old rate and stay
+  // queued; only bytes caught by the switch itself are dropped
+  rx_pump();
+  Serial.begin(link_bauds[baud]);
+  link_baud = baud;
+  while ( Serial.available() > 0 ) Serial.read();
+}
 
 void spi_setup() {
   // junk clr variable
@@ -99,7 +242,7 @@ void spi_setup() {
   // CPOL - Sets the data clock to be idle when high if set to 1, idle when low if set to 0
   // CPHA - Samples data on the falling edge of the data clock when 1, rising edge when 0
   // SPR1 and SPR0 - Sets the SPI speed, 00 is fastest (4MHz) 11 is slowest (250KHz)
-  SPCR = (0 << SPIE) | (1 << SPE) | (1 << DORD) | (1 << MSTR) | (1 << CPOL) | (1 << CPHA) | (1 << SPR1) | (1 << SPR0) ;
+  SPCR = (1 << SPIE) | (1 << SPE) | (1 << DORD) | (1 << MSTR) | (1 << CPOL) | (1 << CPHA) | (1 << SPR1) | (1 << SPR0) ;
 
   // SPI data register (SPDR): holds the byte which is about to be shifted out the MOSI line,
   //                           and the data which has just been shifted in the MISO line.
@@ -113,74 +256,277 @@ void spi_setup() {
   delay(10);
 }
 
-byte spi_xfer_byte(byte cmdByte, unsigned int Delay) {
-  SPDR = cmdByte;             // Start the transmission
-  while (!(SPSR & (1 << SPIF))) // Poll for the end of the transmission
-  {
-  };
-  while ( ! f_psx_ack && Delay > 0 ) // Poll for the ACK signal from the Memory Card
-  {
-    Delay--;
-    delayMicroseconds(1);
+
+// PackBits: c < 80h is followed by c + 1 literal bytes, c >= 80h by one
+// byte repeated c - 7Eh times. Codes the 128 data bytes into out,
+// returns the code length or 0 when it would not be shorter.
+byte zb[128];
+byte rle_encode(const byte *in, byte *out)
+{
+  byte i = 0, n = 0;
+  while (i < 128) {
+    byte run = 1;
+    while (i + run < 128 && in[i + run] == in[i]) run++;
+    if (run >= 2) {
+      if (n + 2 >= 128) return 0;
+      out[n++] = 0x7E + run;
+      out[n++] = in[i];
+      i += run;
+      continue;
+    }
+    // literals up to the next pair, which may start a run
+    byte start = i;
+    while (i < 128 && !(i + 1 < 128 && in[i] == in[i + 1])) i++;
+    if (n + 1 + (i - start) >= 128) return 0;
+    out[n++] = i - start - 1;
+    while (start < i) out[n++] = in[start++];
+  }
+  return n;
+}
+
+// frame buffer
+volatile char fb[FRAME_BUF_SIZE];  // read cmd header + frame data + 2 checksum + 8 byte 0x5C if 3rd party card.
+const byte datp = 10;     // frame data in fb
+#define FRAME_XFER_LEN (datp + 128 + 3)
+
+// A frame read is clocked by interrupts: the SPI transfer complete ISR
+// stores the byte and the ACK ISR starts the next one, so the main
+// loop is free to feed the UART meanwhile. A missing ACK is timed out
+// by spi_poll(), which then goes on like the ACK had come.
+#define SPI_IDLE     0
+#define SPI_XFER     1  // byte being shifted
+#define SPI_WAIT_ACK 2  // byte done, card not acknowledged yet
+#define SPI_DONE     3  // all FRAME_XFER_LEN bytes in fb
+volatile byte spi_state = SPI_IDLE;
+volatile byte spi_pos;    // next byte of fb
+volatile unsigned long spi_ack_t0;
+byte spi_msb, spi_lsb;
+
+//Command byte sent while byte pos of the read comes back
+byte psx_read_cmd(byte pos)
+{
+  switch (pos) {
+    case 0: return 0x81;    //Access Memory Card // FF (Error code)
+    case 1: return 0x52;    //Send read command // 00
+    case 4: return spi_msb; //Address MSB //00
+    case 5: return spi_lsb; //Address LSB //00
   }
-  if ( f_psx_ack ) { // ACK interrupt
-    f_psx_ack = false;
-  } else {  // ACK time out
+  // ID1 5A, ID2 5D, ACK1 5C, ACK2 5C, confirm MSB LSB, data,
+  // checksum (MSB xor LSB xor Data), status, 3rd party tail
+  return 0x00;
+}
+
+// ACK latency of each phase of a read, from the end of a byte to the
+// ACK, and the ACK timeout per phase. hist[i] counts latencies in
+// [2^(i-1), 2^i) usec, hist[0] zeroes and the last one everything
+// above; the counts stop at FFFFh. D sets all three timeouts at once,
+// T one of them.
+#define ACK_HDR  0 // after 81 52 00 00
+#define ACK_ADDR 1 // after MSB LSB ACK1 ACK2 confirm-MSB confirm-LSB
+#define ACK_DATA 2 // after data and checksum
+#define ACK_PHASES 3
+#define ACK_NONE ACK_PHASES // after the end byte, the card does not ACK it
+#define ACK_BUCKETS 16
+struct ack_stat {
+  unsigned long count;
+  unsigned int timeouts;
+  unsigned int min_us;
+  unsigned int max_us;
+  unsigned long sum_us;
+  unsigned int hist[ACK_BUCKETS];
+};
+struct ack_stat ack_stats[ACK_PHASES];  // written by the ISRs
+unsigned long ack_timeout_us[ACK_PHASES];
+
+//Phase of the ACK after byte pos, the card takes longer around the address
+byte ack_phase(byte pos)
+{
+  if ( pos >= FRAME_XFER_LEN - 2 ) return ACK_NONE;
+  if ( pos < 4 ) return ACK_HDR;
+  if ( pos <= 9 ) return ACK_ADDR;
+  return ACK_DATA;
+}
+
+void ack_set_delay(unsigned long us)
+{
+  ack_timeout_us[ACK_HDR] = us;
+  ack_timeout_us[ACK_ADDR] = us * 6;
+  ack_timeout_us[ACK_DATA] = us;
+}
+
+void ack_clear()
+{
+  noInterrupts();
+  memset(ack_stats, 0, sizeof ack_stats);
+  for (byte i = 0; i < ACK_PHASES; i++) ack_stats[i].min_us = 0xFFFF;
+  interrupts();
+}
+
+//Account one ACK, called with interrupts off
+void ack_record(byte phase, unsigned long us)
+{
+  if ( phase == ACK_NONE ) return;
+  struct ack_stat *st = &ack_stats[phase];
+  byte b = 0;
+  while ( b < ACK_BUCKETS - 1 && (us >> b) ) b++;
+  if ( st->hist[b] != 0xFFFF ) st->hist[b]++;
+  if ( us > 0xFFFF ) us = 0xFFFF;
+  st->count++;
+  st->sum_us += us;
+  if ( us < st->min_us ) st->min_us = us;
+  if ( us > st->max_us ) st->max_us = us;
+}
+
+void pkt_write_be(unsigned long v, byte n)
+{
+  while ( n-- > 0 ) pkt_write(v >> (8 * n));
+}
+
+//PKT_ACKSTAT: phase timeout[4] count[4] timeouts[2] min[2] max[2] sum[4] hist[16][2]
+void ack_send(byte phase)
+{
+  struct ack_stat st;
+  noInterrupts();
+  st = ack_stats[phase];
+  interrupts();
+  pkt_begin(PKT_ACKSTAT, 1 + 4 + 4 + 2 + 2 + 2 + 4 + 2 * ACK_BUCKETS);
+  pkt_write(phase);
+  pkt_write_be(ack_timeout_us[phase], 4);
+  pkt_write_be(st.count, 4);
+  pkt_write_be(st.timeouts, 2);
+  pkt_write_be(st.min_us, 2);
+  pkt_write_be(st.max_us, 2);
+  pkt_write_be(st.sum_us, 4);
+  for (byte i = 0; i < ACK_BUCKETS; i++) {
+    pkt_write_be(st.hist[i], 2);
+  }
+  pkt_end();
+}
+
+void spi_next() {
+  f_psx_ack = false;
+  spi_state = SPI_XFER;
+  SPDR = psx_read_cmd(spi_pos);  // Start the transmission
+}
+
+ISR(SPI_STC_vect) {
+  fb[spi_pos++] = SPDR;
+  if ( spi_pos == FRAME_XFER_LEN ) {
+    spi_state = SPI_DONE;      // nothing follows, no ACK to wait for
+  } else if ( spi_pos == FRAME_XFER_LEN - 1 ) {
+    spi_next();                // the card does not ACK its end byte
+  } else if ( f_psx_ack ) {
+    ack_record(ack_phase(spi_pos - 1), 0);
+    spi_next();                // ACK beat us here
+  } else {
+    spi_state = SPI_WAIT_ACK;
+    spi_ack_t0 = micros();
   }
-  return SPDR; // return the received byte
 }
 
 void psx_ack_isr() {
   f_psx_ack = true;
+  if ( spi_state == SPI_WAIT_ACK ) {
+    // moves on the moment the card is ready, no fixed byte delay
+    ack_record(ack_phase(spi_pos - 1), micros() - spi_ack_t0);
+    spi_next();
+  }
 }
 
-//Send a command to PlayStation port using SPI
-byte psx_spi_cmd(byte cmdByte, int Delay)
-{
-  return spi_xfer_byte( cmdByte, Delay);
+void spi_poll() {
+  noInterrupts();
+  if ( spi_state == SPI_WAIT_ACK ) {
+    byte phase = ack_phase(spi_pos - 1);
+    if ( phase == ACK_NONE ) {
+      spi_next();  // no ACK to wait for, nor to count as missing
+    } else if ( micros() - spi_ack_t0 >= ack_timeout_us[phase] ) {
+      if ( ack_stats[phase].timeouts != 0xFFFF ) ack_stats[phase].timeouts++;
+      spi_next();  // ACK time out
+    }
+  }
+  interrupts();
 }
 
-// frame buffer
-char fb[FRAME_BUF_SIZE];  // read cmd header + frame data + 2 checksum + 8 byte 0x5C if 3rd party card.
-unsigned int fbp, datp;
-//Read a frame from Memory Card and send it to serial port
-void psx_read_frame(byte AddressMSB, byte AddressLSB)
+void psx_read_start(byte AddressMSB, byte AddressLSB)
 {
+  spi_msb = AddressMSB;
+  spi_lsb = AddressLSB;
+  spi_pos = 0;
   digitalWrite( PSX_SEL, LOW ); //Activate device
+  spi_next();
+}
 
-  fbp = 0;
-  fb[fbp++] = psx_spi_cmd(0x81, SPI_XFER_BYTE_DELAY_MAX);      //Access Memory Card // FF (Error code)
-  fb[fbp++] = psx_spi_cmd(0x52, SPI_XFER_BYTE_DELAY_MAX);      //Send read command // 00
-  fb[fbp++] = psx_spi_cmd(0x00, SPI_XFER_BYTE_DELAY_MAX);      //Memory Card ID1  //5A
-  fb[fbp++] = psx_spi_cmd(0x00, SPI_XFER_BYTE_DELAY_MAX);      //Memory Card ID2  //5D
-  fb[fbp++] = psx_spi_cmd(AddressMSB, SPI_XFER_BYTE_DELAY_MAX*6);      //Address MSB //00
-  fb[fbp++] = psx_spi_cmd(AddressLSB, SPI_XFER_BYTE_DELAY_MAX*6);      //Address LSB //00
-  fb[fbp++] = psx_spi_cmd(0x00, SPI_XFER_BYTE_DELAY_MAX*6);      //Memory Card ACK1  //5C
-  fb[fbp++] = psx_spi_cmd(0x00, SPI_XFER_BYTE_DELAY_MAX*6);      //Memory Card ACK2  //5C
-  fb[fbp++] = psx_spi_cmd(0x00, SPI_XFER_BYTE_DELAY_MAX*6);      //Confirm MSB // 5D
-  fb[fbp++] = psx_spi_cmd(0x00, SPI_XFER_BYTE_DELAY_MAX*6);      //Confirm LSB // FF
-
-  datp = fbp;
-  //Get 128 byte data from the frame
-  for (int i = 0; i < 128; i++)
-  {
-    fb[fbp++] = psx_spi_cmd(0x00, SPI_XFER_BYTE_DELAY_MAX);
+//Wait for the frame, sending what is queued meanwhile
+void psx_read_wait()
+{
+  while ( spi_state != SPI_DONE ) {
+    spi_poll();
+    tx_pump();
+    rx_pump();
   }
-  fb[fbp++] = psx_spi_cmd(0x00, SPI_XFER_BYTE_DELAY_MAX);      //Checksum (MSB xor LSB xor Data)
-  fb[fbp++] = psx_spi_cmd(0x00, SPI_XFER_BYTE_DELAY_MAX);      //Memory Card status byte
-  fb[fbp++] = psx_spi_cmd(0x00, SPI_XFER_BYTE_DELAY_MAX);      // 3rd party tail
-
+  spi_state = SPI_IDLE;
   digitalWrite( PSX_SEL, HIGH); //Deactivate device
+}
+
+//Queue the frame in fb for the serial port
+void psx_send_frame(byte AddressMSB, byte AddressLSB)
+{
+  if ( mode & MODE_RLE ) {
+    // check the card's checksum here, the host only gets the verdict
+    byte sum = AddressMSB ^ AddressLSB;
+    for (int i = 0; i < 128; i++) sum ^= fb[datp + i];
+    byte n = rle_encode((const byte *)fb + datp, zb);
+    if ( n ) {
+      pkt_begin(PKT_FRAME_RLE, 3 + n);
+      pkt_write(AddressMSB | (sum != (byte)fb[datp + 128] ? RLE_BAD_CHECKSUM : 0));
+      pkt_write(AddressLSB);
+      pkt_write(fb[datp + 129]);  // status
+      for (byte i = 0; i < n; i++) {
+        pkt_write(zb[i]);
+      }
+      pkt_end();
+      return;
+    }
+  }
 
   // wite back to serial
-  for (int i = 0; i < sizeof fb; i++) {
-    Serial.write(fb[i]);
+  pkt_begin(PKT_FRAME, 4 + 128);
+  pkt_write(AddressMSB);
+  pkt_write(AddressLSB);
+  pkt_write(fb[datp + 129]);  // status
+  pkt_write(fb[datp + 128]);  // checksum
+  for (int i = 0; i < 128; i++) {
+    pkt_write(fb[datp + i]);
+  }
+  pkt_end();
+}
+
+//Read a frame from Memory Card and send it to serial port
+void psx_read_frame(byte AddressMSB, byte AddressLSB)
+{
+  psx_read_start(AddressMSB, AddressLSB);
+  psx_read_wait();
+  psx_send_frame(AddressMSB, AddressLSB);
+}
+
+//Read count frames starting at sector MSB/LSB and stream them back-to-back.
+//Frame n + 1 is read from the card while frame n is still going out.
+void psx_read_frames(byte AddressMSB, byte AddressLSB, unsigned int count)
+{
+  unsigned int addr = ((unsigned int)AddressMSB << 8) | AddressLSB;
+  while (count-- > 0 && addr < 0x400) {
+    if ( link_expired() ) break; // no S at the new setting, give up on it
+    psx_read_frame(addr >> 8, addr & 0xFF);
+    addr++;
+    delayMicroseconds(SPI_ATT_DELAY); // deselect time between frames
   }
 }
 
 void setup()
 {
-  Serial.begin(38400);
+  Serial.begin(link_bauds[0]);
+  ack_set_delay(SPI_XFER_BYTE_DELAY_MAX);
+  ack_clear();
   spi_setup();
   // attachInterrupt(interrupt, ISR, mode);
   // interrupt: numbers 0 (on digital pin 2) and 1 (on digital pin 3)
@@ -188,49 +534,128 @@ void setup()
   attachInterrupt(0, psx_ack_isr, FALLING);
 }
 
-#define CMDLEN_MAX 3
+#define CMDLEN_MAX 5
 byte cmdbuf[CMDLEN_MAX] = {0};
-unsigned cmdlen = 0;
 
+//Bytes of the command starting with c, the letter included
+byte cmd_len(byte c)
+{
+  switch (c) {
+    case 'R': return 3;
+    case 'B': return 5;
+    case 'D': return 3;
+    case 'M': return 2;
+    case 'L': return 3;
+    case 'A': return 2;
+    case 'T': return 4;
+  }
+  return 1;  // S, or an unknown byte answered with PKT_ERROR
+}
+
+//Run the oldest queued command once it is complete
 void parseCmd() {
+  byte n = cmd_count();
+  if ( n == 0 ) return;
+  byte cmdlen = cmd_len(cmd_peek(0));
+  if ( n < cmdlen ) return; // rest still to come
+  for (byte i = 0; i < cmdlen; i++) {
+    cmdbuf[i] = cmd_peek(i);
+  }
+  cmd_head += cmdlen;       // room for more while this one runs
+
   switch (cmdbuf[0])
   {
     default:
-      Serial.write('E');
+      pkt_begin(PKT_ERROR, 1);
+      pkt_write(cmdbuf[0]);
+      pkt_end();
       break;
 
     case 'R':
-      if ( cmdlen < 3 ) return; // do not reset cmd buf
-      delay(5); // avoid continus read
       psx_read_frame(cmdbuf[1], cmdbuf[2]);
       break;
 
+    case 'B': // B MSB LSB countMSB countLSB
+      psx_read_frames(cmdbuf[1], cmdbuf[2],
+                      ((unsigned int)cmdbuf[3] << 8) | cmdbuf[4]);
+      break;
+
     case 'D':
-      if (cmdlen < 3 ) return;
       SPI_XFER_BYTE_DELAY_MAX = cmdbuf[1];
       SPI_XFER_BYTE_DELAY_MAX <<= 8;
       SPI_XFER_BYTE_DELAY_MAX += cmdbuf[2];
+      ack_set_delay(SPI_XFER_BYTE_DELAY_MAX);
       cmdbuf[1] = SPI_XFER_BYTE_DELAY_MAX>>8;
       cmdbuf[2] = SPI_XFER_BYTE_DELAY_MAX;
-      Serial.write('D');
-      Serial.write(cmdbuf[1]);
-      Serial.write(cmdbuf[2]);
+      pkt_begin(PKT_DELAY, 2);
+      pkt_write(cmdbuf[1]);
+      pkt_write(cmdbuf[2]);
+      pkt_end();
       break;
-      
+
     case 'S':
-      Serial.write('S');
+      link_probation = false; // the host hears us, keep the link
+      pkt_begin(PKT_ID, 1);
+      pkt_write(PKT_VERSION);
+      pkt_end();
+      break;
+
+    case 'M': // M flags
+      mode = cmdbuf[1] & MODE_RLE;
+      pkt_begin(PKT_MODE, 1);
+      pkt_write(mode);
+      pkt_end();
+      break;
+
+    case 'L': // L spi baud
+      if ( cmdbuf[1] >= LINK_SPIS || cmdbuf[2] >= LINK_BAUDS ) {
+        pkt_begin(PKT_ERROR, 1);
+        pkt_write(cmdbuf[0]);
+        pkt_end();
+        break;
+      }
+      if ( !link_probation ) {
+        link_old_spi = link_spi;
+        link_old_baud = link_baud;
+      }
+      pkt_begin(PKT_LINK, 2);
+      pkt_write(cmdbuf[1]);
+      pkt_write(cmdbuf[2]);
+      pkt_end();
+      link_apply(cmdbuf[1], cmdbuf[2]);
+      link_probation = true;
+      link_t0 = millis();
+      break;
+
+    case 'A': // A flags
+      for (byte i = 0; i < ACK_PHASES; i++) {
+        ack_send(i);
+      }
+      if ( cmdbuf[1] & ACK_CLEAR ) ack_clear();
+      break;
+
+    case 'T': // T phase MSB LSB, ACK timeout in usec
+      if ( cmdbuf[1] >= ACK_PHASES ) {
+        pkt_begin(PKT_ERROR, 1);
+        pkt_write(cmdbuf[0]);
+        pkt_end();
+        break;
+      }
+      ack_timeout_us[cmdbuf[1]] = ((unsigned int)cmdbuf[2] << 8) | cmdbuf[3];
+      ack_send(cmdbuf[1]);
       break;
   }
-  memset(cmdbuf, 0 , CMDLEN_MAX);
-  cmdlen = 0;
+  cmd_seq++;
 }
 
 void loop()
 {
-  if (Serial.available() > 0)
-  {
-    cmdbuf[cmdlen++] = Serial.read();
-    parseCmd();
+  if ( link_expired() ) {
+    link_probation = false;
+    link_apply(link_old_spi, link_old_baud);
   }
+  tx_pump();
+  rx_pump();
+  parseCmd();
 }
 
@@ -0,0 +1,41 @@
+/*
+ * PSX memory card protocol constants shared by the host tools.
+ *
+ * Read command, as seen on the wire (Martin Korth, NO$PSX):
+ *  Send Reply Comment
+ *  [0]   81h  N/A   Memory Card Access (unlike 01h=Controller access), dummy response
+ *  [1]   52h  FLAG  Send Read Command (ASCII "R"), Receive FLAG Byte
+ *  [2]   00h  5Ah   Receive Memory Card ID1
+ *  [3]   00h  5Dh   Receive Memory Card ID2
+ *  [4]   MSB  (00h) Send Address MSB  ;\sector number (0..3FFh)
+ *  [5]   LSB  (pre) Send Address LSB  ;/
+ *  [6]   00h  5Ch   Receive Command Acknowledge 1  ;<-- late /ACK after this byte-pair
+ *  [7]   00h  5Dh   Receive Command Acknowledge 2
+ *  [8]   00h  MSB   Receive Confirmed Address MSB
+ *  [9]   00h  LSB   Receive Confirmed Address LSB
+ *  [10]  00h  ...   Receive Data Sector (128 bytes)
+ *  [138] 00h  CHK   Receive Checksum (MSB xor LSB xor Data bytes)
+ *  [139] 00h  47h   Receive Memory End Byte (should be always 47h="G"=Good for Read)
+ */
+#ifndef PSX_H
+#define PSX_H
+
+#define PSX_FRAME_SIZE 128
+#define PSX_FRAME_COUNT 1024
+#define PSX_READ_HDR 10                                 // 81 52 00 00 MSB LSB 00 00 00 00
+#define PSX_READ_LEN (PSX_READ_HDR + PSX_FRAME_SIZE + 2) // + checksum + end byte
+#define PSX_READ_ADDR_LEN 6                             // 81 52 00 00 MSB LSB
+
+#define PSX_OK 0
+#define PSX_ERR_IO (-1)         // transfer failed
+#define PSX_ERR_ADDR (-2)       // confirmed address differs, FFFFh = bad sector
+#define PSX_ERR_CHECKSUM (-3)
+#define PSX_ERR_STATUS (-4)     // end byte not 47h
+#define PSX_ERR_ACK (-5)        // card did not /ACK a byte in time
+#define PSX_ERR_TIMEOUT (-6)    // no answer from the reader in time
+#define PSX_ERR_UNSUPPORTED (-7)
+
+/* Frames one transport read may carry, see psx_transport.h */
+#define PSX_BATCH_MAX 16
+
+#endif // PSX_H
@@ -0,0 +1,301 @@
+/*
+ * ACK-aware byte transfers for the PSX memory card, see psx_ack.h.
+ */
+#define _GNU_SOURCE     // ppoll
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+
+#include "psx.h"
+#include "psx_ack.h"
+#include "psx_trace.h"
+#include "psx_kernels.h"
+
+static const char *phase_names[PSX_PHASE_COUNT] = { "hdr", "addr", "data" };
+
+const char *psx_phase_name( enum psx_phase phase ){
+    return phase < PSX_PHASE_COUNT ? phase_names[phase] : "?";
+}
+
+void psx_ack_reset_stats( struct psx_ack *e ){
+    int i;
+
+    memset(e->stat, 0, sizeof e->stat);
+    for (i = 0; i < PSX_PHASE_COUNT; ++i)
+        e->stat[i].min_us = UINT_MAX;
+}
+
+void psx_ack_add( struct psx_ack_stat *st, unsigned int latency_us ){
+    int b = 0;
+
+    while (b < PSX_ACK_BUCKETS - 1 && (latency_us >> b))
+        ++b;
+    ++st->hist[b];
+    ++st->count;
+    st->sum_us += latency_us;
+    if (latency_us < st->min_us)
+        st->min_us = latency_us;
+    if (latency_us > st->max_us)
+        st->max_us = latency_us;
+}
+
+void psx_ack_init( struct psx_ack *e, const struct psx_ack_io *io ){
+    memset(e, 0, sizeof *e);
+    e->io = *io;
+    e->timeout_us[PSX_PHASE_HDR] = PSX_ACK_TIMEOUT_HDR;
+    e->timeout_us[PSX_PHASE_ADDR] = PSX_ACK_TIMEOUT_ADDR;
+    e->timeout_us[PSX_PHASE_DATA] = PSX_ACK_TIMEOUT_DATA;
+    psx_ack_reset_stats(e);
+}
+
+void psx_ack_print_stats( const struct psx_ack *e ){
+    int i, b;
+
+    for (i = 0; i < PSX_PHASE_COUNT; ++i) {
+        const struct psx_ack_stat *st = &e->stat[i];
+        if (!st->count) {
+            printf("ack %-4s: none, %lu timeouts (%u us)\n",
+                   phase_names[i], st->timeouts, e->timeout_us[i]);
+            continue;
+        }
+        printf("ack %-4s: %lu acks, min %u avg %llu max %u us, %lu timeouts (%u us)\n",
+               phase_names[i], st->count, st->min_us, st->sum_us / st->count,
+               st->max_us, st->timeouts, e->timeout_us[i]);
+        // upper bound of the bucket in usec: count
+        printf("         ");
+        for (b = 0; b < PSX_ACK_BUCKETS; ++b)
+            if (st->hist[b])
+                printf(b < PSX_ACK_BUCKETS - 1 ? " <%u:%lu" : " >=%u:%lu",
+                       b < PSX_ACK_BUCKETS - 1 ? 1u << b : 1u << (b - 1), st->hist[b]);
+        printf("\n");
+    }
+}
+
+/* Exchange bytes from..to-1 of a len byte command. Before every byte but
+ * the first, wait for the /ACK of the one before it, so a caller can look
+ * at a reply before the card is asked to go on. Acks after bytes before
+ * addr_from are header, before data_from address, the rest data phase.
+ */
+static int psx_ack_bytes( struct psx_ack *e, const uint8_t *tx, uint8_t *rx,
+                          int from, int to, int len, int addr_from, int data_from ){
+    int i;
+
+    for (i = from; i < to; ++i) {
+        if (i > 0) {
+            enum psx_phase phase;
+            struct psx_ack_stat *st;
+            unsigned int lat = 0;
+            int ret;
+
+            phase = i - 1 < addr_from ? PSX_PHASE_HDR :
+                    i - 1 < data_from ? PSX_PHASE_ADDR : PSX_PHASE_DATA;
+            st = &e->stat[phase];
+            ret = e->io.wait_ack(e->io.ctx, e->timeout_us[phase], &lat);
+            if (ret != 0) {
+                e->io.release(e->io.ctx);
+                if (ret < 0)
+                    return PSX_ERR_IO;
+                ++st->timeouts;
+                PSX_TRACE_INSTANT("ack timeout", "byte", i - 1);
+                return PSX_ERR_ACK;
+            }
+            psx_ack_add(st, lat);
+        }
+        if (e->io.xfer(e->io.ctx, tx[i], &rx[i], i == len - 1) < 0) {
+            e->io.release(e->io.ctx);
+            return PSX_ERR_IO;
+        }
+    }
+    return PSX_OK;
+}
+
+int psx_ack_read_frame( struct psx_ack *e, unsigned int sector, uint8_t *rx ){
+    uint8_t tx[PSX_READ_LEN] = { 0x81, 0x52, 0x00, 0x00 };
+    int ret;
+
+    tx[4] = 0xFF & (sector >> 8);
+    tx[5] = 0xFF & sector;
+
+    ret = psx_ack_bytes(e, tx, rx, 0, PSX_READ_HDR, PSX_READ_LEN, 4, 8);
+    if (ret != PSX_OK)
+        return ret;
+    // a refused sector comes back as FFFFh, and the card stops there
+    if (rx[8] != tx[4] || rx[9] != tx[5]) {
+        e->io.release(e->io.ctx);
+        return PSX_ERR_ADDR;
+    }
+    return psx_ack_bytes(e, tx, rx, PSX_READ_HDR, PSX_READ_LEN, PSX_READ_LEN, 4, 8);
+}
+
+int psx_ack_get_id( struct psx_ack *e, uint8_t *rx ){
+    uint8_t tx[10] = { 0x81, 0x53 };
+
+    return psx_ack_bytes(e, tx, rx, 0, sizeof tx, sizeof tx, 4, 4);
+}
+
+static int ack_read( void *ctx, unsigned int sector, int n,
+                     const uint8_t **rx, uint8_t *data_xor, int *res, uint64_t *done_ns ){
+    struct psx_ack *e = ctx;
+    int i, j;
+
+    for (i = 0; i < n; ++i) {
+        rx[i] = e->rx[i];
+        PSX_TRACE_BEGIN("ack frame", "sector", sector + i);
+        res[i] = psx_ack_read_frame(e, sector + i, e->rx[i]);
+        PSX_TRACE_END("ack frame", "res", res[i]);
+        done_ns[i] = psx_now_ns();
+        if (res[i] == PSX_ERR_IO)
+            return PSX_ERR_IO;
+        data_xor[i] = 0;
+        for (j = 0; j < PSX_FRAME_SIZE; ++j)
+            data_xor[i] ^= e->rx[i][PSX_READ_HDR + j];
+    }
+    return PSX_OK;
+}
+
+static int ack_get_id( void *ctx, uint8_t *rx ){
+    return psx_ack_get_id(ctx, rx);
+}
+
+static void ack_close( void *ctx ){
+    (void) ctx;
+}
+
+void psx_ack_transport( struct psx_ack *e, struct psx_transport *t ){
+    t->name = "ack";
+    t->ctx = e;
+    t->batch = PSX_BATCH_MAX;
+    t->read = ack_read;
+    t->get_id = ack_get_id;
+    t->close = ack_close;
+}
+
+/* spidev + gpio backend */
+
+/* Drop edges left over from an aborted command. */
+static void hw_drain( struct psx_ack_hw *hw ){
+    struct pollfd p = { hw->event_fd, POLLIN, 0 };
+    struct gpioevent_data ev;
+
+    while (poll(&p, 1, 0) > 0 && read(hw->event_fd, &ev, sizeof ev) == sizeof ev)
+        ;
+}
+
+static int hw_xfer( void *ctx, uint8_t tx, uint8_t *rx, int last ){
+    struct psx_ack_hw *hw = ctx;
+    struct spi_ioc_transfer x;
+    uint8_t b = hw->lsb_first ? BitReverseTable256[tx] : tx;
+    uint8_t r = 0xFF;
+
+    memset(&x, 0, sizeof x);
+    x.tx_buf = (unsigned long) &b;
+    x.rx_buf = (unsigned long) &r;
+    x.len = 1;
+    x.speed_hz = hw->speed_hz;
+    x.bits_per_word = 8;
+    // on the last transfer of a message cs_change keeps the card selected
+    x.cs_change = !last;
+
+    if (ioctl(hw->spi_fd, SPI_IOC_MESSAGE(1), &x) < 0) {
+        perror("SPI_IOC_MESSAGE");
+        return -1;
+    }
+    hw->byte_end_ns = psx_now_ns();
+    *rx = hw->lsb_first ? BitReverseTable256[r] : r;
+    return 0;
+}
+
+static int hw_wait_ack( void *ctx, unsigned int timeout_us, unsigned int *latency_us ){
+    struct psx_ack_hw *hw = ctx;
+    struct pollfd p = { hw->event_fd, POLLIN, 0 };
+    struct timespec ts = { timeout_us / 1000000, (timeout_us % 1000000) * 1000 };
+    struct gpioevent_data ev;
+    uint64_t now;
+    int ret;
+
+    ret = ppoll(&p, 1, &ts, NULL);
+    if (ret < 0) {
+        perror("ppoll ack");
+        return -1;
+    }
+    if (ret == 0)
+        return 1;
+    if (read(hw->event_fd, &ev, sizeof ev) != sizeof ev) {
+        perror("read ack event");
+        return -1;
+    }
+    now = psx_now_ns();
+    // older kernels stamp events with CLOCK_REALTIME, fall back to now
+    if (ev.timestamp > now)
+        ev.timestamp = now;
+    *latency_us = ev.timestamp > hw->byte_end_ns ?
+        (unsigned int) ((ev.timestamp - hw->byte_end_ns) / 1000) : 0;
+    return 0;
+}
+
+static void hw_release( void *ctx ){
+    struct psx_ack_hw *hw = ctx;
+    struct spi_ioc_transfer x;
+
+    // an empty transfer, deselecting after it
+    memset(&x, 0, sizeof x);
+    x.speed_hz = hw->speed_hz;
+    x.bits_per_word = 8;
+    if (ioctl(hw->spi_fd, SPI_IOC_MESSAGE(1), &x) < 0)
+        perror("SPI_IOC_MESSAGE release");
+    hw_drain(hw);
+}
+
+int psx_ack_hw_open( struct psx_ack_hw *hw, int spi_fd, uint32_t speed_hz, int lsb_first,
+                     const char *chip, unsigned int line ){
+    struct gpioevent_request req;
+    int fd;
+
+    memset(hw, 0, sizeof *hw);
+    hw->spi_fd = spi_fd;
+    hw->event_fd = -1;
+    hw->speed_hz = speed_hz;
+    hw->lsb_first = lsb_first;
+
+    fd = open(chip, O_RDONLY);
+    if (fd < 0) {
+        perror(chip);
+        return -1;
+    }
+    memset(&req, 0, sizeof req);
+    req.lineoffset = line;
+    req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+    strncpy(req.consumer_label, "rcard-ack", sizeof req.consumer_label - 1);
+    if (ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+        perror("GPIO_GET_LINEEVENT_IOCTL");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    hw->event_fd = req.fd;
+    hw_drain(hw);
+    return 0;
+}
+
+void psx_ack_hw_close( struct psx_ack_hw *hw ){
+    if (hw->event_fd >= 0)
+        close(hw->event_fd);
+    hw->event_fd = -1;
+}
+
+void psx_ack_hw_io( struct psx_ack_hw *hw, struct psx_ack_io *io ){
+    io->ctx = hw;
+    io->xfer = hw_xfer;
+    io->wait_ack = hw_wait_ack;
+    io->release = hw_release;
+}
@@ -0,0 +1,101 @@
+/*
+ * ACK-aware byte transfers for the PSX memory card.
+ *
+ * The card pulls /ACK (PSX_ACK, GPIO25) low after every byte it wants
+ * the next one for, except the last. Instead of padding every byte with
+ * a fixed delay, the engine exchanges one byte at a time and waits for
+ * that edge. The wait window depends on the phase of the command: the
+ * card answers the header bytes quickly, takes long after the address
+ * ("late /ACK") and is quick again while streaming data.
+ *
+ * Bytes are in logical (lsb first) order here, backends do the reversing.
+ */
+#ifndef PSX_ACK_H
+#define PSX_ACK_H
+
+#include <stdint.h>
+
+#include "psx.h"
+#include "psx_proto.h"
+#include "psx_transport.h"
+
+enum psx_phase {
+    PSX_PHASE_HDR,      // 81 cmd 00 00
+    PSX_PHASE_ADDR,     // MSB LSB and the two command acknowledge bytes
+    PSX_PHASE_DATA,     // confirmed address, data, checksum
+    PSX_PHASE_COUNT
+};
+
+#define PSX_ACK_TIMEOUT_HDR 100    // usec
+#define PSX_ACK_TIMEOUT_ADDR 2000  // usec
+#define PSX_ACK_TIMEOUT_DATA 100   // usec
+
+/* Measured /ACK latencies of one phase, from the end of the byte
+ * to the falling edge. hist[i] counts latencies in [2^(i-1), 2^i) usec,
+ * hist[0] zeroes and the last bucket everything above.
+ */
+struct psx_ack_stat {
+    unsigned long count;
+    unsigned long timeouts;
+    unsigned int min_us;
+    unsigned int max_us;
+    unsigned long long sum_us;
+    unsigned long hist[PSX_ACK_BUCKETS];
+};
+
+/* Byte level access to a card.
+ * xfer     exchange one byte, keep the card selected unless last is set.
+ * wait_ack wait up to timeout_us for /ACK, 0 when seen (latency_us set),
+ *          1 on timeout, negative on error.
+ * release  deselect the card, after an aborted command.
+ */
+struct psx_ack_io {
+    void *ctx;
+    int (*xfer)( void *ctx, uint8_t tx, uint8_t *rx, int last );
+    int (*wait_ack)( void *ctx, unsigned int timeout_us, unsigned int *latency_us );
+    void (*release)( void *ctx );
+};
+
+struct psx_ack {
+    struct psx_ack_io io;
+    unsigned int timeout_us[PSX_PHASE_COUNT];
+    struct psx_ack_stat stat[PSX_PHASE_COUNT];
+    uint8_t rx[PSX_BATCH_MAX][PSX_READ_LEN];
+};
+
+void psx_ack_init( struct psx_ack *e, const struct psx_ack_io *io );
+void psx_ack_reset_stats( struct psx_ack *e );
+void psx_ack_add( struct psx_ack_stat *st, unsigned int latency_us );
+void psx_ack_print_stats( const struct psx_ack *e );
+const char *psx_phase_name( enum psx_phase phase );
+
+/* Read one sector into rx (PSX_READ_LEN bytes, same layout as the wire).
+ * Returns PSX_OK, PSX_ERR_ADDR when the card refused the sector,
+ * PSX_ERR_ACK when a byte was not acknowledged or PSX_ERR_IO.
+ * Checksum and end byte are left to the caller.
+ */
+int psx_ack_read_frame( struct psx_ack *e, unsigned int sector, uint8_t *rx );
+
+/* Get ID command, rx gets the 10 reply bytes. */
+int psx_ack_get_id( struct psx_ack *e, uint8_t *rx );
+
+/* The engine as a transport, over whatever io it was set up with. */
+void psx_ack_transport( struct psx_ack *e, struct psx_transport *t );
+
+/* spidev + gpio character device backend. The spidev fd must already
+ * be set up; lsb_first reverses bits in software like the rest of rcard.
+ */
+struct psx_ack_hw {
+    int spi_fd;
+    int event_fd;               // line event fd of the /ACK gpio
+    int lsb_first;
+    uint32_t speed_hz;
+    uint64_t byte_end_ns;       // CLOCK_MONOTONIC at the end of the last byte
+};
+
+int psx_ack_hw_open( struct psx_ack_hw *hw, int spi_fd, uint32_t speed_hz, int lsb_first,
+                     const char *chip, unsigned int line );
+void psx_ack_hw_close( struct psx_ack_hw *hw );
+void psx_ack_hw_io( struct psx_ack_hw *hw, struct psx_ack_io *io );
+
+#endif // PSX_ACK_H
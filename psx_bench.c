@@ -0,0 +1,123 @@
+/*
+ * Microbenchmark of the bit order kernels in psx_kernels.c.
+ *
+ * For buffer sizes from one short command to a whole 128 KB card,
+ * reports bytes per cycle (bytes per ns where there is no cycle
+ * counter) of every kernel usable on this cpu, against the old path:
+ * table lookup followed by a separate XOR checksum pass.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "psx_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICK_UNIT "B/cycle"
+static uint64_t ticks(void) { return __rdtsc(); }
+#else
+#define TICK_UNIT "B/ns"
+static uint64_t ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define BYTES_PER_RUN (64UL << 20)     // per measurement
+#define CARD_SIZE (1024 * 128)
+
+static const size_t sizes[] = {
+    10,             // get id command
+    140,            // one frame read
+    16 * 140,       // one batched SPI message
+    64 * 128,       // one block
+    CARD_SIZE       // whole card
+};
+
+static volatile uint8_t sink;
+
+/* old rcard.c path: table reverse, then a separate checksum pass */
+static uint8_t table_then_xor( uint8_t *p, size_t len, const struct psx_kernel *table ){
+    uint8_t x = 0;
+    size_t i;
+    table->reverse(p, len);
+    for (i = 0; i < len; ++i)
+        x ^= p[i];
+    return x;
+}
+
+static double rate( uint64_t t, size_t bytes ){
+    return t ? (double)bytes / t : 0.0;
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t buf[CARD_SIZE], ref[CARD_SIZE], out[CARD_SIZE];
+    const struct psx_kernel *k;
+    int nk, i;
+    size_t si;
+
+    (void)argc;
+    (void)argv;
+
+    k = psx_kernels(&nk);
+    srand(1);
+    for (si = 0; si < sizeof buf; ++si)
+        buf[si] = rand();
+
+    // every kernel must agree with the table
+    for (i = 0; i < nk; ++i) {
+        for (si = 0; si < ARRAY_SIZE(sizes); ++si) {
+            size_t len = sizes[si] - 3;     // odd length hits the tails
+            uint8_t x, xr;
+            memcpy(ref, buf, len);
+            xr = table_then_xor(ref, len, &k[0]);
+            memcpy(out, buf, len);
+            x = k[i].reverse_xor(out, len);
+            if (x != xr || memcmp(ref, out, len)) {
+                fprintf(stderr, "kernel %s wrong at %zu bytes\n", k[i].name, len);
+                return 1;
+            }
+        }
+    }
+
+    printf("best kernel: %s\n", psx_kernel_best()->name);
+    printf("%-8s %-12s", "bytes", "table+xor");
+    for (i = 0; i < nk; ++i)
+        printf(" %-12s %-12s", k[i].name, "+xor fused");
+    printf("  (%s)\n", TICK_UNIT);
+
+    for (si = 0; si < ARRAY_SIZE(sizes); ++si) {
+        size_t len = sizes[si];
+        unsigned long runs = BYTES_PER_RUN / len, r;
+        uint64_t t;
+
+        printf("%-8zu", len);
+        t = ticks();
+        for (r = 0; r < runs; ++r)
+            sink = table_then_xor(buf, len, &k[0]);
+        printf(" %-12.3f", rate(ticks() - t, runs * len));
+
+        for (i = 0; i < nk; ++i) {
+            t = ticks();
+            for (r = 0; r < runs; ++r)
+                k[i].reverse(buf, len);
+            sink = buf[0];
+            printf(" %-12.3f", rate(ticks() - t, runs * len));
+
+            t = ticks();
+            for (r = 0; r < runs; ++r)
+                sink = k[i].reverse_xor(buf, len);
+            printf(" %-12.3f", rate(ticks() - t, runs * len));
+        }
+        puts("");
+    }
+    return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Memory card protocol engine, see psx_engine.h.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "psx_engine.h"
+#include "psx_trace.h"
+
+void psx_print_buffer( const uint8_t *buf, int len ){
+    int i;
+    for (i = 0; i < len; i++) {
+        if (!(i % 8))
+            printf("    ");
+        if (!(i % 16 ) )
+            puts("");
+        printf("%.2X ", buf[i]);
+    }
+    puts("");
+}
+
+void psx_engine_init( struct psx_engine *e, struct psx_transport *t ){
+    memset(e, 0, sizeof *e);
+    e->t = t;
+    e->batch = t->batch;
+}
+
+int psx_check_frame( const uint8_t *rx, unsigned int sector,
+                     uint8_t data_xor, uint8_t *data ){
+    uint8_t MSB = 0xFF & (sector >> 8);
+    uint8_t LSB = 0xFF & sector;
+
+    if (rx[8] != MSB || rx[9] != LSB)
+        return PSX_ERR_ADDR;
+
+    // MSB xor LSB xor DATA
+    uint8_t chk = MSB ^ LSB ^ data_xor;
+    if (chk != rx[PSX_READ_LEN - 2])
+        return PSX_ERR_CHECKSUM;
+    if (rx[PSX_READ_LEN - 1] != 0x47)
+        return PSX_ERR_STATUS;
+
+    if (data)
+        memcpy(data, rx + PSX_READ_HDR, PSX_FRAME_SIZE);
+    return PSX_OK;
+}
+
+int psx_read_sectors( struct psx_engine *e, unsigned int sector, int n,
+                      uint8_t *data, int *res ){
+    const uint8_t *rx[PSX_BATCH_MAX];
+    uint8_t data_xor[PSX_BATCH_MAX];
+    uint64_t done_ns[PSX_BATCH_MAX];
+    int done, i, m, ret, good = 0;
+
+    for (done = 0; done < n; done += m) {
+        m = n - done;
+        if (m > e->batch)
+            m = e->batch;
+        PSX_TRACE_BEGIN("read", "sector", sector + done);
+        ret = e->t->read(e->t->ctx, sector + done, m, rx, data_xor, res + done, done_ns);
+        PSX_TRACE_END("read", "frames", m);
+        if (ret != PSX_OK)
+            return ret;
+
+        for (i = 0; i < m; ++i) {
+            int *r = &res[done + i];
+            if (e->verbose) {
+                printf("psx_read_sectors() 0x%x %d\n", sector + done + i, *r);
+                psx_print_buffer(rx[i], PSX_READ_LEN);
+            }
+            if (*r == PSX_OK)
+                *r = psx_check_frame(rx[i], sector + done + i, data_xor[i],
+                                     data ? data + (done + i) * PSX_FRAME_SIZE : NULL);
+            ++e->frames;
+            if (*r == PSX_OK)
+                ++good;
+            else
+                ++e->bad;
+            if (e->on_frame)
+                e->on_frame(e->arg, sector + done + i, *r, done_ns[i]);
+        }
+    }
+    return good;
+}
+
+int psx_read_sector( struct psx_engine *e, unsigned int sector, uint8_t *data ){
+    int res, ret;
+
+    ret = psx_read_sectors(e, sector, 1, data, &res);
+    return ret < 0 ? ret : res;
+}
+
+int psx_link_clean( struct psx_engine *e ){
+    struct psx_engine probe = *e;
+    int res[PSX_LINK_TEST_FRAMES];
+    int ret;
+
+    probe.on_frame = NULL;
+    probe.verbose = 0;
+    ret = psx_read_sectors(&probe, 0, PSX_LINK_TEST_FRAMES, NULL, res);
+    if (ret < 0)
+        return ret;
+    return ret == PSX_LINK_TEST_FRAMES;
+}
+
+int psx_get_id( struct psx_engine *e, uint8_t *rx ){
+    if (!e->t->get_id)
+        return PSX_ERR_UNSUPPORTED;
+    return e->t->get_id(e->t->ctx, rx);
+}
+
+enum psx_fail psx_fail_of( int res ){
+    switch (res) {
+    case PSX_ERR_ADDR: return PSX_FAIL_BAD_SECTOR;     // FFFFh confirmed
+    case PSX_ERR_CHECKSUM: return PSX_FAIL_CHECKSUM;
+    case PSX_ERR_STATUS: return PSX_FAIL_STATUS;
+    }
+    return PSX_FAIL_TIMEOUT;
+}
+
+/* Read all 16 blocks x 64 frames, e->batch at a time.
+ * Failed frames are retried alone, every frame must pass
+ * address, checksum and end byte checks.
+ */
+int psx_read_card( struct psx_engine *e, uint8_t *card ){
+    int res[PSX_BATCH_MAX];
+    unsigned int sector;
+    int ret, fails, i, n;
+
+    for (sector = 0; sector < PSX_FRAME_COUNT; sector += n) {
+        n = e->batch;
+        if (n > (int) (PSX_FRAME_COUNT - sector))
+            n = PSX_FRAME_COUNT - sector;
+        ret = psx_read_sectors(e, sector, n, card + sector * PSX_FRAME_SIZE, res);
+        if (ret < 0)
+            return ret;
+
+        for (i = 0; i < n; ++i) {
+            ret = res[i];
+            for (fails = 1; ret != PSX_OK && fails < psx_retry_limit[psx_fail_of(ret)]; ++fails) {
+                ++e->retries;
+                PSX_TRACE_INSTANT("retry", "sector", sector + i);
+                ret = psx_read_sector(e, sector + i, card + (sector + i) * PSX_FRAME_SIZE);
+            }
+            if (ret != PSX_OK) {
+                fprintf(stderr, "psx_dump() frame 0x%x failed (%d, %s)\n", sector + i, ret,
+                        psx_fail_name(psx_fail_of(ret)));
+                return ret;
+            }
+        }
+        if (e->progress && !(sector % 64))
+            printf("block %d\n", sector / 64);
+    }
+    return PSX_OK;
+}
+
+/* Read the card and write it to a .mcr image, the file is only
+ * put in place once the whole card is good.
+ */
+int psx_dump( struct psx_engine *e, const char *path ){
+    static uint8_t card[PSX_FRAME_COUNT * PSX_FRAME_SIZE];
+    char tmp[4096];
+    size_t written;
+    int ret;
+    FILE *f;
+
+    ret = psx_read_card(e, card);
+    if (ret != PSX_OK)
+        return ret;
+
+    snprintf(tmp, sizeof tmp, "%s.tmp", path);
+    f = fopen(tmp, "wb");
+    if (!f) {
+        perror(tmp);
+        return PSX_ERR_IO;
+    }
+    written = fwrite(card, sizeof card, 1, f);
+    // close in any case, a failed write leaves nothing to keep
+    if (fclose(f) != 0 || written != 1) {
+        perror(tmp);
+        unlink(tmp);
+        return PSX_ERR_IO;
+    }
+    if (rename(tmp, path) < 0) {
+        perror(path);
+        return PSX_ERR_IO;
+    }
+    printf("%s saved\n", path);
+    return PSX_OK;
+}
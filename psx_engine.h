@@ -0,0 +1,70 @@
+/*
+ * Memory card protocol engine: frame checks, batching, retries and
+ * whole-card dumps on top of any psx_transport.
+ */
+#ifndef PSX_ENGINE_H
+#define PSX_ENGINE_H
+
+#include <stdint.h>
+
+#include "psx.h"
+#include "psx_proto.h"
+#include "psx_transport.h"
+
+struct psx_engine {
+    struct psx_transport *t;
+    int batch;                  // frames per transport read, <= t->batch
+    int verbose;                // print every frame read
+    int progress;               // print every block read by psx_read_card()
+
+    /* Called for every frame read, good or not, with the time
+     * it was complete. May be NULL.
+     */
+    void (*on_frame)( void *arg, unsigned int sector, int res, uint64_t done_ns );
+    void *arg;
+
+    unsigned long frames;       // frames read
+    unsigned long bad;          // of which failed
+    unsigned long retries;      // frames read again by psx_read_card()
+};
+
+void psx_engine_init( struct psx_engine *e, struct psx_transport *t );
+
+/* Check one received frame (in logical bit order) and copy its data.
+ * data_xor is the XOR of the 128 data bytes.
+ */
+int psx_check_frame( const uint8_t *rx, unsigned int sector,
+                     uint8_t data_xor, uint8_t *data );
+
+/* Read n consecutive sectors, e->batch at a time.
+ * res[i] gets the result of frame i, data the n * 128 bytes of frames.
+ * Returns the number of good frames, or the transport error.
+ */
+int psx_read_sectors( struct psx_engine *e, unsigned int sector, int n,
+                      uint8_t *data, int *res );
+int psx_read_sector( struct psx_engine *e, unsigned int sector, uint8_t *data );
+
+/* Read the first PSX_LINK_TEST_FRAMES frames and check them, for
+ * trying out a faster link. 1 if all came back good, 0 if not, or the
+ * transport error. Not counted in the engine's statistics.
+ */
+#define PSX_LINK_TEST_FRAMES 8
+int psx_link_clean( struct psx_engine *e );
+
+/* Get ID command, rx gets the 10 reply bytes. */
+int psx_get_id( struct psx_engine *e, uint8_t *rx );
+
+/* psx_fail reason of a failed frame result. */
+enum psx_fail psx_fail_of( int res );
+
+/* Read the whole card into card (PSX_FRAME_COUNT * PSX_FRAME_SIZE).
+ * A failed frame is read again up to psx_retry_limit of its reason.
+ */
+int psx_read_card( struct psx_engine *e, uint8_t *card );
+
+/* Read the whole card and write it to a .mcr image. */
+int psx_dump( struct psx_engine *e, const char *path );
+
+void psx_print_buffer( const uint8_t *buf, int len );
+
+#endif // PSX_ENGINE_H
@@ -0,0 +1,281 @@
+/*
+ * Bit order kernels for the PSX SPI path, see psx_kernels.h.
+ */
+
+#include <string.h>
+
+#include "psx_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PSX_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PSX_NEON 1
+#endif
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+// Reverse table is used because we don't know how to change bit-order on SPI settings
+const uint8_t BitReverseTable256[256] = {
+    0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0, 0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0,
+    0x08, 0x88, 0x48, 0xC8, 0x28, 0xA8, 0x68, 0xE8, 0x18, 0x98, 0x58, 0xD8, 0x38, 0xB8, 0x78, 0xF8,
+    0x04, 0x84, 0x44, 0xC4, 0x24, 0xA4, 0x64, 0xE4, 0x14, 0x94, 0x54, 0xD4, 0x34, 0xB4, 0x74, 0xF4,
+    0x0C, 0x8C, 0x4C, 0xCC, 0x2C, 0xAC, 0x6C, 0xEC, 0x1C, 0x9C, 0x5C, 0xDC, 0x3C, 0xBC, 0x7C, 0xFC,
+    0x02, 0x82, 0x42, 0xC2, 0x22, 0xA2, 0x62, 0xE2, 0x12, 0x92, 0x52, 0xD2, 0x32, 0xB2, 0x72, 0xF2,
+    0x0A, 0x8A, 0x4A, 0xCA, 0x2A, 0xAA, 0x6A, 0xEA, 0x1A, 0x9A, 0x5A, 0xDA, 0x3A, 0xBA, 0x7A, 0xFA,
+    0x06, 0x86, 0x46, 0xC6, 0x26, 0xA6, 0x66, 0xE6, 0x16, 0x96, 0x56, 0xD6, 0x36, 0xB6, 0x76, 0xF6,
+    0x0E, 0x8E, 0x4E, 0xCE, 0x2E, 0xAE, 0x6E, 0xEE, 0x1E, 0x9E, 0x5E, 0xDE, 0x3E, 0xBE, 0x7E, 0xFE,
+    0x01, 0x81, 0x41, 0xC1, 0x21, 0xA1, 0x61, 0xE1, 0x11, 0x91, 0x51, 0xD1, 0x31, 0xB1, 0x71, 0xF1,
+    0x09, 0x89, 0x49, 0xC9, 0x29, 0xA9, 0x69, 0xE9, 0x19, 0x99, 0x59, 0xD9, 0x39, 0xB9, 0x79, 0xF9,
+    0x05, 0x85, 0x45, 0xC5, 0x25, 0xA5, 0x65, 0xE5, 0x15, 0x95, 0x55, 0xD5, 0x35, 0xB5, 0x75, 0xF5,
+    0x0D, 0x8D, 0x4D, 0xCD, 0x2D, 0xAD, 0x6D, 0xED, 0x1D, 0x9D, 0x5D, 0xDD, 0x3D, 0xBD, 0x7D, 0xFD,
+    0x03, 0x83, 0x43, 0xC3, 0x23, 0xA3, 0x63, 0xE3, 0x13, 0x93, 0x53, 0xD3, 0x33, 0xB3, 0x73, 0xF3,
+    0x0B, 0x8B, 0x4B, 0xCB, 0x2B, 0xAB, 0x6B, 0xEB, 0x1B, 0x9B, 0x5B, 0xDB, 0x3B, 0xBB, 0x7B, 0xFB,
+    0x07, 0x87, 0x47, 0xC7, 0x27, 0xA7, 0x67, 0xE7, 0x17, 0x97, 0x57, 0xD7, 0x37, 0xB7, 0x77, 0xF7,
+    0x0F, 0x8F, 0x4F, 0xCF, 0x2F, 0xAF, 0x6F, 0xEF, 0x1F, 0x9F, 0x5F, 0xDF, 0x3F, 0xBF, 0x7F, 0xFF
+};
+
+/* table lookup, one byte at a time */
+
+static void reverse_table( uint8_t *p, size_t len ){
+    size_t i;
+    for ( i = 0; i < len; ++i ){
+        p[i] = BitReverseTable256[p[i]];
+    }
+}
+
+static uint8_t reverse_xor_table( uint8_t *p, size_t len ){
+    uint8_t x = 0;
+    size_t i;
+    for ( i = 0; i < len; ++i ){
+        p[i] = BitReverseTable256[p[i]];
+        x ^= p[i];
+    }
+    return x;
+}
+
+/* eight bytes at a time in a 64 bit word: swap nibbles, pairs, bits */
+
+static inline uint64_t reverse_word64( uint64_t w ){
+    w = ((w >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((w & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    w = ((w >> 2) & 0x3333333333333333ULL) | ((w & 0x3333333333333333ULL) << 2);
+    w = ((w >> 1) & 0x5555555555555555ULL) | ((w & 0x5555555555555555ULL) << 1);
+    return w;
+}
+
+static inline uint8_t fold64( uint64_t w ){
+    w ^= w >> 32;
+    w ^= w >> 16;
+    w ^= w >> 8;
+    return w;
+}
+
+static void reverse_word( uint8_t *p, size_t len ){
+    size_t i = 0;
+    for ( ; i + 8 <= len; i += 8 ){
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        w = reverse_word64(w);
+        memcpy(p + i, &w, 8);
+    }
+    reverse_table(p + i, len - i);
+}
+
+static uint8_t reverse_xor_word( uint8_t *p, size_t len ){
+    uint64_t x = 0;
+    size_t i = 0;
+    for ( ; i + 8 <= len; i += 8 ){
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        w = reverse_word64(w);
+        memcpy(p + i, &w, 8);
+        x ^= w;
+    }
+    return fold64(x) ^ reverse_xor_table(p + i, len - i);
+}
+
+#ifdef PSX_X86
+
+/* SSE2: same shifts and masks on 16 bytes */
+
+static inline __m128i reverse_sse2_16( __m128i v ){
+    const __m128i m4 = _mm_set1_epi8(0x0F);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 4), m4),
+                     _mm_slli_epi16(_mm_and_si128(v, m4), 4));
+    v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 2), m2),
+                     _mm_slli_epi16(_mm_and_si128(v, m2), 2));
+    v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 1), m1),
+                     _mm_slli_epi16(_mm_and_si128(v, m1), 1));
+    return v;
+}
+
+static inline uint8_t fold128( __m128i x ){
+    uint64_t lo = _mm_cvtsi128_si64(x);
+    uint64_t hi = _mm_cvtsi128_si64(_mm_unpackhi_epi64(x, x));
+    return fold64(lo ^ hi);
+}
+
+__attribute__((target("sse2")))
+static void reverse_sse2( uint8_t *p, size_t len ){
+    size_t i = 0;
+    for ( ; i + 16 <= len; i += 16 ){
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        _mm_storeu_si128((__m128i *)(p + i), reverse_sse2_16(v));
+    }
+    reverse_word(p + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static uint8_t reverse_xor_sse2( uint8_t *p, size_t len ){
+    __m128i x = _mm_setzero_si128();
+    size_t i = 0;
+    for ( ; i + 16 <= len; i += 16 ){
+        __m128i v = reverse_sse2_16(_mm_loadu_si128((const __m128i *)(p + i)));
+        _mm_storeu_si128((__m128i *)(p + i), v);
+        x = _mm_xor_si128(x, v);
+    }
+    return fold128(x) ^ reverse_xor_word(p + i, len - i);
+}
+
+/* AVX2: reverse each nibble with a 16 entry shuffle table, 32 bytes at once */
+
+__attribute__((target("avx2")))
+static inline __m256i reverse_avx2_32( __m256i v ){
+    const __m256i lut = _mm256_setr_epi8(
+        0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE, 0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF,
+        0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE, 0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF);
+    const __m256i m4 = _mm256_set1_epi8(0x0F);
+    __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, m4));
+    __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), m4));
+    return _mm256_or_si256(_mm256_slli_epi16(lo, 4), hi);
+}
+
+__attribute__((target("avx2")))
+static void reverse_avx2( uint8_t *p, size_t len ){
+    size_t i = 0;
+    for ( ; i + 32 <= len; i += 32 ){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        _mm256_storeu_si256((__m256i *)(p + i), reverse_avx2_32(v));
+    }
+    // tail in general purpose registers, no AVX/SSE transitions
+    reverse_word(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint8_t reverse_xor_avx2( uint8_t *p, size_t len ){
+    __m256i x = _mm256_setzero_si256();
+    size_t i = 0;
+    for ( ; i + 32 <= len; i += 32 ){
+        __m256i v = reverse_avx2_32(_mm256_loadu_si256((const __m256i *)(p + i)));
+        _mm256_storeu_si256((__m256i *)(p + i), v);
+        x = _mm256_xor_si256(x, v);
+    }
+    __m128i x128 = _mm_xor_si128(_mm256_castsi256_si128(x),
+                                 _mm256_extracti128_si256(x, 1));
+    return fold128(x128) ^ reverse_xor_word(p + i, len - i);
+}
+
+#endif // PSX_X86
+
+#ifdef PSX_NEON
+
+/* NEON: byte-wise shifts, no masking needed for u8 lanes */
+
+static inline uint8x16_t reverse_neon_16( uint8x16_t v ){
+#ifdef __aarch64__
+    return vrbitq_u8(v);
+#else
+    v = vorrq_u8(vshrq_n_u8(v, 4), vshlq_n_u8(v, 4));
+    v = vorrq_u8(vandq_u8(vshrq_n_u8(v, 2), vdupq_n_u8(0x33)),
+                 vshlq_n_u8(vandq_u8(v, vdupq_n_u8(0x33)), 2));
+    v = vorrq_u8(vandq_u8(vshrq_n_u8(v, 1), vdupq_n_u8(0x55)),
+                 vshlq_n_u8(vandq_u8(v, vdupq_n_u8(0x55)), 1));
+    return v;
+#endif
+}
+
+static void reverse_neon( uint8_t *p, size_t len ){
+    size_t i = 0;
+    for ( ; i + 16 <= len; i += 16 ){
+        vst1q_u8(p + i, reverse_neon_16(vld1q_u8(p + i)));
+    }
+    reverse_word(p + i, len - i);
+}
+
+static uint8_t reverse_xor_neon( uint8_t *p, size_t len ){
+    uint8x16_t x = vdupq_n_u8(0);
+    size_t i = 0;
+    for ( ; i + 16 <= len; i += 16 ){
+        uint8x16_t v = reverse_neon_16(vld1q_u8(p + i));
+        vst1q_u8(p + i, v);
+        x = veorq_u8(x, v);
+    }
+    uint64x2_t x64 = vreinterpretq_u64_u8(x);
+    return fold64(vgetq_lane_u64(x64, 0) ^ vgetq_lane_u64(x64, 1))
+        ^ reverse_xor_word(p + i, len - i);
+}
+
+#endif // PSX_NEON
+
+static const struct psx_kernel all_kernels[] = {
+    { "table", reverse_table, reverse_xor_table },
+    { "word", reverse_word, reverse_xor_word },
+#ifdef PSX_X86
+    { "sse2", reverse_sse2, reverse_xor_sse2 },
+    { "avx2", reverse_avx2, reverse_xor_avx2 },
+#endif
+#ifdef PSX_NEON
+    { "neon", reverse_neon, reverse_xor_neon },
+#endif
+};
+
+static int kernel_supported( const struct psx_kernel *k ){
+#ifdef PSX_X86
+    if (k->reverse == reverse_sse2)
+        return __builtin_cpu_supports("sse2");
+    if (k->reverse == reverse_avx2)
+        return __builtin_cpu_supports("avx2");
+#endif
+    (void)k;
+    return 1;
+}
+
+const struct psx_kernel *psx_kernels( int *count ){
+    static struct psx_kernel usable[ARRAY_SIZE(all_kernels)];
+    static int n = -1;
+    size_t i;
+
+    if (n < 0) {
+        n = 0;
+        for (i = 0; i < ARRAY_SIZE(all_kernels); ++i)
+            if (kernel_supported(&all_kernels[i]))
+                usable[n++] = all_kernels[i];
+    }
+    *count = n;
+    return usable;
+}
+
+const struct psx_kernel *psx_kernel_best( void ){
+    int n;
+    const struct psx_kernel *k = psx_kernels(&n);
+    return &k[n - 1];
+}
+
+void psx_reverse( uint8_t *p, size_t len ){
+    static psx_reverse_fn fn;
+    if (!fn)
+        fn = psx_kernel_best()->reverse;
+    fn(p, len);
+}
+
+uint8_t psx_reverse_xor( uint8_t *p, size_t len ){
+    static psx_reverse_xor_fn fn;
+    if (!fn)
+        fn = psx_kernel_best()->reverse_xor;
+    return fn(p, len);
+}
@@ -0,0 +1,34 @@
+/*
+ * Bit order kernels for the PSX SPI path.
+ *
+ * The spidev driver can't send lsb first, so every byte going to and
+ * coming from the card has its bits reversed in software. These are
+ * the table, word-wide and SIMD versions of that, plus fused versions
+ * that also return the XOR of the reversed bytes (the frame checksum).
+ */
+#ifndef PSX_KERNELS_H
+#define PSX_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern const uint8_t BitReverseTable256[256];
+
+typedef void (*psx_reverse_fn)( uint8_t *p, size_t len );
+typedef uint8_t (*psx_reverse_xor_fn)( uint8_t *p, size_t len );
+
+struct psx_kernel {
+    const char *name;
+    psx_reverse_fn reverse;             // reverse bits of every byte in place
+    psx_reverse_xor_fn reverse_xor;     // same, returns XOR of the result
+};
+
+/* Kernels usable on this cpu, table lookup first, best last. */
+const struct psx_kernel *psx_kernels( int *count );
+const struct psx_kernel *psx_kernel_best( void );
+
+/* Best kernel, picked at first use. */
+void psx_reverse( uint8_t *p, size_t len );
+uint8_t psx_reverse_xor( uint8_t *p, size_t len );
+
+#endif // PSX_KERNELS_H
@@ -0,0 +1,92 @@
+/*
+ * Wire protocol of the Arduino reader, see psx_proto.h.
+ */
+#include <string.h>
+
+#include "psx_proto.h"
+
+const int psx_link_spi_hz[PSX_LINK_SPIS] = { 125000, 250000, 500000, 1000000 };
+const int psx_link_baud[PSX_LINK_BAUDS] = { 38400, 57600, 115200, 500000, 1000000 };
+
+// a refused sector rarely comes good, noise on the line usually does
+const int psx_retry_limit[PSX_FAIL_REASONS] = {
+    8,  // PSX_FAIL_TIMEOUT
+    8,  // PSX_FAIL_CHECKSUM
+    6,  // PSX_FAIL_CARD_CHECKSUM
+    3,  // PSX_FAIL_BAD_SECTOR
+    4,  // PSX_FAIL_STATUS
+    8   // PSX_FAIL_LOST
+};
+
+static const char *fail_names[PSX_FAIL_REASONS] = {
+    "timeout", "checksum", "card checksum (4E)", "bad sector (FF)", "status",
+    "lost"
+};
+
+const char *psx_fail_name( int reason ){
+    if (reason < 0 || reason >= PSX_FAIL_REASONS)
+        return "?";
+    return fail_names[reason];
+}
+
+uint16_t psx_crc16( uint16_t crc, const uint8_t *p, size_t len ){
+    // same as avr-libc _crc_ccitt_update()
+    while (len--) {
+        uint8_t d = *p++;
+        d ^= crc & 0xFF;
+        d ^= d << 4;
+        crc = ((uint16_t) d << 8 | (crc >> 8)) ^ (uint8_t) (d >> 4) ^ ((uint16_t) d << 3);
+    }
+    return crc;
+}
+
+int psx_rle_encode( const uint8_t *in, int len, uint8_t *out, int max ){
+    int i = 0, n = 0;
+
+    while (i < len) {
+        int run = 1, start;
+
+        while (i + run < len && run < 129 && in[i + run] == in[i])
+            ++run;
+        if (run >= 2) {
+            if (n + 2 >= max)
+                return 0;
+            out[n++] = 0x7E + run;
+            out[n++] = in[i];
+            i += run;
+            continue;
+        }
+        // literals up to the next pair, which may start a run
+        start = i;
+        while (i < len && i - start < 128 && !(i + 1 < len && in[i] == in[i + 1]))
+            ++i;
+        if (n + 1 + (i - start) >= max)
+            return 0;
+        out[n++] = i - start - 1;
+        memcpy(out + n, in + start, i - start);
+        n += i - start;
+    }
+    return n;
+}
+
+int psx_rle_decode( const uint8_t *in, int len, uint8_t *out, int max ){
+    int i = 0, n = 0;
+
+    while (i < len) {
+        uint8_t c = in[i++];
+
+        if (c < 0x80) {
+            if (i + c + 1 > len || n + c + 1 > max)
+                return -1;
+            memcpy(out + n, in + i, c + 1);
+            i += c + 1;
+            n += c + 1;
+        } else {
+            if (i >= len || n + c - 0x7E > max)
+                return -1;
+            memset(out + n, in[i++], c - 0x7E);
+            n += c - 0x7E;
+        }
+    }
+    return n;
+}
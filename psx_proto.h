@@ -0,0 +1,87 @@
+/*
+ * Wire protocol of the Arduino reader (arduino/rcard) and the dump
+ * policy, shared by the C tools and RcardClient. Plain C, no host
+ * dependencies, so the Qt side compiles and includes it as it is.
+ *
+ * Answers come back as packets:
+ * | A5 | 5A | VER | TYPE | SEQ | LEN | payload[LEN] | CRC lo | CRC hi |
+ * CRC-16/CCITT (reflected, init FFFF) over VER .. payload.
+ *
+ * PSX_PKT_FRAME_RLE carries a frame the firmware checked itself:
+ * | MSB, 80h if the checksum was bad | LSB | status | code |
+ * where code is PackBits: c < 80h is followed by c + 1 literal bytes,
+ * c >= 80h by one byte repeated c - 7Eh times.
+ *
+ * PSX_PKT_ACKSTAT holds the /ACK statistics of one phase of a read:
+ * | phase | timeout[4] | count[4] | timeouts[2] | min[2] | max[2] | sum[4] | hist[16][2] |
+ * all MSB first, in usec, hist[i] counting [2^(i-1), 2^i).
+ */
+#ifndef PSX_PROTO_H
+#define PSX_PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PSX_PKT_SYNC0 0xA5
+#define PSX_PKT_SYNC1 0x5A
+#define PSX_PKT_VERSION 1
+#define PSX_PKT_HEADER 6               // sync, ver, type, seq, len
+#define PSX_PKT_CRC 2
+#define PSX_PKT_MAX (PSX_PKT_HEADER + 255 + PSX_PKT_CRC)
+
+#define PSX_PKT_FRAME 0x01             // MSB LSB status checksum data[128]
+#define PSX_PKT_ID 0x02                // protocol version
+#define PSX_PKT_DELAY 0x03             // delay MSB LSB
+#define PSX_PKT_MODE 0x04              // mode flags now in effect
+#define PSX_PKT_FRAME_RLE 0x05         // see above
+#define PSX_PKT_LINK 0x06              // spi baud codes now in effect
+#define PSX_PKT_ACKSTAT 0x07           // see above
+#define PSX_PKT_ERROR 0x7F             // offending command byte
+
+#define PSX_MODE_RLE 0x01              // compressed frames
+#define PSX_RLE_BAD_CHECKSUM 0x80      // in the MSB of a PSX_PKT_FRAME_RLE
+#define PSX_ACK_CLEAR 0x01             // A flags
+#define PSX_ACK_BUCKETS 16
+#define PSX_ACKSTAT_LEN (1 + 4 + 4 + 2 + 2 + 2 + 4 + 2 * PSX_ACK_BUCKETS)
+
+#define PSX_LINK_SPIS 4
+#define PSX_LINK_BAUDS 5
+#define PSX_LINK_PROBATION 2000        // msec
+
+extern const int psx_link_spi_hz[PSX_LINK_SPIS];
+extern const int psx_link_baud[PSX_LINK_BAUDS];
+
+uint16_t psx_crc16( uint16_t crc, const uint8_t *p, size_t len );
+
+/* PackBits coding of frame data. encode returns the code length, 0 when
+ * it would not be shorter than max; decode returns the bytes written to
+ * out, -1 when the code is malformed or does not fit in max.
+ */
+int psx_rle_encode( const uint8_t *in, int len, uint8_t *out, int max );
+int psx_rle_decode( const uint8_t *in, int len, uint8_t *out, int max );
+
+/* Why a frame read failed, and how many failed reads of that kind a
+ * dump takes before it gives the frame up.
+ */
+enum psx_fail {
+    PSX_FAIL_TIMEOUT,           // frame never came back
+    PSX_FAIL_CHECKSUM,          // status 47h but data does not match, line noise
+    PSX_FAIL_CARD_CHECKSUM,     // status 4Eh, card saw a bad checksum
+    PSX_FAIL_BAD_SECTOR,        // status FFh, card refused the sector
+    PSX_FAIL_STATUS,            // any other end byte
+    PSX_FAIL_LOST,              // skipped in a burst, lost on the link
+    PSX_FAIL_REASONS
+};
+
+extern const int psx_retry_limit[PSX_FAIL_REASONS];
+const char *psx_fail_name( int reason );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PSX_PROTO_H
@@ -0,0 +1,479 @@
+/*
+ * Arduino bridge transport, see psx_serial.h.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "psx_serial.h"
+#include "psx_trace.h"
+
+#define SYNC_TRIES 20
+
+static speed_t serial_speed( int baud ){
+    switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    }
+    return 0;
+}
+
+static int serial_write( struct psx_serial *s, const uint8_t *p, int len ){
+    PSX_TRACE_INSTANT("serial write", "cmd", p[0]);
+    while (len > 0) {
+        ssize_t n = write(s->fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("serial write");
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Take the next good packet out of s->buf, 1 when there is one. */
+static int serial_parse( struct psx_serial *s, struct psx_pkt *pkt ){
+    int i = 0, ret = 0;
+
+    while (s->len - i >= PSX_PKT_HEADER) {
+        const uint8_t *p = s->buf + i;
+        int total;
+        uint16_t crc;
+
+        if (p[0] != PSX_PKT_SYNC0 || p[1] != PSX_PKT_SYNC1) {
+            ++i;
+            continue;
+        }
+        total = PSX_PKT_HEADER + p[5] + 2;
+        if (s->len - i < total)
+            break;
+        crc = psx_crc16(0xFFFF, p + 2, total - 4);
+        if (p[2] != PSX_PKT_VERSION
+            || (crc & 0xFF) != p[total - 2] || crc >> 8 != p[total - 1]) {
+            // not a packet after all, look again right after the sync
+            ++s->crc_errors;
+            ++i;
+            continue;
+        }
+        pkt->type = p[3];
+        pkt->seq = p[4];
+        pkt->len = p[5];
+        memcpy(pkt->payload, p + PSX_PKT_HEADER, p[5]);
+        i += total;
+        ret = 1;
+        break;
+    }
+    memmove(s->buf, s->buf + i, s->len - i);
+    s->len -= i;
+    return ret;
+}
+
+/* Wait up to timeout_ms for the next packet.
+ * Returns 1 with pkt filled, 0 on timeout, -1 on error.
+ */
+static int serial_packet( struct psx_serial *s, struct psx_pkt *pkt, int timeout_ms ){
+    struct pollfd p = { s->fd, POLLIN, 0 };
+
+    for (;;) {
+        ssize_t n;
+        int ret;
+
+        if (serial_parse(s, pkt))
+            return 1;
+        PSX_TRACE_BEGIN("serial poll", NULL, 0);
+        ret = poll(&p, 1, timeout_ms);
+        PSX_TRACE_END("serial poll", "ready", ret);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("serial poll");
+            return -1;
+        }
+        if (ret == 0)
+            return 0;
+        n = read(s->fd, s->buf + s->len, sizeof s->buf - s->len);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            perror("serial read");
+            return -1;
+        }
+        if (n == 0)
+            return -1;  // pty closed
+        PSX_TRACE_INSTANT("serial read", "bytes", n);
+        s->len += n;
+    }
+}
+
+static int serial_set_baud( struct psx_serial *s, int baud ){
+    struct termios tio;
+    speed_t speed = serial_speed(baud);
+
+    // let the last command out at the old rate first
+    if (!speed || tcdrain(s->fd) < 0 || tcgetattr(s->fd, &tio) < 0)
+        return -1;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(s->fd, TCSANOW, &tio) < 0)
+        return -1;
+    tcflush(s->fd, TCIFLUSH);
+    s->len = 0;
+    return 0;
+}
+
+/* Send S until the firmware answers, take over its numbering. */
+static int serial_sync( struct psx_serial *s, int tries ){
+    struct psx_pkt pkt;
+    int i;
+
+    for (i = 0; i < tries; ++i) {
+        uint8_t cmd = 'S';
+        int ret;
+
+        if (serial_write(s, &cmd, 1) < 0)
+            return -1;
+        while ((ret = serial_packet(s, &pkt, PSX_SERIAL_FRAME_TIMEOUT)) > 0
+               && pkt.type != PSX_PKT_ID)
+            ;
+        if (ret < 0)
+            return -1;
+        if (ret > 0) {
+            s->seq = pkt.seq + 1;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int psx_serial_open( struct psx_serial *s, const char *tty, int baud ){
+    struct timespec reset = { PSX_SERIAL_RESET_WAIT / 1000,
+                              (PSX_SERIAL_RESET_WAIT % 1000) * 1000000 };
+    struct termios tio;
+    speed_t speed = serial_speed(baud);
+    int i;
+
+    memset(s, 0, sizeof *s);
+    for (i = 0; i < PSX_LINK_BAUDS && psx_link_baud[i] != baud; ++i)
+        ;
+    // L and S steps start from the code of this rate, there has to be one
+    s->link_baud = s->old_baud = i;
+    if (!speed || i == PSX_LINK_BAUDS) {
+        fprintf(stderr, "%s: unsupported baud rate %d\n", tty, baud);
+        return -1;
+    }
+    s->fd = open(tty, O_RDWR | O_NOCTTY);
+    if (s->fd < 0) {
+        perror(tty);
+        return -1;
+    }
+    if (tcgetattr(s->fd, &tio) < 0) {
+        perror(tty);
+        psx_serial_close(s);
+        return -1;
+    }
+    // arduino defaults to 8-n-1
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(s->fd, TCSANOW, &tio) < 0) {
+        perror(tty);
+        psx_serial_close(s);
+        return -1;
+    }
+
+    // firmware resets on open, numbering starts over
+    nanosleep(&reset, NULL);
+    tcflush(s->fd, TCIFLUSH);
+
+    if (serial_sync(s, SYNC_TRIES) == 0)
+        return 0;
+    fprintf(stderr, "%s: no reader answering\n", tty);
+    psx_serial_close(s);
+    return -1;
+}
+
+int psx_serial_set_mode( struct psx_serial *s, uint8_t mode ){
+    uint8_t cmd[] = { 'M', mode };
+    uint8_t seq = s->seq++;
+    struct psx_pkt pkt;
+    int ret;
+
+    if (serial_write(s, cmd, sizeof cmd) < 0)
+        return -1;
+    while ((ret = serial_packet(s, &pkt, PSX_SERIAL_FRAME_TIMEOUT)) > 0) {
+        if (pkt.seq != seq)
+            continue;
+        if (pkt.type == PSX_PKT_MODE && pkt.len == 1)
+            return pkt.payload[0];
+        if (pkt.type == PSX_PKT_ERROR)
+            return 0;   // older firmware
+    }
+    return -1;
+}
+
+int psx_serial_set_link( struct psx_serial *s, int spi, int baud ){
+    uint8_t cmd[] = { 'L', spi, baud };
+    uint8_t seq = s->seq++;
+    struct psx_pkt pkt;
+    int ret;
+
+    if (spi < 0 || spi >= PSX_LINK_SPIS || baud < 0 || baud >= PSX_LINK_BAUDS)
+        return -1;
+    if (serial_write(s, cmd, sizeof cmd) < 0)
+        return -1;
+    while ((ret = serial_packet(s, &pkt, PSX_SERIAL_FRAME_TIMEOUT)) > 0) {
+        if (pkt.seq != seq)
+            continue;
+        if (pkt.type == PSX_PKT_ERROR)
+            return 1;   // older firmware
+        if (pkt.type == PSX_PKT_LINK)
+            break;
+    }
+    if (ret <= 0)
+        return -1;
+    PSX_TRACE_INSTANT("link", "baud", psx_link_baud[baud]);
+    s->old_spi = s->link_spi;
+    s->old_baud = s->link_baud;
+    s->link_spi = spi;
+    s->link_baud = baud;
+    if (baud != s->old_baud && serial_set_baud(s, psx_link_baud[baud]) < 0) {
+        perror("serial baud");
+        return -1;
+    }
+    return 0;
+}
+
+int psx_serial_keep_link( struct psx_serial *s ){
+    // a few tries only, a link that needs more is no good
+    if (serial_sync(s, 3) == 0) {
+        s->old_spi = s->link_spi;
+        s->old_baud = s->link_baud;
+        return 0;
+    }
+    return psx_serial_drop_link(s) < 0 ? -1 : 1;
+}
+
+int psx_serial_drop_link( struct psx_serial *s ){
+    struct timespec wait = { (PSX_LINK_PROBATION + 500) / 1000,
+                             ((PSX_LINK_PROBATION + 500) % 1000) * 1000000 };
+
+    PSX_TRACE_INSTANT("link dropped", "baud", psx_link_baud[s->link_baud]);
+    if (s->link_baud != s->old_baud
+        && serial_set_baud(s, psx_link_baud[s->old_baud]) < 0) {
+        perror("serial baud");
+        return -1;
+    }
+    s->link_spi = s->old_spi;
+    s->link_baud = s->old_baud;
+    nanosleep(&wait, NULL);
+    tcflush(s->fd, TCIFLUSH);
+    s->len = 0;
+    return serial_sync(s, SYNC_TRIES);
+}
+
+static uint32_t get_be( const uint8_t *p, int n ){
+    uint32_t v = 0;
+
+    while (n--)
+        v = v << 8 | *p++;
+    return v;
+}
+
+/* Take one PSX_PKT_ACKSTAT into e, returns its phase or -1. */
+static int serial_ack_stat( const struct psx_pkt *pkt, struct psx_ack *e ){
+    const uint8_t *p = pkt->payload;
+    struct psx_ack_stat *st;
+    int b;
+
+    if (pkt->len < PSX_ACKSTAT_LEN || p[0] >= PSX_PHASE_COUNT)
+        return -1;
+    st = &e->stat[p[0]];
+    e->timeout_us[p[0]] = get_be(p + 1, 4);
+    st->count = get_be(p + 5, 4);
+    st->timeouts = get_be(p + 9, 2);
+    st->min_us = get_be(p + 11, 2);
+    st->max_us = get_be(p + 13, 2);
+    st->sum_us = get_be(p + 15, 4);
+    for (b = 0; b < PSX_ACK_BUCKETS; ++b)
+        st->hist[b] = get_be(p + 19 + 2 * b, 2);
+    return p[0];
+}
+
+int psx_serial_ack_stats( struct psx_serial *s, struct psx_ack *e, uint8_t flags ){
+    uint8_t cmd[] = { 'A', flags };
+    uint8_t seq = s->seq++;
+    struct psx_pkt pkt;
+    int got = 0;
+    int ret;
+
+    if (serial_write(s, cmd, sizeof cmd) < 0)
+        return -1;
+    while ((ret = serial_packet(s, &pkt, PSX_SERIAL_FRAME_TIMEOUT)) > 0) {
+        if (pkt.seq != seq)
+            continue;
+        if (pkt.type == PSX_PKT_ERROR)
+            return 1;   // older firmware
+        if (pkt.type == PSX_PKT_ACKSTAT && serial_ack_stat(&pkt, e) >= 0
+            && ++got == PSX_PHASE_COUNT)
+            return 0;
+    }
+    return -1;
+}
+
+int psx_serial_set_ack_timeout( struct psx_serial *s, enum psx_phase phase, unsigned int us ){
+    uint8_t cmd[] = { 'T', phase, 0xFF & (us >> 8), 0xFF & us };
+    uint8_t seq = s->seq++;
+    struct psx_ack e;
+    struct psx_pkt pkt;
+    int ret;
+
+    if (us > 0xFFFF)
+        return -1;
+    if (serial_write(s, cmd, sizeof cmd) < 0)
+        return -1;
+    while ((ret = serial_packet(s, &pkt, PSX_SERIAL_FRAME_TIMEOUT)) > 0) {
+        if (pkt.seq != seq)
+            continue;
+        if (pkt.type == PSX_PKT_ERROR)
+            return 1;   // older firmware
+        if (pkt.type == PSX_PKT_ACKSTAT)
+            return serial_ack_stat(&pkt, &e) == (int) phase ? 0 : -1;
+    }
+    return -1;
+}
+
+void psx_serial_close( struct psx_serial *s ){
+    if (s->fd >= 0)
+        close(s->fd);
+    s->fd = -1;
+}
+
+/* Turn a PKT_FRAME_RLE into the PKT_FRAME it stands for, the checksum
+ * byte made up to match or not as the firmware found. -1 if malformed.
+ */
+static int serial_unpack( struct psx_pkt *pkt ){
+    uint8_t data[PSX_FRAME_SIZE];
+    uint8_t msb = pkt->payload[0] & ~PSX_RLE_BAD_CHECKSUM;
+    uint8_t sum;
+    int j;
+
+    if (pkt->len < 3
+        || psx_rle_decode(pkt->payload + 3, pkt->len - 3, data, sizeof data) != PSX_FRAME_SIZE)
+        return -1;
+    sum = msb ^ pkt->payload[1];
+    for (j = 0; j < PSX_FRAME_SIZE; ++j)
+        sum ^= data[j];
+    if (pkt->payload[0] & PSX_RLE_BAD_CHECKSUM)
+        sum ^= 0xFF;
+    pkt->payload[3] = sum;
+    pkt->payload[0] = msb;
+    memcpy(pkt->payload + 4, data, PSX_FRAME_SIZE);
+    pkt->type = PSX_PKT_FRAME;
+    pkt->len = 4 + PSX_FRAME_SIZE;
+    return 0;
+}
+
+/* A PKT_FRAME laid out like the frame on the wire. The firmware does not
+ * pass on the confirmed address, a bad sector shows in the status byte.
+ */
+static void serial_frame( const struct psx_pkt *pkt, uint8_t *rx, uint8_t *data_xor ){
+    static const uint8_t hdr[8] = { 0xFF, 0x00, 0x5A, 0x5D, 0x00, 0x00, 0x5C, 0x5D };
+    uint8_t status = pkt->payload[2];
+    int j;
+
+    memcpy(rx, hdr, sizeof hdr);
+    rx[4] = pkt->payload[0];
+    rx[5] = pkt->payload[1];
+    rx[8] = status == 0xFF ? 0xFF : pkt->payload[0];
+    rx[9] = status == 0xFF ? 0xFF : pkt->payload[1];
+    memcpy(rx + PSX_READ_HDR, pkt->payload + 4, PSX_FRAME_SIZE);
+    rx[PSX_READ_LEN - 2] = pkt->payload[3];
+    rx[PSX_READ_LEN - 1] = status;
+
+    *data_xor = 0;
+    for (j = 0; j < PSX_FRAME_SIZE; ++j)
+        *data_xor ^= pkt->payload[4 + j];
+}
+
+static int serial_read( void *ctx, unsigned int sector, int n,
+                        const uint8_t **rx, uint8_t *data_xor, int *res, uint64_t *done_ns ){
+    struct psx_serial *s = ctx;
+    uint8_t cmd[] = { 'B', 0xFF & (sector >> 8), 0xFF & sector, 0, n };
+    uint8_t seq = s->seq++;
+    struct psx_pkt pkt;
+    int got = 0, i, ret;
+
+    for (i = 0; i < n; ++i) {
+        rx[i] = s->rx[i];
+        memset(s->rx[i], 0xFF, PSX_READ_LEN);
+        data_xor[i] = 0;
+        res[i] = PSX_ERR_TIMEOUT;
+        done_ns[i] = 0;
+    }
+    if (serial_write(s, cmd, sizeof cmd) < 0)
+        return PSX_ERR_IO;
+
+    while (got < n) {
+        ret = serial_packet(s, &pkt, PSX_SERIAL_FRAME_TIMEOUT);
+        if (ret < 0)
+            return PSX_ERR_IO;
+        if (ret == 0) {
+            // the rest of the burst is lost
+            uint64_t now = psx_now_ns();
+            PSX_TRACE_INSTANT("serial timeout", "frames", n - got);
+            for (i = 0; i < n; ++i)
+                if (!done_ns[i])
+                    done_ns[i] = now;
+            break;
+        }
+        if (pkt.seq != seq)
+            continue;   // late answer to an earlier command
+        if (pkt.type == PSX_PKT_ERROR) {
+            fprintf(stderr, "serial_read() command %02X refused\n", pkt.payload[0]);
+            return PSX_ERR_IO;
+        }
+        if (pkt.type == PSX_PKT_FRAME_RLE && serial_unpack(&pkt) < 0)
+            continue;
+        if (pkt.type != PSX_PKT_FRAME || pkt.len != 4 + PSX_FRAME_SIZE)
+            continue;
+        i = ((pkt.payload[0] << 8) | pkt.payload[1]) - sector;
+        if (i < 0 || i >= n || res[i] == PSX_OK)
+            continue;
+        serial_frame(&pkt, s->rx[i], &data_xor[i]);
+        res[i] = PSX_OK;
+        done_ns[i] = psx_now_ns();
+        ++got;
+    }
+    return PSX_OK;
+}
+
+static void serial_close( void *ctx ){
+    psx_serial_close(ctx);
+}
+
+void psx_serial_transport( struct psx_serial *s, struct psx_transport *t ){
+    t->name = "serial";
+    t->ctx = s;
+    t->batch = PSX_BATCH_MAX;
+    t->read = serial_read;
+    t->get_id = NULL;   // the bridge has no get ID command for the card
+    t->close = serial_close;
+}
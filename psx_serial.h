@@ -0,0 +1,91 @@
+/*
+ * Arduino bridge transport: arduino/rcard over a serial line.
+ *
+ * Commands are R/B/D/S/M/L/A/T as in rcard.ino, the answers come back as
+ * the packets of psx_proto.h.
+ *
+ * With PSX_MODE_RLE set by an M command, the firmware checks the card's
+ * checksum itself and sends frames that shrink as PSX_PKT_FRAME_RLE.
+ *
+ * L spi baud moves the reader to psx_link_spi_hz[spi] and
+ * psx_link_baud[baud], answered with PSX_PKT_LINK at the old rate. The
+ * firmware drops the new setting again unless an S command reaches it
+ * within PSX_LINK_PROBATION, so a link too fast to talk over undoes
+ * itself.
+ *
+ * A flags answers with one PSX_PKT_ACKSTAT per phase of a read, flags
+ * 01h clears the statistics after. T phase MSB LSB sets the /ACK timeout
+ * of one phase in usec and answers with its PSX_PKT_ACKSTAT, hist as in
+ * struct psx_ack_stat. The sketch counts the acks after the two confirm
+ * bytes to the address phase, they share its long timeout.
+ */
+#ifndef PSX_SERIAL_H
+#define PSX_SERIAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "psx.h"
+#include "psx_ack.h"
+#include "psx_proto.h"
+#include "psx_transport.h"
+
+#define PSX_SERIAL_BAUD 38400
+#define PSX_SERIAL_FRAME_TIMEOUT 250   // msec, a frame is ~40 ms at 38400
+#define PSX_SERIAL_RESET_WAIT 2000     // msec, the Arduino resets on open
+
+struct psx_pkt {
+    uint8_t type;
+    uint8_t seq;
+    uint8_t len;
+    uint8_t payload[255];
+};
+
+struct psx_serial {
+    int fd;
+    uint8_t seq;                // firmware number of our next command
+    int link_spi;               // L codes in effect
+    int link_baud;
+    int old_spi;                // L codes before the last L
+    int old_baud;
+    uint8_t buf[4096];          // received, not yet parsed
+    int len;
+    unsigned long crc_errors;
+    uint8_t rx[PSX_BATCH_MAX][PSX_READ_LEN];
+};
+
+/* Open and configure the tty, wait out the reset and sync sequence
+ * numbers with an S command. Returns 0, or -1 with a message printed.
+ */
+int psx_serial_open( struct psx_serial *s, const char *tty, int baud );
+void psx_serial_close( struct psx_serial *s );
+
+/* Ask for PSX_MODE_* flags. Returns the flags the firmware took, 0 if
+ * it does not know the M command, or -1 on error.
+ */
+int psx_serial_set_mode( struct psx_serial *s, uint8_t mode );
+
+/* Move the reader and the tty to L codes spi and baud, on probation.
+ * Returns 0, 1 if the firmware does not know L, or -1 on error.
+ * Then either keep it, which sends the S the firmware waits for, or
+ * drop it, which waits out the probation back at the old setting.
+ * Both return 0, keep 1 if it had to drop the link after all, and -1
+ * when the reader does not answer any more.
+ */
+int psx_serial_set_link( struct psx_serial *s, int spi, int baud );
+int psx_serial_keep_link( struct psx_serial *s );
+int psx_serial_drop_link( struct psx_serial *s );
+
+/* Fetch the reader's /ACK statistics into e->stat and e->timeout_us,
+ * the rest of e is left alone. flags as for A.
+ * Returns 0, 1 if the firmware does not know A, or -1 on error.
+ */
+int psx_serial_ack_stats( struct psx_serial *s, struct psx_ack *e, uint8_t flags );
+
+/* Set the reader's /ACK timeout of one phase, in usec up to FFFFh.
+ * Returns 0, 1 if the firmware does not know T, or -1 on error.
+ */
+int psx_serial_set_ack_timeout( struct psx_serial *s, enum psx_phase phase, unsigned int us );
+void psx_serial_transport( struct psx_serial *s, struct psx_transport *t );
+
+#endif // PSX_SERIAL_H
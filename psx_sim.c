@@ -0,0 +1,155 @@
+/*
+ * Simulated memory card behind the psx_ack byte interface, see psx_sim.h.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "psx_sim.h"
+
+static uint32_t sim_rand( struct psx_sim *sim ){
+    // xorshift32
+    uint32_t x = sim->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return sim->rng = x;
+}
+
+void psx_sim_init( struct psx_sim *sim ){
+    memset(sim, 0, sizeof *sim);
+    sim->latency_us[PSX_PHASE_HDR] = PSX_SIM_LATENCY_HDR;
+    sim->latency_us[PSX_PHASE_ADDR] = PSX_SIM_LATENCY_ADDR;
+    sim->latency_us[PSX_PHASE_DATA] = PSX_SIM_LATENCY_DATA;
+    sim->rng = 0x2545F491;
+}
+
+int psx_sim_load( struct psx_sim *sim, const char *path ){
+    FILE *f = fopen(path, "rb");
+    size_t n;
+
+    if (!f)
+        return -1;
+    n = fread(sim->image, 1, sizeof sim->image, f);
+    fclose(f);
+    if (n != sizeof sim->image) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/* What the card shifts out for byte pos of the current command,
+ * and the phase of the /ACK after it (-1 for none).
+ */
+static uint8_t sim_reply( struct psx_sim *sim, int pos, uint8_t tx, int *phase ){
+    static const uint8_t id[] = { 0x5A, 0x5D, 0x5C, 0x5D, 0x04, 0x00, 0x00, 0x80 };
+    unsigned int sector;
+
+    *phase = -1;
+    if (pos == 0) {
+        if (tx == 0x81)
+            *phase = PSX_PHASE_HDR;
+        return 0xFF;
+    }
+    if (pos == 1) {
+        sim->cmd = tx;
+        if (tx == 0x52 || tx == 0x53)
+            *phase = PSX_PHASE_HDR;
+        return 0x00;    // FLAG
+    }
+
+    if (sim->cmd == 0x53) {
+        if (pos - 2 >= (int) sizeof id)
+            return 0xFF;
+        if (pos - 2 < (int) sizeof id - 1)
+            *phase = pos < 4 ? PSX_PHASE_HDR : PSX_PHASE_DATA;
+        return id[pos - 2];
+    }
+    if (sim->cmd != 0x52)
+        return 0xFF;
+
+    sector = (sim->msb << 8) | sim->lsb;
+    *phase = pos < 4 ? PSX_PHASE_HDR : pos < 8 ? PSX_PHASE_ADDR : PSX_PHASE_DATA;
+    switch (pos) {
+    case 2: return 0x5A;
+    case 3: return 0x5D;
+    case 4: sim->msb = tx; return 0x00;
+    case 5: sim->lsb = tx; return sim->msb;
+    case 6: return 0x5C;
+    case 7: return 0x5D;
+    case 8:
+        if (sector >= PSX_FRAME_COUNT)
+            return 0xFF;
+        sim->chk = sim->msb ^ sim->lsb;
+        return sim->msb;
+    case 9:
+        if (sector >= PSX_FRAME_COUNT) {
+            *phase = -1;        // FFFFh, then the card stops
+            return 0xFF;
+        }
+        return sim->lsb;
+    }
+    if (pos < PSX_READ_HDR + PSX_FRAME_SIZE) {
+        uint8_t d = sim->image[sector * PSX_FRAME_SIZE + pos - PSX_READ_HDR];
+        sim->chk ^= d;
+        return d;
+    }
+    if (pos == PSX_READ_LEN - 2)
+        return sim->chk;
+    *phase = -1;
+    return pos == PSX_READ_LEN - 1 ? 0x47 : 0xFF;
+}
+
+static int sim_xfer( void *ctx, uint8_t tx, uint8_t *rx, int last ){
+    struct psx_sim *sim = ctx;
+    int phase;
+
+    *rx = sim_reply(sim, sim->pos++, tx, &phase);
+    sim->ack = phase >= 0 && !last && sim_rand(sim) % 1000 >= sim->drop_ack;
+    if (sim->ack) {
+        sim->ack_us = sim->latency_us[phase];
+        if (sim->jitter_us)
+            sim->ack_us += sim_rand(sim) % (sim->jitter_us + 1);
+    }
+    if (last)
+        sim->pos = 0;
+    return 0;
+}
+
+static void sim_sleep( unsigned int us ){
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+static int sim_wait_ack( void *ctx, unsigned int timeout_us, unsigned int *latency_us ){
+    struct psx_sim *sim = ctx;
+
+    if (!sim->ack || sim->ack_us > timeout_us) {
+        if (sim->realtime)
+            sim_sleep(timeout_us);
+        return 1;
+    }
+    if (sim->realtime)
+        sim_sleep(sim->ack_us);
+    sim->ack = 0;
+    *latency_us = sim->ack_us;
+    return 0;
+}
+
+static void sim_release( void *ctx ){
+    struct psx_sim *sim = ctx;
+
+    sim->pos = 0;
+    sim->ack = 0;
+}
+
+void psx_sim_io( struct psx_sim *sim, struct psx_ack_io *io ){
+    io->ctx = sim;
+    io->xfer = sim_xfer;
+    io->wait_ack = sim_wait_ack;
+    io->release = sim_release;
+}
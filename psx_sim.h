@@ -0,0 +1,42 @@
+/*
+ * Simulated memory card behind the psx_ack byte interface.
+ *
+ * Answers the read and get ID commands byte by byte from a .mcr image,
+ * pulls /ACK with a configurable latency per phase and can drop acks,
+ * so the ACK engine and rcard can run without a card or a Pi.
+ */
+#ifndef PSX_SIM_H
+#define PSX_SIM_H
+
+#include <stdint.h>
+
+#include "psx.h"
+#include "psx_ack.h"
+
+#define PSX_SIM_LATENCY_HDR 10     // usec
+#define PSX_SIM_LATENCY_ADDR 200   // usec, the late /ACK
+#define PSX_SIM_LATENCY_DATA 10    // usec
+
+struct psx_sim {
+    uint8_t image[PSX_FRAME_COUNT * PSX_FRAME_SIZE];
+    unsigned int latency_us[PSX_PHASE_COUNT];   // /ACK latency per phase
+    unsigned int jitter_us;                     // up to this much more
+    unsigned int drop_ack;                      // per mille of acks never sent
+    int realtime;                               // really wait for the latency
+
+    // card side state of the current command
+    int pos;
+    uint8_t cmd;
+    uint8_t msb, lsb;
+    uint8_t chk;
+    int ack;                    // /ACK will follow the last byte
+    unsigned int ack_us;
+    uint32_t rng;
+};
+
+void psx_sim_init( struct psx_sim *sim );
+/* Load a 128 KB image, returns 0 or -1 with errno set. */
+int psx_sim_load( struct psx_sim *sim, const char *path );
+void psx_sim_io( struct psx_sim *sim, struct psx_ack_io *io );
+
+#endif // PSX_SIM_H
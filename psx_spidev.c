@@ -0,0 +1,364 @@
+/*
+ * spidev transport: whole frames per SPI_IOC_MESSAGE, with fixed delays
+ * standing in for the card's /ACK. From the SPI testing utility
+ * (spidev_test), Copyright (c) 2007 MontaVista Software, Inc.
+ * Copyright (c) 2007 Anton Vorontsov <avorontsov@ru.mvista.com>, GPLv2.
+ */
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+
+#include "psx_kernels.h"
+#include "psx_spidev.h"
+#include "psx_trace.h"
+
+#define PSX_SPI_BYTE_XFR_DELAY 16 // usec
+#define PSX_SPI_BITS_PER_WORD 8 // usec
+#define PSX_SPI_ADDR_ACK_DELAY 64 // usec, late /ACK after the address
+
+static void reverseBitsInArray( uint8_t a[], int len ){
+    psx_reverse( a, len );
+}
+
+static uint8_t mode;
+static uint8_t lsb_first = 1;
+static uint8_t bits = PSX_SPI_BITS_PER_WORD;
+static uint32_t speed = PSX_SPI_SPEED;
+static uint16_t xfr_delay = PSX_SPI_BYTE_XFR_DELAY;
+
+static void print_xfr( struct spi_ioc_transfer xfr ){
+    printf("spi_ioc_transfer: %p\n", &xfr);
+    printf(" .tx_buf: %p\n", xfr.tx_buf);
+    printf(" .rx_buf: %p\n", xfr.rx_buf);
+    printf(" .len: %ld\n", xfr.len);
+    printf(" .speed_hz: %d\n", xfr.speed_hz);
+    printf(" .bits_per_word: %d\n", xfr.bits_per_word);
+    printf(" .delay_usecs: %d\n", xfr.delay_usecs);
+    printf(" .cs_change: %d\n", xfr.cs_change);
+}
+
+static void spi_dump_stat(int fd)
+{
+    __u8    lsb=0, bits=0;
+    __u32   mode=0, speed=0;
+
+    if (ioctl(fd, SPI_IOC_RD_MODE, &mode) < 0) {
+        perror("SPI rd_mode");
+        return;
+    }
+
+    if (ioctl(fd, SPI_IOC_RD_LSB_FIRST, &lsb) < 0) {
+        perror("SPI rd_lsb_fist");
+        return;
+    }
+    if (ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, &bits) < 0) {
+        perror("SPI bits_per_word");
+        return;
+    }
+    if (ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed) < 0) {
+        perror("SPI max_speed_hz");
+        return;
+    }
+
+    printf("spi mode 0x%x, %d bits %sper word, %d Hz max\n",
+            mode, bits, lsb ? "(lsb first) " : "", speed);
+}
+
+static int psx_spi_setup( int fd ){
+    int ret;
+
+    speed = PSX_SPI_SPEED;
+    mode |= SPI_CPHA;
+    mode |= SPI_CPOL;
+    bits = PSX_SPI_BITS_PER_WORD ;
+    xfr_delay = PSX_SPI_BYTE_XFR_DELAY;
+    lsb_first = 1;  // HACK, spi-bcm2708 (driver?) do not support set lsb first.
+
+    ret = ioctl(fd, SPI_IOC_WR_MODE, &mode);
+    if (ret == -1) {
+        perror("can't set spi mode");
+        return -1;
+    }
+
+    /* ret = ioctl(fd, SPI_IOC_WR_LSB_FIRST, &mode); */
+    /* if (ret == -1) */
+    /* 	pabort("can't set LSB first"); */
+
+    ret = ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
+    if (ret == -1) {
+        perror("can't set bits per word");
+        return -1;
+    }
+
+    ret = ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
+    if (ret == -1) {
+        perror("can't set max speed hz");
+        return -1;
+    }
+    return 0;
+}
+
+static void psx_spi_do_msg(struct psx_spidev *s, char *cmd, char *dat, unsigned int len){
+    /*
+     *  struct spi_ioc_transfer - describes a single SPI transfer 
+     *  @tx_buf: Holds pointer to userspace buffer with transmit data, or null. 
+     *       If no data is provided, zeroes are shifted out. 
+     *  @rx_buf: Holds pointer to userspace buffer for receive data, or null. 
+     *  @len: Length of tx and rx buffers, in bytes. 
+     *  @speed_hz: Temporary override of the device's bitrate. 
+     *  @bits_per_word: Temporary override of the device's wordsize. 
+     *  @delay_usecs: If nonzero, how long to delay after the last bit transfer 
+     *       before optionally deselecting the device before the next transfer. 
+     *  @cs_change: True to deselect device before starting the next transfer. 
+     */
+    struct spi_ioc_transfer xfer;
+    memset( &xfer, 0, sizeof xfer );
+
+    xfer.tx_buf = (unsigned long) cmd;
+    xfer.rx_buf = (unsigned long) dat;
+    xfer.len = len;
+    xfer.speed_hz = s->speed;
+    xfer.bits_per_word = PSX_SPI_BITS_PER_WORD;
+    xfer.delay_usecs = PSX_SPI_BYTE_XFR_DELAY;
+    xfer.cs_change = 0;
+
+    /* print_xfr( xfer ); */
+
+    int status;
+
+    if ( lsb_first ){
+        /* printf("lsb trans cmd\n"); */
+        reverseBitsInArray(cmd, len);  // soft reverse bit order
+    }
+    PSX_TRACE_BEGIN("SPI_IOC_MESSAGE", "bytes", len);
+    status = ioctl(s->fd, SPI_IOC_MESSAGE(1), &xfer);
+    PSX_TRACE_END("SPI_IOC_MESSAGE", "status", status);
+
+    /* status = write(fd, cmd, len); */
+
+    if (status < 0) {
+        perror("SPI_IOC_MESSAGE");
+    }
+    
+    // soft reverse bit order rx
+    if (lsb_first) {
+        /* printf("lsb trans dat\n"); */
+        reverseBitsInArray(dat, len);
+    }
+}
+static void psx_spi_do_msg_multi_xfer(struct psx_spidev *s, char *cmd, char *dat, unsigned int len){
+    /*
+     *  struct spi_ioc_transfer - describes a single SPI transfer 
+     *  @tx_buf: Holds pointer to userspace buffer with transmit data, or null. 
+     *       If no data is provided, zeroes are shifted out. 
+     *  @rx_buf: Holds pointer to userspace buffer for receive data, or null. 
+     *  @len: Length of tx and rx buffers, in bytes. 
+     *  @speed_hz: Temporary override of the device's bitrate. 
+     *  @bits_per_word: Temporary override of the device's wordsize. 
+     *  @delay_usecs: If nonzero, how long to delay after the last bit transfer 
+     *       before optionally deselecting the device before the next transfer. 
+     *  @cs_change: True to deselect device before starting the next transfer. 
+     */
+    struct spi_ioc_transfer xfer[len];
+    memset( &xfer, 0, sizeof xfer );
+
+    int j;
+    for (j=0;j < len; ++j){
+        xfer[j].tx_buf = (unsigned long) (cmd +j);
+        xfer[j].rx_buf = (unsigned long) (dat +j);
+        xfer[j].len = 1;
+        xfer[j].speed_hz = s->speed;
+        xfer[j].bits_per_word = PSX_SPI_BITS_PER_WORD;
+        xfer[j].delay_usecs = PSX_SPI_BYTE_XFR_DELAY;
+        xfer[j].cs_change = 0;
+    }
+
+    /* print_xfr( xfer ); */
+
+    int status;
+
+    if ( lsb_first ){
+        /* printf("lsb trans cmd\n"); */
+        reverseBitsInArray(cmd, len);  // soft reverse bit order
+    }
+    status = ioctl(s->fd, SPI_IOC_MESSAGE(len), xfer);
+
+    /* status = write(fd, cmd, len); */
+
+    if (status < 0) {
+        perror("SPI_IOC_MESSAGE");
+    }
+    
+    // soft reverse bit order rx
+    if (lsb_first) {
+        /* printf("lsb trans dat\n"); */
+        reverseBitsInArray(dat, len);
+    }
+}
+
+int psx_spidev_open( struct psx_spidev *s, const char* spi_device ){
+    int i;
+
+    memset(s, 0, sizeof *s);
+    s->fd = open(spi_device, O_RDWR);
+    if (s->fd < 0)
+        return -1;
+
+    if (psx_spi_setup(s->fd) < 0) {
+        psx_spidev_close(s);
+        return -1;
+    }
+    spi_dump_stat(s->fd);
+    s->speed = speed;
+    s->lsb_first = lsb_first;
+
+    for (i = 0; i < PSX_BATCH_MAX; ++i) {
+        uint8_t *tx = s->tx[i];
+        struct spi_ioc_transfer *x = &s->xfer[i * 2];
+
+        /* Send Reply Comment */
+        tx[0] = 0x81; // N/A   Memory Card Access (unlike 01h=Controller access), dummy response
+        tx[1] = 0x52; // FLAG  Send Read Command (ASCII "R"), Receive FLAG Byte
+        /* [2]  0x00     5Ah   Receive Memory Card ID1 */
+        /* [3]  0x00     5Dh   Receive Memory Card ID2 */
+        /* [4]  MSB      (00h) Send Address MSB  ;\sector number (0..3FFh) */
+        /* [5]  LSB      (pre) Send Address LSB  ;/ */
+        /* [6]  0x00     5Ch   Receive Command Acknowledge 1  ;<-- late /ACK after this byte-pair */
+        /* [7]  0x00     5Dh   Receive Command Acknowledge 2 */
+        /* [8]  0x00     MSB   Receive Confirmed Address MSB */
+        /* [9]  0x00     LSB   Receive Confirmed Address LSB */
+        /* [10] 0x00     ...   Receive Data Sector (128 bytes) */
+        /* [138] 0x00    CHK   Receive Checksum (MSB xor LSB xor Data bytes) */
+        /* [139] 0x00    47h   Receive Memory End Byte (should be always 47h="G"=Good for Read) */
+        if ( lsb_first )
+            reverseBitsInArray(tx, PSX_READ_LEN);
+
+        x[0].tx_buf = (unsigned long) tx;
+        x[0].rx_buf = (unsigned long) s->rx[i];
+        x[0].len = PSX_READ_ADDR_LEN;
+        x[0].speed_hz = s->speed;
+        x[0].bits_per_word = PSX_SPI_BITS_PER_WORD;
+        x[0].delay_usecs = PSX_SPI_ADDR_ACK_DELAY;
+        x[0].cs_change = 0;
+
+        x[1].tx_buf = (unsigned long) (tx + PSX_READ_ADDR_LEN);
+        x[1].rx_buf = (unsigned long) (s->rx[i] + PSX_READ_ADDR_LEN);
+        x[1].len = PSX_READ_LEN - PSX_READ_ADDR_LEN;
+        x[1].speed_hz = s->speed;
+        x[1].bits_per_word = PSX_SPI_BITS_PER_WORD;
+        x[1].delay_usecs = PSX_SPI_BYTE_XFR_DELAY;
+        x[1].cs_change = 1;     // deselect before the next frame
+    }
+    return 0;
+}
+
+void psx_spidev_close( struct psx_spidev *s ){
+    if (s->fd >= 0)
+        close(s->fd);
+    s->fd = -1;
+}
+
+int psx_spidev_set_speed( struct psx_spidev *s, uint32_t hz ){
+    int i;
+
+    if (ioctl(s->fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz) < 0) {
+        perror("can't set max speed hz");
+        return -1;
+    }
+    s->speed = speed = hz;
+    for (i = 0; i < PSX_BATCH_MAX * 2; ++i)
+        s->xfer[i].speed_hz = hz;
+    return 0;
+}
+
+static int spidev_read( void *ctx, unsigned int sector, int n,
+                        const uint8_t **rxp, uint8_t *data_xor, int *res, uint64_t *done_ns ){
+    struct psx_spidev *s = ctx;
+    uint64_t now;
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        uint8_t MSB = 0xFF & ((sector + i) >> 8);
+        uint8_t LSB = 0xFF & (sector + i);
+        s->tx[i][4] = lsb_first ? BitReverseTable256[MSB] : MSB;
+        s->tx[i][5] = lsb_first ? BitReverseTable256[LSB] : LSB;
+    }
+    // no deselect hint after the last frame of the message
+    s->xfer[n * 2 - 1].cs_change = 0;
+    PSX_TRACE_BEGIN("SPI_IOC_MESSAGE", "sector", sector);
+    i = ioctl(s->fd, SPI_IOC_MESSAGE(n * 2), s->xfer);
+    PSX_TRACE_END("SPI_IOC_MESSAGE", "frames", n);
+    s->xfer[n * 2 - 1].cs_change = 1;
+    if (i < 0) {
+        perror("SPI_IOC_MESSAGE");
+        return PSX_ERR_IO;
+    }
+    now = psx_now_ns();
+
+    for (i = 0; i < n; ++i) {
+        uint8_t *rx = s->rx[i];
+        if (lsb_first) {
+            // soft reverse bit order rx, data bytes fused with the checksum
+            reverseBitsInArray(rx, PSX_READ_HDR);
+            data_xor[i] = psx_reverse_xor(rx + PSX_READ_HDR, PSX_FRAME_SIZE);
+            reverseBitsInArray(rx + PSX_READ_HDR + PSX_FRAME_SIZE, 2);
+        } else {
+            int j;
+            data_xor[i] = 0;
+            for (j = 0; j < PSX_FRAME_SIZE; ++j)
+                data_xor[i] ^= rx[PSX_READ_HDR + j];
+        }
+        rxp[i] = rx;
+        res[i] = PSX_OK;
+        done_ns[i] = now;
+    }
+    return PSX_OK;
+}
+
+static int spidev_get_id( void *ctx, uint8_t *dat ){
+    /* This command is supported only by original Sony memory cards.
+     * Not sure if all sony cards are responding with the same values,
+     * and what meaning they have,
+     * might be number of sectors (0400h) and sector size (0080h) or whatever.
+     */
+    uint8_t cmd[] = {
+        /* Send Reply Comment*/
+        0x81 ,// N/A   Memory Card Access (unlike 01h=Controller access), dummy response
+        0x53 ,// FLAG  Send Get ID Command (ASCII "S"), Receive FLAG Byte
+        0x00 ,// 5Ah   Receive Memory Card ID1
+        0x00 ,// 5Dh   Receive Memory Card ID2
+        0x00 ,// 5Ch   Receive Command Acknowledge 1
+        0x00 ,// 5Dh   Receive Command Acknowledge 2
+        0x00 ,// 04h   Receive 04h
+        0x00 ,// 00h   Receive 00h
+        0x00 ,// 00h   Receive 00h
+        0x00  // 80h   Receive 80h
+    };
+    struct psx_spidev *s = ctx;
+
+    memset(dat, 0xff, sizeof cmd);     // DEBUG
+
+    psx_spi_do_msg(s, (char *) cmd, (char *) dat, sizeof cmd );
+    return PSX_OK;
+}
+
+static void spidev_close( void *ctx ){
+    psx_spidev_close(ctx);
+}
+
+void psx_spidev_transport( struct psx_spidev *s, struct psx_transport *t ){
+    t->name = "spidev";
+    t->ctx = s;
+    t->batch = PSX_BATCH_MAX;
+    t->read = spidev_read;
+    t->get_id = spidev_get_id;
+    t->close = spidev_close;
+}
+
@@ -0,0 +1,39 @@
+/*
+ * spidev transport: the Pi talking to the card directly over
+ * /dev/spidev, a whole batch of frames per SPI_IOC_MESSAGE.
+ */
+#ifndef PSX_SPIDEV_H
+#define PSX_SPIDEV_H
+
+#include <stdint.h>
+#include <linux/spi/spidev.h>
+
+#include "psx.h"
+#include "psx_transport.h"
+
+#define PSX_SPI_SPEED 128000 // Hz, default
+#define PSX_SPI_SPEED_MAX 1000000 // Hz, most rcard -N tries
+
+/* An open, configured spidev with preallocated transfer buffers.
+ * Opened once, then every batch of frames costs a single SPI_IOC_MESSAGE.
+ * Each frame is two transfers: command + address, then a pause for
+ * the card's late /ACK, then the rest with chip select toggled after it.
+ * spidev limits a whole message to bufsiz (4096 by default) bytes.
+ */
+struct psx_spidev {
+    int fd;
+    uint32_t speed;
+    int lsb_first;              // bits reversed in software
+    uint8_t tx[PSX_BATCH_MAX][PSX_READ_LEN];   // already in wire (reversed) bit order
+    uint8_t rx[PSX_BATCH_MAX][PSX_READ_LEN];
+    struct spi_ioc_transfer xfer[PSX_BATCH_MAX * 2];
+};
+
+int psx_spidev_open( struct psx_spidev *s, const char *spi_device );
+void psx_spidev_close( struct psx_spidev *s );
+
+/* Clock the following transfers at hz. Returns 0 or -1. */
+int psx_spidev_set_speed( struct psx_spidev *s, uint32_t hz );
+void psx_spidev_transport( struct psx_spidev *s, struct psx_transport *t );
+
+#endif // PSX_SPIDEV_H
@@ -0,0 +1,115 @@
+/*
+ * Timeline tracing, see psx_trace.h.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "psx_trace.h"
+#include "psx_transport.h"
+
+struct psx_trace_ev {
+    uint64_t ns;
+    const char *name;
+    const char *arg_name;
+    long arg;
+    char ph;
+};
+
+struct psx_trace_buf {
+    struct psx_trace_buf *next;
+    long tid;
+    unsigned int n;             // events recorded, published with release
+    unsigned long dropped;
+    struct psx_trace_ev ev[PSX_TRACE_EVENTS];
+};
+
+int psx_trace_on;
+
+static struct psx_trace_buf *bufs;  // every thread's buffer, pushed with CAS
+static __thread struct psx_trace_buf *own;
+static __thread int own_failed;
+
+static struct psx_trace_buf *trace_buf( void ){
+    struct psx_trace_buf *b = calloc(1, sizeof *b);
+
+    if (!b) {
+        own_failed = 1;
+        return NULL;
+    }
+    b->tid = syscall(SYS_gettid);
+    b->next = __atomic_load_n(&bufs, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&bufs, &b->next, b, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return b;
+}
+
+void psx_trace_event( char ph, const char *name, const char *arg_name, long arg ){
+    struct psx_trace_buf *b = own;
+    struct psx_trace_ev *ev;
+
+    if (!b) {
+        if (own_failed)
+            return;
+        b = own = trace_buf();
+        if (!b)
+            return;
+    }
+    if (b->n == PSX_TRACE_EVENTS) {
+        ++b->dropped;
+        return;
+    }
+    ev = &b->ev[b->n];
+    ev->ns = psx_now_ns();
+    ev->name = name;
+    ev->arg_name = arg_name;
+    ev->arg = arg;
+    ev->ph = ph;
+    __atomic_store_n(&b->n, b->n + 1, __ATOMIC_RELEASE);
+}
+
+int psx_trace_write( const char *path ){
+    struct psx_trace_buf *b;
+    unsigned long dropped = 0;
+    const char *sep = "";
+    int pid = getpid();
+    FILE *f = fopen(path, "w");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fputs("{\"traceEvents\":[\n", f);
+    for (b = __atomic_load_n(&bufs, __ATOMIC_ACQUIRE); b; b = b->next) {
+        unsigned int i, n = __atomic_load_n(&b->n, __ATOMIC_ACQUIRE);
+
+        for (i = 0; i < n; ++i) {
+            const struct psx_trace_ev *ev = &b->ev[i];
+
+            // ts in microseconds; instants are scoped to their thread
+            fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,"
+                    "\"pid\":%d,\"tid\":%ld%s",
+                    sep, ev->name, ev->ph,
+                    (unsigned long long) (ev->ns / 1000), (unsigned int) (ev->ns % 1000),
+                    pid, b->tid, ev->ph == 'i' ? ",\"s\":\"t\"" : "");
+            if (ev->arg_name)
+                fprintf(f, ",\"args\":{\"%s\":%ld}", ev->arg_name, ev->arg);
+            fputs("}", f);
+            sep = ",\n";
+        }
+        dropped += b->dropped;
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":\"%lu\"}}\n",
+            dropped);
+    if (fclose(f) != 0) {
+        perror(path);
+        return -1;
+    }
+    if (dropped)
+        fprintf(stderr, "psx_trace_write() %lu events dropped\n", dropped);
+    return 0;
+}
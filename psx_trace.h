@@ -0,0 +1,36 @@
+/*
+ * Timeline tracing in the Chrome trace event format, for chrome://tracing
+ * or ui.perfetto.dev. Every thread records into a buffer of its own, no
+ * locks are taken; a buffer is chained into a global list once, on the
+ * first event of its thread. Off by default, a disabled event is one
+ * load and a branch.
+ *
+ * Names must be string literals (or live as long as the process), only
+ * the pointer is kept until psx_trace_write().
+ */
+#ifndef PSX_TRACE_H
+#define PSX_TRACE_H
+
+#define PSX_TRACE_EVENTS 65536  // per thread, later events are dropped
+
+extern int psx_trace_on;
+
+void psx_trace_event( char ph, const char *name, const char *arg_name, long arg );
+
+/* Write every thread's events as JSON, 0 on success. Threads must
+ * not be recording any more.
+ */
+int psx_trace_write( const char *path );
+
+#define PSX_TRACE(ph, name, arg_name, arg) \
+    do { \
+        if (__builtin_expect(__atomic_load_n(&psx_trace_on, __ATOMIC_RELAXED), 0)) \
+            psx_trace_event(ph, name, arg_name, arg); \
+    } while (0)
+
+// slices nest per thread, an END closes the last BEGIN
+#define PSX_TRACE_BEGIN(name, arg_name, arg) PSX_TRACE('B', name, arg_name, arg)
+#define PSX_TRACE_END(name, arg_name, arg) PSX_TRACE('E', name, arg_name, arg)
+#define PSX_TRACE_INSTANT(name, arg_name, arg) PSX_TRACE('i', name, arg_name, arg)
+
+#endif // PSX_TRACE_H
@@ -0,0 +1,43 @@
+/*
+ * Transports carry memory card commands to a card: spidev on the Pi,
+ * byte by byte on /ACK (real or simulated card), or the Arduino bridge
+ * over a serial line. The protocol engine (psx_engine.h) sits on top
+ * and checks, batches and retries frames the same way for all of them.
+ */
+#ifndef PSX_TRANSPORT_H
+#define PSX_TRANSPORT_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "psx.h"
+
+static inline uint64_t psx_now_ns( void ){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct psx_transport {
+    const char *name;
+    void *ctx;
+    int batch;      // most frames per read, 1 .. PSX_BATCH_MAX
+
+    /* Read n (<= batch) consecutive sectors. rx[i] is pointed at the
+     * PSX_READ_LEN bytes of frame i, laid out as on the wire and in
+     * logical bit order, data_xor[i] gets the XOR of its data bytes.
+     * res[i] is PSX_OK or why frame i could not be read at all,
+     * done_ns[i] when it was complete (psx_now_ns()).
+     * Returns PSX_OK, or an error when the transport itself failed.
+     */
+    int (*read)( void *ctx, unsigned int sector, int n,
+                 const uint8_t **rx, uint8_t *data_xor, int *res, uint64_t *done_ns );
+
+    /* Get ID command, rx gets the 10 reply bytes. May be NULL. */
+    int (*get_id)( void *ctx, uint8_t *rx );
+
+    void (*close)( void *ctx );
+};
+
+#endif // PSX_TRANSPORT_H
@@ -0,0 +1,418 @@
+/*
+ * End-to-end benchmark of the protocol engine.
+ *
+ * Runs whole-card dumps, single frame reads and ID probes against the
+ * in-process simulated card and against rcard-emu (virtual Arduino on a
+ * pty) at several baud rates and fault rates. Reports frames/sec,
+ * p50/p99/max latency, retries and host cpu time per frame, as a table
+ * and optionally as JSON for tracking over time.
+ *
+ * Latency is per call for reads and probes. For dumps it is the time
+ * between consecutive good frames, so stalls from timeouts and retries
+ * show up in p99 and max.
+ */
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "psx.h"
+#include "psx_ack.h"
+#include "psx_engine.h"
+#include "psx_serial.h"
+#include "psx_sim.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define CARD_SIZE (PSX_FRAME_COUNT * PSX_FRAME_SIZE)
+#define LAT_MAX 65536
+
+enum link { LINK_SIM, LINK_EMU };
+enum op { OP_DUMP, OP_READ, OP_ID };
+
+static const char *link_names[] = { "sim", "serial" };
+static const char *op_names[] = { "dump", "read", "id" };
+
+struct scenario {
+    const char *name;
+    enum link link;
+    int baud;
+    int bad_chk;        // per mille, see rcard-emu -e -f -n
+    int bad_sector;
+    int noise;
+    enum op op;
+    int count;          // dumps, reads or probes
+};
+
+static const struct scenario scenarios[] = {
+    { "sim-dump",              LINK_SIM,       0,  0, 0,  0, OP_DUMP,  20 },
+    { "sim-read",              LINK_SIM,       0,  0, 0,  0, OP_READ, 4096 },
+    { "sim-id",                LINK_SIM,       0,  0, 0,  0, OP_ID,   4096 },
+    { "serial-38400-read",     LINK_EMU,   38400,  0, 0,  0, OP_READ,   32 },
+    { "serial-115200-dump",    LINK_EMU,  115200,  0, 0,  0, OP_DUMP,    1 },
+    { "serial-1M-dump",        LINK_EMU, 1000000,  0, 0,  0, OP_DUMP,    1 },
+    { "serial-1M-dump-faults", LINK_EMU, 1000000, 10, 5, 10, OP_DUMP,    1 },
+    { "serial-1M-read-faults", LINK_EMU, 1000000, 10, 5, 10, OP_READ,  128 },
+};
+
+struct result {
+    const struct scenario *sc;
+    int ok;
+    const char *error;
+    unsigned long ops, frames, bad, retries;
+    double seconds, cpu_seconds;
+    double p50_ms, p99_ms, max_ms;
+};
+
+struct bench {
+    uint8_t image[CARD_SIZE];
+    uint8_t card[CARD_SIZE];
+    const char *emu;
+    const char *image_path;
+    int verbose;
+
+    uint64_t lat[LAT_MAX];      // ns
+    int nlat;
+    uint64_t last_ns;           // last good frame of a dump
+};
+
+static void lat_add( struct bench *b, uint64_t ns ){
+    if (b->nlat < LAT_MAX)
+        b->lat[b->nlat++] = ns;
+}
+
+static void on_frame( void *arg, unsigned int sector, int res, uint64_t done_ns ){
+    struct bench *b = arg;
+
+    (void) sector;
+    if (res != PSX_OK)
+        return;
+    lat_add(b, done_ns - b->last_ns);
+    b->last_ns = done_ns;
+}
+
+static int cmp_u64( const void *a, const void *b ){
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double cpu_seconds( void ){
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+        + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* Start rcard-emu for sc, returns its pid and the pty in tty. */
+static pid_t emu_start( struct bench *b, const struct scenario *sc, char *tty, size_t len ){
+    char baud[16], chk[16], sector[16], noise[16];
+    int fds[2];
+    pid_t pid;
+    FILE *f;
+
+    snprintf(tty, len, "/tmp/rcard-bench-%d.tty", (int) getpid());
+    snprintf(baud, sizeof baud, "%d", sc->baud);
+    snprintf(chk, sizeof chk, "%d", sc->bad_chk);
+    snprintf(sector, sizeof sector, "%d", sc->bad_sector);
+    snprintf(noise, sizeof noise, "%d", sc->noise);
+    if (pipe(fds) < 0)
+        return -1;
+    pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        if (!b->verbose)
+            freopen("/dev/null", "w", stderr);
+        close(fds[0]);
+        close(fds[1]);
+        execl(b->emu, b->emu, "-l", tty, "-b", baud, "-e", chk, "-f", sector,
+              "-n", noise, "-s", "1", b->image_path, (char *) NULL);
+        perror(b->emu);
+        _exit(127);
+    }
+    close(fds[1]);
+    // the emulator prints the pty once it is ready
+    f = fdopen(fds[0], "r");
+    if (!f || !fgets(tty, len, f)) {
+        if (f)
+            fclose(f);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    fclose(f);
+    tty[strcspn(tty, "\n")] = 0;
+    return pid;
+}
+
+static void run_ops( struct bench *b, struct psx_engine *e, struct result *r ){
+    const struct scenario *sc = r->sc;
+    uint8_t rx[10];
+    int i, ret = PSX_OK, fails;
+
+    for (i = 0; i < sc->count; ++i) {
+        uint64_t t0 = psx_now_ns();
+
+        b->last_ns = t0;
+        switch (sc->op) {
+        case OP_DUMP:
+            e->on_frame = on_frame;
+            ret = psx_read_card(e, b->card);
+            e->on_frame = NULL;
+            if (ret == PSX_OK && memcmp(b->card, b->image, CARD_SIZE))
+                r->error = "card differs from image";
+            break;
+        case OP_READ: {
+            unsigned int sector = (i * 37) % PSX_FRAME_COUNT;
+            uint8_t *data = b->card + sector * PSX_FRAME_SIZE;
+            ret = psx_read_sector(e, sector, data);
+            for (fails = 1; ret != PSX_OK && fails < psx_retry_limit[psx_fail_of(ret)]; ++fails) {
+                ++e->retries;
+                ret = psx_read_sector(e, sector, data);
+            }
+            if (ret == PSX_OK && memcmp(data, b->image + sector * PSX_FRAME_SIZE, PSX_FRAME_SIZE))
+                r->error = "frame differs from image";
+            lat_add(b, psx_now_ns() - t0);
+            break;
+        }
+        case OP_ID:
+            ret = psx_get_id(e, rx);
+            lat_add(b, psx_now_ns() - t0);
+            break;
+        }
+        if (ret != PSX_OK) {
+            r->error = ret == PSX_ERR_UNSUPPORTED ? "unsupported" : "read failed";
+            return;
+        }
+        if (r->error)
+            return;
+        ++r->ops;
+    }
+}
+
+static void run( struct bench *b, const struct scenario *sc, struct result *r ){
+    static struct psx_sim sim;
+    static struct psx_ack ack;
+    static struct psx_serial serial;
+    struct psx_ack_io io;
+    struct psx_transport t;
+    struct psx_engine e;
+    char tty[256];
+    pid_t pid = -1;
+    uint64_t t0;
+    double cpu0;
+
+    memset(r, 0, sizeof *r);
+    r->sc = sc;
+    b->nlat = 0;
+
+    if (sc->link == LINK_SIM) {
+        psx_sim_init(&sim);
+        memcpy(sim.image, b->image, CARD_SIZE);
+        psx_sim_io(&sim, &io);
+        psx_ack_init(&ack, &io);
+        psx_ack_transport(&ack, &t);
+    } else {
+        pid = emu_start(b, sc, tty, sizeof tty);
+        if (pid < 0) {
+            r->error = "cannot start rcard-emu";
+            return;
+        }
+        if (psx_serial_open(&serial, tty, sc->baud) < 0) {
+            r->error = "no reader on the emulator";
+            kill(pid, SIGTERM);
+            waitpid(pid, NULL, 0);
+            return;
+        }
+        psx_serial_transport(&serial, &t);
+    }
+    psx_engine_init(&e, &t);
+    e.arg = b;
+
+    cpu0 = cpu_seconds();
+    t0 = psx_now_ns();
+    run_ops(b, &e, r);
+    r->seconds = (psx_now_ns() - t0) / 1e9;
+    r->cpu_seconds = cpu_seconds() - cpu0;
+    r->frames = e.frames;
+    r->bad = e.bad;
+    r->retries = e.retries;
+    r->ok = !r->error;
+
+    if (b->nlat) {
+        qsort(b->lat, b->nlat, sizeof b->lat[0], cmp_u64);
+        r->p50_ms = b->lat[b->nlat / 2] / 1e6;
+        r->p99_ms = b->lat[(b->nlat * 99) / 100] / 1e6;
+        r->max_ms = b->lat[b->nlat - 1] / 1e6;
+    }
+
+    t.close(t.ctx);
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+}
+
+static double per_sec( double n, double s ){
+    return s > 0 ? n / s : 0;
+}
+
+static void print_table( const struct result *r, int n ){
+    int i;
+
+    printf("%-22s %6s %9s %10s %9s %9s %9s %7s %5s %9s\n", "scenario", "ops", "ops/s",
+           "frames/s", "p50 ms", "p99 ms", "max ms", "retries", "bad", "cpu us/fr");
+    for (i = 0; i < n; ++i, ++r) {
+        if (!r->ok) {
+            printf("%-22s  %s\n", r->sc->name, r->error);
+            continue;
+        }
+        printf("%-22s %6lu %9.1f %10.1f %9.3f %9.3f %9.3f %7lu %5lu %9.2f\n",
+               r->sc->name, r->ops, per_sec(r->ops, r->seconds), per_sec(r->frames, r->seconds),
+               r->p50_ms, r->p99_ms, r->max_ms, r->retries, r->bad,
+               r->frames ? r->cpu_seconds * 1e6 / r->frames : 0.0);
+    }
+}
+
+static int write_json( const char *path, const struct result *r, int n ){
+    FILE *f = fopen(path, "w");
+    int i;
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "{\n  \"tool\": \"rcard-bench\",\n  \"time\": %ld,\n  \"results\": [\n",
+            (long) time(NULL));
+    for (i = 0; i < n; ++i, ++r) {
+        const struct scenario *sc = r->sc;
+        fprintf(f, "    {\"name\": \"%s\", \"link\": \"%s\", \"baud\": %d, "
+                "\"faults\": {\"bad_checksum\": %d, \"bad_sector\": %d, \"noise\": %d}, "
+                "\"op\": \"%s\", \"ok\": %s",
+                sc->name, link_names[sc->link], sc->baud,
+                sc->bad_chk, sc->bad_sector, sc->noise, op_names[sc->op],
+                r->ok ? "true" : "false");
+        if (r->error)
+            fprintf(f, ", \"error\": \"%s\"", r->error);
+        fprintf(f, ", \"ops\": %lu, \"frames\": %lu, \"bad_frames\": %lu, \"retries\": %lu, "
+                "\"seconds\": %.6f, \"frames_per_sec\": %.3f, \"ops_per_sec\": %.3f, "
+                "\"latency_ms\": {\"p50\": %.6f, \"p99\": %.6f, \"max\": %.6f}, "
+                "\"cpu_us_per_frame\": %.3f}%s\n",
+                r->ops, r->frames, r->bad, r->retries, r->seconds,
+                per_sec(r->frames, r->seconds), per_sec(r->ops, r->seconds),
+                r->p50_ms, r->p99_ms, r->max_ms,
+                r->frames ? r->cpu_seconds * 1e6 / r->frames : 0.0,
+                i + 1 < n ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f);
+}
+
+static void usage( const char *prog ){
+    unsigned int i;
+
+    printf("Usage: %s [-v] [-l] [-s match] [-j FILE] [-e rcard-emu] [-i IMAGE]\n"
+           "  -l     list the scenarios\n"
+           "  -s     only run scenarios whose name contains match\n"
+           "  -j     also write the results as JSON\n"
+           "  -e     emulator to run serial scenarios on, default ./rcard-emu\n"
+           "  -i     card image, default a random one\n"
+           "scenarios:", prog);
+    for (i = 0; i < ARRAY_SIZE(scenarios); ++i)
+        printf(" %s", scenarios[i].name);
+    printf("\n");
+    exit(1);
+}
+
+int main( int argc, char *argv[] ){
+    static struct bench b;
+    struct result res[ARRAY_SIZE(scenarios)];
+    const char *match = NULL, *json = NULL;
+    char tmp[] = "/tmp/rcard-bench-XXXXXX";
+    unsigned int i;
+    int c, n = 0, ret = 0;
+
+    b.emu = "./rcard-emu";
+    while ((c = getopt(argc, argv, "vls:j:e:i:")) != -1) {
+        switch (c) {
+        case 'v':
+            b.verbose = 1;
+            break;
+        case 'l':
+            for (i = 0; i < ARRAY_SIZE(scenarios); ++i)
+                printf("%s\n", scenarios[i].name);
+            return 0;
+        case 's':
+            match = optarg;
+            break;
+        case 'j':
+            json = optarg;
+            break;
+        case 'e':
+            b.emu = optarg;
+            break;
+        case 'i':
+            b.image_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0]);
+
+    if (b.image_path) {
+        FILE *f = fopen(b.image_path, "rb");
+        if (!f || fread(b.image, CARD_SIZE, 1, f) != 1) {
+            fprintf(stderr, "%s: not a memory card image\n", b.image_path);
+            return 1;
+        }
+        fclose(f);
+    } else {
+        // random contents, so a misplaced frame cannot go unnoticed
+        uint32_t x = 0x2545F491;
+        int fd;
+        FILE *f;
+        for (i = 0; i < CARD_SIZE; ++i) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            b.image[i] = x;
+        }
+        fd = mkstemp(tmp);
+        f = fd < 0 ? NULL : fdopen(fd, "wb");
+        if (!f || fwrite(b.image, CARD_SIZE, 1, f) != 1 || fclose(f) != 0) {
+            perror(tmp);
+            return 1;
+        }
+        b.image_path = tmp;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(scenarios); ++i) {
+        if (match && !strstr(scenarios[i].name, match))
+            continue;
+        if (b.verbose)
+            fprintf(stderr, "running %s\n", scenarios[i].name);
+        run(&b, &scenarios[i], &res[n]);
+        if (!res[n].ok)
+            ret = 1;
+        ++n;
+    }
+    if (!strcmp(b.image_path, tmp))
+        unlink(tmp);
+
+    print_table(res, n);
+    if (json && write_json(json, res, n) != 0)
+        ret = 1;
+    return ret;
+}
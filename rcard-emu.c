@@ -0,0 +1,601 @@
+/*
+ * Virtual rcard reader: the Arduino sketch (arduino/rcard) and a memory
+ * card behind it, on a pseudo-terminal.
+ *
+ * Answers R/B/D/S/M/L/A/T with the sketch's packets, reading frames byte by byte
+ * from a simulated card holding a .mcr image (psx_sim). Timing follows a
+ * virtual clock: the card takes a byte time plus its /ACK latency per
+ * byte, the serial line drains at the emulated baud rate and the sketch
+ * runs ahead of the line by its two packet slots, reading the next frame
+ * while the last one is still going out. Checksum
+ * errors (0x4E), bad sectors (0xFF), line noise and fragmented writes
+ * can be injected to exercise the host side, and a link faster than -x
+ * allows garbles frames (SPI) or everything on the line (baud).
+ *
+ * Point RcardClient, rcard-dump or rcard -P at the printed pty.
+ */
+#define _GNU_SOURCE     // ptsname_r
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <getopt.h>
+
+#include "psx.h"
+#include "psx_ack.h"
+#include "psx_serial.h"
+#include "psx_sim.h"
+
+#define EMU_BYTE_US 64          // SPI at 125 kHz, SPR1:SPR0 = 11 on a 16 MHz AVR
+#define EMU_READ_BYTES 141      // the sketch clocks a 3rd party tail byte too
+#define EMU_SERIAL_BUF 64       // Serial TX buffer of the AVR core
+#define EMU_SLOTS 2             // packet slots of the sketch
+#define EMU_QUEUE (1 << 20)     // answers not yet on the line
+
+struct emu_pkt {
+    uint64_t ready_ns;          // not on the line before
+    int len;
+};
+
+struct emu {
+    struct psx_sim sim;
+    struct psx_ack ack;
+    int fd;                     // pty master
+
+    // options
+    unsigned int byte_us;
+    int baud;                   // 0 = no line limit
+    int max_spi, max_baud;      // fastest L codes that still work
+    unsigned int bad_chk;       // per mille of frames answered 0x4E
+    unsigned int bad_sector;    // per mille answered 0xFF
+    unsigned int noise;         // per mille of packets with a byte flipped
+    int chunk;                  // most bytes per write, 0 = no limit
+    unsigned int gap_us;        // between fragments
+
+    // sketch state
+    uint8_t cmd[5];
+    int cmdlen;
+    uint8_t seq;
+    uint16_t delay;
+    uint8_t mode;               // PSX_MODE_* flags
+    int base_baud;              // baud after reset
+    int link_spi, link_baud;    // L codes in effect
+    int old_spi, old_baud;      // to go back to
+    int old_rate;
+    uint64_t probation_ns;      // link dropped at, 0 = kept
+    uint64_t busy_ns;           // sketch busy until
+    uint64_t line_ns;           // line busy until, as scheduled
+    uint64_t sent_ns;           // line busy until, as sent
+    uint64_t slot_ns[EMU_SLOTS];    // slot handed to Serial at
+    int slot;                   // slot the next packet is built in
+
+    // answers waiting for their time
+    uint8_t q[EMU_QUEUE];
+    int qhead, qtail;
+    struct emu_pkt pkts[EMU_QUEUE / 8];
+    int phead, ptail;
+    int pkt_sent;               // bytes of pkts[phead] written
+    uint32_t rng;
+
+    unsigned long commands, frames, chk_errors, bad_sectors, noisy, bytes;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal( int sig ){
+    (void) sig;
+    stop = 1;
+}
+
+static uint32_t emu_rand( struct emu *m ){
+    // xorshift32
+    uint32_t x = m->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return m->rng = x;
+}
+
+static uint64_t byte_ns( const struct emu *m ){
+    // 8-n-1 is 10 bits per byte
+    return m->baud ? 10000000000ull / m->baud : 0;
+}
+
+static int line_garbled( const struct emu *m ){
+    return m->link_baud > m->max_baud;
+}
+
+/* Queue one packet, ready once the sketch has it in its Serial buffer. */
+static void emu_packet( struct emu *m, uint8_t type, const uint8_t *payload, int len ){
+    uint8_t p[PSX_PKT_MAX];
+    uint16_t crc;
+    uint64_t start;
+    int total = PSX_PKT_HEADER + len + 2;
+
+    if (m->ptail - m->phead >= (int) (sizeof m->pkts / sizeof m->pkts[0])
+        || m->qtail - m->qhead + total > EMU_QUEUE) {
+        fprintf(stderr, "rcard-emu: answer queue full, host not reading\n");
+        return;
+    }
+    p[0] = PSX_PKT_SYNC0;
+    p[1] = PSX_PKT_SYNC1;
+    p[2] = PSX_PKT_VERSION;
+    p[3] = type;
+    p[4] = m->seq;
+    p[5] = len;
+    memcpy(p + PSX_PKT_HEADER, payload, len);
+    crc = psx_crc16(0xFFFF, p + 2, total - 4);
+    p[total - 2] = crc & 0xFF;
+    p[total - 1] = crc >> 8;
+    if (line_garbled(m)
+        || (m->noise && emu_rand(m) % 1000 < m->noise)) {
+        p[2 + emu_rand(m) % (total - 2)] ^= 1 << (emu_rand(m) % 8);
+        ++m->noisy;
+    }
+
+    if (m->qhead == m->qtail) {
+        m->qhead = m->qtail = 0;
+        m->phead = m->ptail = 0;
+    } else if (m->qtail + total > EMU_QUEUE) {
+        memmove(m->q, m->q + m->qhead, m->qtail - m->qhead);
+        m->qtail -= m->qhead;
+        m->qhead = 0;
+    }
+    memcpy(m->q + m->qtail, p, total);
+    m->qtail += total;
+    if (m->ptail == (int) (sizeof m->pkts / sizeof m->pkts[0])) {
+        memmove(m->pkts, m->pkts + m->phead, (m->ptail - m->phead) * sizeof m->pkts[0]);
+        m->ptail -= m->phead;
+        m->phead = 0;
+    }
+    // the sketch waits in pkt_begin() for the slot to be handed over
+    if (m->slot_ns[m->slot] > m->busy_ns)
+        m->busy_ns = m->slot_ns[m->slot];
+    m->pkts[m->ptail].ready_ns = m->busy_ns;
+    m->pkts[m->ptail].len = total;
+    ++m->ptail;
+
+    // the line sends it after what is queued already; the slot is free
+    // again once all but a Serial buffer full of it is out
+    start = m->line_ns > m->busy_ns ? m->line_ns : m->busy_ns;
+    m->line_ns = start + total * byte_ns(m);
+    m->slot_ns[m->slot] = m->busy_ns;
+    if (m->line_ns - EMU_SERIAL_BUF * byte_ns(m) > m->busy_ns)
+        m->slot_ns[m->slot] = m->line_ns - EMU_SERIAL_BUF * byte_ns(m);
+    m->slot = (m->slot + 1) % EMU_SLOTS;
+}
+
+/* psx_read_frame() of the sketch, the card read clocked by interrupts
+ * while the main loop keeps feeding Serial. */
+static void emu_frame( struct emu *m, unsigned int sector ){
+    uint8_t rx[PSX_READ_LEN];
+    uint8_t p[4 + PSX_FRAME_SIZE];
+    unsigned long long ack_us = 0;
+    int i, ret;
+
+    for (i = 0; i < PSX_PHASE_COUNT; ++i)
+        ack_us -= m->ack.stat[i].sum_us;
+    memset(rx, 0xFF, sizeof rx);
+    ret = psx_ack_read_frame(&m->ack, sector, rx);
+    for (i = 0; i < PSX_PHASE_COUNT; ++i)
+        ack_us += m->ack.stat[i].sum_us;
+    m->busy_ns += (EMU_READ_BYTES * (uint64_t) (m->byte_us >> m->link_spi) + ack_us) * 1000;
+
+    p[0] = 0xFF & (sector >> 8);
+    p[1] = 0xFF & sector;
+    p[2] = rx[PSX_READ_LEN - 1];        // status
+    p[3] = rx[PSX_READ_LEN - 2];        // checksum
+    memcpy(p + 4, rx + PSX_READ_HDR, PSX_FRAME_SIZE);
+    if (ret == PSX_OK && m->bad_sector && emu_rand(m) % 1000 < m->bad_sector) {
+        memset(p + 2, 0xFF, sizeof p - 2);
+        ++m->bad_sectors;
+    } else if (ret == PSX_OK && m->bad_chk && emu_rand(m) % 1000 < m->bad_chk) {
+        p[2] = 0x4E;
+        p[3] ^= 0x01;
+        ++m->chk_errors;
+    }
+    if (ret == PSX_OK && m->link_spi > m->max_spi) {
+        // clocked too fast for the card, a data bit comes out wrong
+        p[4 + emu_rand(m) % PSX_FRAME_SIZE] ^= 1 << (emu_rand(m) % 8);
+        ++m->chk_errors;
+    }
+    if (m->mode & PSX_MODE_RLE) {
+        // the sketch checks the checksum and sends the frame coded if shorter
+        uint8_t z[3 + PSX_FRAME_SIZE];
+        uint8_t sum = p[0] ^ p[1];
+        int n;
+
+        for (i = 0; i < PSX_FRAME_SIZE; ++i)
+            sum ^= p[4 + i];
+        n = psx_rle_encode(p + 4, PSX_FRAME_SIZE, z + 3, PSX_FRAME_SIZE);
+        if (n) {
+            z[0] = p[0] | (sum != p[3] ? PSX_RLE_BAD_CHECKSUM : 0);
+            z[1] = p[1];
+            z[2] = p[2];
+            emu_packet(m, PSX_PKT_FRAME_RLE, z, 3 + n);
+            ++m->frames;
+            return;
+        }
+    }
+    emu_packet(m, PSX_PKT_FRAME, p, sizeof p);
+    ++m->frames;
+}
+
+static void put_be( uint8_t *p, uint32_t v, int n ){
+    while (n--) {
+        p[n] = v;
+        v >>= 8;
+    }
+}
+
+/* The sketch's PSX_PKT_ACKSTAT of one phase, with the emulated card's
+ * latencies. */
+static void emu_ack_stat( struct emu *m, int phase ){
+    const struct psx_ack_stat *st = &m->ack.stat[phase];
+    uint8_t p[PSX_ACKSTAT_LEN];
+    int b;
+
+    p[0] = phase;
+    put_be(p + 1, m->ack.timeout_us[phase], 4);
+    put_be(p + 5, st->count, 4);
+    put_be(p + 9, st->timeouts > 0xFFFF ? 0xFFFF : st->timeouts, 2);
+    put_be(p + 11, st->count ? st->min_us : 0xFFFF, 2);
+    put_be(p + 13, st->max_us > 0xFFFF ? 0xFFFF : st->max_us, 2);
+    put_be(p + 15, st->sum_us, 4);
+    for (b = 0; b < PSX_ACK_BUCKETS; ++b)
+        put_be(p + 19 + 2 * b, st->hist[b] > 0xFFFF ? 0xFFFF : st->hist[b], 2);
+    emu_packet(m, PSX_PKT_ACKSTAT, p, sizeof p);
+}
+
+/* parseCmd() of the sketch, 0 while the command is incomplete. */
+static int emu_command( struct emu *m ){
+    const uint8_t *c = m->cmd;
+    uint64_t now = psx_now_ns();
+    unsigned int sector, count;
+    uint8_t p[2];
+    int i;
+
+    // the sketch takes the next command once done with the last one
+    if (m->busy_ns < now)
+        m->busy_ns = now;
+
+    switch (c[0]) {
+    default:
+        emu_packet(m, PSX_PKT_ERROR, c, 1);
+        break;
+    case 'R':
+        if (m->cmdlen < 3)
+            return 0;
+        emu_frame(m, (c[1] << 8) | c[2]);
+        break;
+    case 'B':
+        if (m->cmdlen < 5)
+            return 0;
+        sector = (c[1] << 8) | c[2];
+        count = (c[3] << 8) | c[4];
+        for (; count > 0 && sector < PSX_FRAME_COUNT; --count, ++sector)
+            emu_frame(m, sector);
+        break;
+    case 'D':
+        if (m->cmdlen < 3)
+            return 0;
+        m->delay = (c[1] << 8) | c[2];
+        // the sketch gives the address phase six times as long
+        m->ack.timeout_us[PSX_PHASE_HDR] = m->delay;
+        m->ack.timeout_us[PSX_PHASE_ADDR] = 6 * m->delay;
+        m->ack.timeout_us[PSX_PHASE_DATA] = m->delay;
+        p[0] = m->delay >> 8;
+        p[1] = m->delay;
+        emu_packet(m, PSX_PKT_DELAY, p, 2);
+        break;
+    case 'S':
+        m->probation_ns = 0;
+        p[0] = PSX_PKT_VERSION;
+        emu_packet(m, PSX_PKT_ID, p, 1);
+        break;
+    case 'M':
+        if (m->cmdlen < 2)
+            return 0;
+        m->mode = c[1] & PSX_MODE_RLE;
+        emu_packet(m, PSX_PKT_MODE, &m->mode, 1);
+        break;
+    case 'L':
+        if (m->cmdlen < 3)
+            return 0;
+        if (c[1] >= PSX_LINK_SPIS || c[2] >= PSX_LINK_BAUDS) {
+            emu_packet(m, PSX_PKT_ERROR, c, 1);
+            break;
+        }
+        if (!m->probation_ns) {
+            m->old_spi = m->link_spi;
+            m->old_baud = m->link_baud;
+            m->old_rate = m->baud;
+        }
+        p[0] = c[1];
+        p[1] = c[2];
+        emu_packet(m, PSX_PKT_LINK, p, 2);
+        // link_apply() lets the answer go out at the old rate first
+        if (m->busy_ns < m->line_ns)
+            m->busy_ns = m->line_ns;
+        m->link_spi = c[1];
+        if (c[2] != m->link_baud) {
+            m->link_baud = c[2];
+            m->baud = psx_link_baud[c[2]];
+        }
+        m->probation_ns = m->busy_ns + PSX_LINK_PROBATION * 1000000ull;
+        break;
+    case 'A':
+        if (m->cmdlen < 2)
+            return 0;
+        for (i = 0; i < PSX_PHASE_COUNT; ++i)
+            emu_ack_stat(m, i);
+        if (c[1] & PSX_ACK_CLEAR)
+            psx_ack_reset_stats(&m->ack);
+        break;
+    case 'T':
+        if (m->cmdlen < 4)
+            return 0;
+        if (c[1] >= PSX_PHASE_COUNT) {
+            emu_packet(m, PSX_PKT_ERROR, c, 1);
+            break;
+        }
+        m->ack.timeout_us[c[1]] = (c[2] << 8) | c[3];
+        emu_ack_stat(m, c[1]);
+        break;
+    }
+    ++m->seq;
+    ++m->commands;
+    m->cmdlen = 0;
+    return 1;
+}
+
+/* loop() of the sketch: no S since the last L, back to the old link. */
+static void emu_probation( struct emu *m ){
+    if (!m->probation_ns || psx_now_ns() < m->probation_ns)
+        return;
+    m->probation_ns = 0;
+    m->link_spi = m->old_spi;
+    m->link_baud = m->old_baud;
+    m->baud = m->old_rate;
+    m->cmdlen = 0;
+    fprintf(stderr, "rcard-emu: link on probation dropped\n");
+}
+
+/* Write whatever the virtual clock allows, returns msec until more may go. */
+static int emu_drain( struct emu *m ){
+    uint64_t now = psx_now_ns(), bns = byte_ns(m);
+
+    while (m->phead < m->ptail) {
+        struct emu_pkt *pk = &m->pkts[m->phead];
+        uint64_t t = m->sent_ns > pk->ready_ns ? m->sent_ns : pk->ready_ns;
+        int n = pk->len - m->pkt_sent;
+        ssize_t w;
+
+        if (t > now)
+            return (int) ((t - now + 999999) / 1000000);
+        if (bns && (uint64_t) n > (now - t) / bns + 1)
+            n = (now - t) / bns + 1;
+        if (m->chunk) {
+            int frag = 1 + emu_rand(m) % m->chunk;
+            if (n > frag)
+                n = frag;
+        }
+        w = write(m->fd, m->q + m->qhead, n);
+        if (w < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                return 1;
+            return -1;
+        }
+        m->qhead += w;
+        m->pkt_sent += w;
+        m->bytes += w;
+        m->sent_ns = t + w * bns;
+        if (m->chunk)
+            m->sent_ns += m->gap_us * 1000ull;
+        if (m->pkt_sent == pk->len) {
+            ++m->phead;
+            m->pkt_sent = 0;
+        }
+    }
+    return -1;
+}
+
+/* The host opened the port: the Arduino resets, all state starts over. */
+static void emu_reset( struct emu *m ){
+    m->cmdlen = 0;
+    m->seq = 0;
+    m->delay = 1000;
+    m->mode = 0;
+    // the sketch waits up to SPI_XFER_BYTE_DELAY_MAX, x6 after the address
+    m->ack.timeout_us[PSX_PHASE_HDR] = m->delay;
+    m->ack.timeout_us[PSX_PHASE_ADDR] = 6 * m->delay;
+    m->ack.timeout_us[PSX_PHASE_DATA] = m->delay;
+    psx_ack_reset_stats(&m->ack);
+    m->baud = m->base_baud;
+    m->link_spi = 0;
+    for (m->link_baud = PSX_LINK_BAUDS - 1; m->link_baud > 0; --m->link_baud)
+        if (psx_link_baud[m->link_baud] == m->baud)
+            break;
+    m->probation_ns = 0;
+    m->busy_ns = m->line_ns = m->sent_ns = psx_now_ns();
+    memset(m->slot_ns, 0, sizeof m->slot_ns);
+    m->slot = 0;
+    m->qhead = m->qtail = 0;
+    m->phead = m->ptail = 0;
+    m->pkt_sent = 0;
+    tcflush(m->fd, TCIOFLUSH);
+}
+
+static void usage( const char *prog ){
+    printf("Usage: %s [-l link] [-L byte_us] [-A hdr,addr,data] [-b baud] [-x spi,baud]\n"
+           "          [-e permille] [-f permille] [-n permille] [-c chunk] [-g gap_us]\n"
+           "          [-s seed] IMAGE\n"
+           "  -l     also make the pty reachable as link\n"
+           "  -L     card time per byte in usec, default %d\n"
+           "  -A     card /ACK latency per phase in usec, default %d,%d,%d\n"
+           "  -b     emulated baud rate, 0 for none, default %d\n"
+           "  -x     fastest L codes that still read clean, default %d,%d\n"
+           "  -e     frames answered with a checksum error (4Eh), per mille\n"
+           "  -f     frames answered as bad sector (FFh), per mille\n"
+           "  -n     packets with a bit flipped on the line, per mille\n"
+           "  -c     split writes into random fragments of at most chunk bytes\n"
+           "  -g     pause between fragments in usec\n"
+           "  -s     random seed\n",
+           prog, EMU_BYTE_US, PSX_SIM_LATENCY_HDR, PSX_SIM_LATENCY_ADDR,
+           PSX_SIM_LATENCY_DATA, PSX_SERIAL_BAUD, PSX_LINK_SPIS - 1, PSX_LINK_BAUDS - 1);
+    exit(1);
+}
+
+int main( int argc, char *argv[] ){
+    static struct emu m;
+    struct psx_ack_io io;
+    struct termios tio;
+    const char *link = NULL;
+    char pts[256];
+    int connected = 0;
+    int c;
+
+    psx_sim_init(&m.sim);
+    m.byte_us = EMU_BYTE_US;
+    m.baud = PSX_SERIAL_BAUD;
+    m.max_spi = PSX_LINK_SPIS - 1;
+    m.max_baud = PSX_LINK_BAUDS - 1;
+    m.rng = 0x9E3779B9;
+
+    while ((c = getopt(argc, argv, "l:L:A:b:x:e:f:n:c:g:s:")) != -1) {
+        switch (c) {
+        case 'l':
+            link = optarg;
+            break;
+        case 'L':
+            m.byte_us = atoi(optarg);
+            break;
+        case 'A':
+            if (sscanf(optarg, "%u,%u,%u", &m.sim.latency_us[PSX_PHASE_HDR],
+                       &m.sim.latency_us[PSX_PHASE_ADDR], &m.sim.latency_us[PSX_PHASE_DATA]) != 3)
+                usage(argv[0]);
+            break;
+        case 'b':
+            m.baud = atoi(optarg);
+            break;
+        case 'x':
+            if (sscanf(optarg, "%d,%d", &m.max_spi, &m.max_baud) != 2)
+                usage(argv[0]);
+            break;
+        case 'e':
+            m.bad_chk = atoi(optarg);
+            break;
+        case 'f':
+            m.bad_sector = atoi(optarg);
+            break;
+        case 'n':
+            m.noise = atoi(optarg);
+            break;
+        case 'c':
+            m.chunk = atoi(optarg);
+            break;
+        case 'g':
+            m.gap_us = atoi(optarg);
+            break;
+        case 's':
+            m.rng = m.sim.rng = strtoul(optarg, NULL, 0) | 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc || m.baud < 0)
+        usage(argv[0]);
+    m.base_baud = m.baud;
+
+    if (psx_sim_load(&m.sim, argv[optind]) < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    psx_sim_io(&m.sim, &io);
+    psx_ack_init(&m.ack, &io);
+
+    m.fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (m.fd < 0 || grantpt(m.fd) < 0 || unlockpt(m.fd) < 0
+        || ptsname_r(m.fd, pts, sizeof pts) != 0) {
+        perror("pty");
+        return 1;
+    }
+    // raw, so the pty passes binary packets untouched
+    if (tcgetattr(m.fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(m.fd, TCSANOW, &tio);
+    }
+    if (link) {
+        unlink(link);
+        if (symlink(pts, link) < 0) {
+            perror(link);
+            return 1;
+        }
+    }
+    printf("%s\n", link ? link : pts);
+    fflush(stdout);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    while (!stop) {
+        struct pollfd p = { m.fd, POLLIN, 0 };
+        int wait = connected ? emu_drain(&m) : 20;
+        int ret;
+
+        if (m.probation_ns && (wait < 0 || wait > 20))
+            wait = 20;
+
+        ret = poll(&p, 1, wait);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        if (p.revents & POLLHUP) {
+            // nobody has the port open
+            uint8_t junk[256];
+            if (connected)
+                fprintf(stderr, "rcard-emu: closed\n");
+            connected = 0;
+            while (read(m.fd, junk, sizeof junk) > 0)
+                ;
+            usleep(20000);
+            continue;
+        }
+        if (!connected) {
+            fprintf(stderr, "rcard-emu: opened\n");
+            emu_reset(&m);
+            connected = 1;
+        }
+        emu_probation(&m);
+        if (p.revents & POLLIN) {
+            uint8_t buf[256];
+            ssize_t n = read(m.fd, buf, sizeof buf), i;
+            for (i = 0; i < n; ++i) {
+                // at a baud the line cannot take, no byte arrives intact
+                m.cmd[m.cmdlen++] = line_garbled(&m) ? buf[i] ^ 0xA5 : buf[i];
+                emu_command(&m);
+            }
+        }
+    }
+
+    fprintf(stderr, "rcard-emu: %lu commands, %lu frames, %lu bytes, "
+            "injected %lu checksum errors, %lu bad sectors, %lu noisy packets\n",
+            m.commands, m.frames, m.bytes, m.chk_errors, m.bad_sectors, m.noisy);
+    if (link)
+        unlink(link);
+    close(m.fd);
+    return 0;
+}
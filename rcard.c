@@ -11,6 +11,7 @@
  * Cross-compile with cross-gcc -I/path/to/cross-kernel/include
  */
 
+#include <signal.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -18,12 +19,14 @@
 #include <string.h>
 
 #include <getopt.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <linux/types.h>
-#include <linux/spi/spidev.h>
 
-#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#include "psx.h"
+#include "psx_ack.h"
+#include "psx_engine.h"
+#include "psx_serial.h"
+#include "psx_sim.h"
+#include "psx_spidev.h"
+#include "psx_trace.h"
 
 // broadcom gpio schema
 #define SPI_CE0  8 // GPIO8, SPI_CE0
@@ -40,37 +43,8 @@
 #define PSX_DAT  SPI_MISO
 #define PSX_ACK  P25
 
-#define PSX_SPI_SPEED 128000 // Hz
-#define PSX_SPI_BYTE_XFR_DELAY 16 // usec
-#define PSX_SPI_BITS_PER_WORD 8 // usec
 #define PSX_ACK_WAIT 8 // usec
-
-// Reverse table is used because we don't know how to change bit-order on SPI settings
-static const uint8_t BitReverseTable256[256] = {
-    0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0, 0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0,
-    0x08, 0x88, 0x48, 0xC8, 0x28, 0xA8, 0x68, 0xE8, 0x18, 0x98, 0x58, 0xD8, 0x38, 0xB8, 0x78, 0xF8,
-    0x04, 0x84, 0x44, 0xC4, 0x24, 0xA4, 0x64, 0xE4, 0x14, 0x94, 0x54, 0xD4, 0x34, 0xB4, 0x74, 0xF4,
-    0x0C, 0x8C, 0x4C, 0xCC, 0x2C, 0xAC, 0x6C, 0xEC, 0x1C, 0x9C, 0x5C, 0xDC, 0x3C, 0xBC, 0x7C, 0xFC,
-    0x02, 0x82, 0x42, 0xC2, 0x22, 0xA2, 0x62, 0xE2, 0x12, 0x92, 0x52, 0xD2, 0x32, 0xB2, 0x72, 0xF2,
-    0x0A, 0x8A, 0x4A, 0xCA, 0x2A, 0xAA, 0x6A, 0xEA, 0x1A, 0x9A, 0x5A, 0xDA, 0x3A, 0xBA, 0x7A, 0xFA,
-    0x06, 0x86, 0x46, 0xC6, 0x26, 0xA6, 0x66, 0xE6, 0x16, 0x96, 0x56, 0xD6, 0x36, 0xB6, 0x76, 0xF6,
-    0x0E, 0x8E, 0x4E, 0xCE, 0x2E, 0xAE, 0x6E, 0xEE, 0x1E, 0x9E, 0x5E, 0xDE, 0x3E, 0xBE, 0x7E, 0xFE,
-    0x01, 0x81, 0x41, 0xC1, 0x21, 0xA1, 0x61, 0xE1, 0x11, 0x91, 0x51, 0xD1, 0x31, 0xB1, 0x71, 0xF1,
-    0x09, 0x89, 0x49, 0xC9, 0x29, 0xA9, 0x69, 0xE9, 0x19, 0x99, 0x59, 0xD9, 0x39, 0xB9, 0x79, 0xF9,
-    0x05, 0x85, 0x45, 0xC5, 0x25, 0xA5, 0x65, 0xE5, 0x15, 0x95, 0x55, 0xD5, 0x35, 0xB5, 0x75, 0xF5,
-    0x0D, 0x8D, 0x4D, 0xCD, 0x2D, 0xAD, 0x6D, 0xED, 0x1D, 0x9D, 0x5D, 0xDD, 0x3D, 0xBD, 0x7D, 0xFD,
-    0x03, 0x83, 0x43, 0xC3, 0x23, 0xA3, 0x63, 0xE3, 0x13, 0x93, 0x53, 0xD3, 0x33, 0xB3, 0x73, 0xF3,
-    0x0B, 0x8B, 0x4B, 0xCB, 0x2B, 0xAB, 0x6B, 0xEB, 0x1B, 0x9B, 0x5B, 0xDB, 0x3B, 0xBB, 0x7B, 0xFB,
-    0x07, 0x87, 0x47, 0xC7, 0x27, 0xA7, 0x67, 0xE7, 0x17, 0x97, 0x57, 0xD7, 0x37, 0xB7, 0x77, 0xF7,
-    0x0F, 0x8F, 0x4F, 0xCF, 0x2F, 0xAF, 0x6F, 0xEF, 0x1F, 0x9F, 0x5F, 0xDF, 0x3F, 0xBF, 0x7F, 0xFF
-};
-
-static void reverseBitsInArray( uint8_t a[], int len ){
-    int i = 0;
-    for ( i = 0; i < len; ++i ){
-        a[i] = BitReverseTable256[a[i]];
-    }
-}
+#define PSX_GPIO_CHIP "/dev/gpiochip0"
 
 static void pabort(const char *s)
 {
@@ -79,315 +53,296 @@ static void pabort(const char *s)
 }
 
 static const char *device = "/dev/spidev0.0";
-static uint8_t mode;
-static uint8_t lsb_first = 1;
-static uint8_t bits = PSX_SPI_BITS_PER_WORD;
-static uint32_t speed = PSX_SPI_SPEED;
-static uint16_t xfr_delay = PSX_SPI_BYTE_XFR_DELAY;
+static volatile sig_atomic_t stop;
 
-static void print_buffer( uint8_t rx[], int len){
-    int ret;
-    for (ret = 0; ret < len; ret++) {
-        if (!(ret % 8))
-            printf("    ");
-        if (!(ret % 16 ) )
-            puts("");
-        printf("%.2X ", rx[ret]);
-    }
-    puts("");
+static void on_signal( int sig ){
+    (void) sig;
+    stop = 1;
 }
 
-static void print_xfr( struct spi_ioc_transfer xfr ){
-    printf("spi_ioc_transfer: %p\n", &xfr);
-    printf(" .tx_buf: %p\n", xfr.tx_buf);
-    printf(" .rx_buf: %p\n", xfr.rx_buf);
-    printf(" .len: %ld\n", xfr.len);
-    printf(" .speed_hz: %d\n", xfr.speed_hz);
-    printf(" .bits_per_word: %d\n", xfr.bits_per_word);
-    printf(" .delay_usecs: %d\n", xfr.delay_usecs);
-    printf(" .cs_change: %d\n", xfr.cs_change);
-}
-
-static void spi_dump_stat(int fd)
-{
-    __u8    lsb=0, bits=0;
-    __u32   mode=0, speed=0;
-
-    if (ioctl(fd, SPI_IOC_RD_MODE, &mode) < 0) {
-        perror("SPI rd_mode");
-        return;
+static int psx_read_frame( struct psx_engine *e, unsigned long block, unsigned long frame, uint8_t *data ){
+    /* block 0 - 15 , each 8KB*/
+    /* frame 0 - 63 , each 128 B */ 
+    if ( ! (block < 16) ){
+        printf("psx_read_frame() not a block No. : %ld", block);
+        abort();
     }
 
-    if (ioctl(fd, SPI_IOC_RD_LSB_FIRST, &lsb) < 0) {
-        perror("SPI rd_lsb_fist");
-        return;
-    }
-    if (ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, &bits) < 0) {
-        perror("SPI bits_per_word");
-        return;
-    }
-    if (ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed) < 0) {
-        perror("SPI max_speed_hz");
-        return;
+    if ( ! (frame < 64) ){
+        printf("psx_read_frame() not a frame No. : %ld", frame);
+        abort();
     }
 
-    printf("spi mode 0x%x, %d bits %sper word, %d Hz max\n",
-            mode, bits, lsb ? "(lsb first) " : "", speed);
+    return psx_read_sector( e, block * 64 + frame, data );
 }
 
-static void psx_spi_setup( int fd ){
-    int ret;
-
-    speed = PSX_SPI_SPEED;
-    mode |= SPI_CPHA;
-    mode |= SPI_CPOL;
-    bits = PSX_SPI_BITS_PER_WORD ;
-    xfr_delay = PSX_SPI_BYTE_XFR_DELAY;
-    lsb_first = 1;  // HACK, spi-bcm2708 (driver?) do not support set lsb first.
-
-    ret = ioctl(fd, SPI_IOC_WR_MODE, &mode);
-    if (ret == -1)
-        pabort("can't set spi mode");
+/* One step of tune_serial(): 0 if the link was kept, 1 if not, 2 if
+ * the firmware cannot switch, -1 if the reader got lost. */
+static int tune_step( struct psx_serial *s, struct psx_engine *e, int spi, int baud ){
+    int ret = psx_serial_set_link(s, spi, baud);
 
-    /* ret = ioctl(fd, SPI_IOC_WR_LSB_FIRST, &mode); */
-    /* if (ret == -1) */
-    /* 	pabort("can't set LSB first"); */
-
-    ret = ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
-    if (ret == -1)
-        pabort("can't set bits per word");
-
-    ret = ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
-    if (ret == -1)
-        pabort("can't set max speed hz");
+    if (ret)
+        return ret < 0 ? -1 : 2;
+    if (psx_link_clean(e) == 1)
+        return psx_serial_keep_link(s);
+    return psx_serial_drop_link(s) < 0 ? -1 : 1;
 }
 
-
-static void psx_spi_do_msg(int fd, char *cmd, char *dat, unsigned int len){
-    /*
-     *  struct spi_ioc_transfer - describes a single SPI transfer 
-     *  @tx_buf: Holds pointer to userspace buffer with transmit data, or null. 
-     *       If no data is provided, zeroes are shifted out. 
-     *  @rx_buf: Holds pointer to userspace buffer for receive data, or null. 
-     *  @len: Length of tx and rx buffers, in bytes. 
-     *  @speed_hz: Temporary override of the device's bitrate. 
-     *  @bits_per_word: Temporary override of the device's wordsize. 
-     *  @delay_usecs: If nonzero, how long to delay after the last bit transfer 
-     *       before optionally deselecting the device before the next transfer. 
-     *  @cs_change: True to deselect device before starting the next transfer. 
-     */
-    struct spi_ioc_transfer xfer;
-    memset( &xfer, 0, sizeof xfer );
-
-    xfer.tx_buf = (unsigned long) cmd;
-    xfer.rx_buf = (unsigned long) dat;
-    xfer.len = len;
-    xfer.speed_hz = PSX_SPI_SPEED;
-    xfer.bits_per_word = PSX_SPI_BITS_PER_WORD;
-    xfer.delay_usecs = PSX_SPI_BYTE_XFR_DELAY;
-    xfer.cs_change = 0;
-
-    /* print_xfr( xfer ); */
-
-    int status;
-
-    if ( lsb_first ){
-        /* printf("lsb trans cmd\n"); */
-        reverseBitsInArray(cmd, len);  // soft reverse bit order
-    }
-    status = ioctl(fd, SPI_IOC_MESSAGE(1), &xfer);
-
-    /* status = write(fd, cmd, len); */
-
-    if (status < 0) {
-        perror("SPI_IOC_MESSAGE");
-    }
-    
-    // soft reverse bit order rx
-    if (lsb_first) {
-        /* printf("lsb trans dat\n"); */
-        reverseBitsInArray(dat, len);
+/* Step the Arduino reader's SPI clock, then its baud rate up as long
+ * as the test reads come back clean. */
+static int tune_serial( struct psx_serial *s, struct psx_engine *e ){
+    int spi, baud, ret = 0;
+
+    for (spi = s->link_spi + 1; spi < PSX_LINK_SPIS && !ret; ++spi)
+        ret = tune_step(s, e, spi, s->link_baud);
+    if (ret == 1)
+        ret = 0;
+    for (baud = s->link_baud + 1; baud < PSX_LINK_BAUDS && !ret; ++baud)
+        ret = tune_step(s, e, s->link_spi, baud);
+    if (ret < 0) {
+        fprintf(stderr, "reader lost while tuning the link\n");
+        return -1;
     }
+    if (ret == 2)
+        fprintf(stderr, "reader firmware cannot switch its link\n");
+    printf("link: SPI %d Hz, %d baud\n",
+           psx_link_spi_hz[s->link_spi], psx_link_baud[s->link_baud]);
+    return 0;
 }
-static void psx_spi_do_msg_multi_xfer(int fd, char *cmd, char *dat, unsigned int len){
-    /*
-     *  struct spi_ioc_transfer - describes a single SPI transfer 
-     *  @tx_buf: Holds pointer to userspace buffer with transmit data, or null. 
-     *       If no data is provided, zeroes are shifted out. 
-     *  @rx_buf: Holds pointer to userspace buffer for receive data, or null. 
-     *  @len: Length of tx and rx buffers, in bytes. 
-     *  @speed_hz: Temporary override of the device's bitrate. 
-     *  @bits_per_word: Temporary override of the device's wordsize. 
-     *  @delay_usecs: If nonzero, how long to delay after the last bit transfer 
-     *       before optionally deselecting the device before the next transfer. 
-     *  @cs_change: True to deselect device before starting the next transfer. 
-     */
-    struct spi_ioc_transfer xfer[len];
-    memset( &xfer, 0, sizeof xfer );
 
-    int j;
-    for (j=0;j < len; ++j){
-        xfer[j].tx_buf = (unsigned long) (cmd +j);
-        xfer[j].rx_buf = (unsigned long) (dat +j);
-        xfer[j].len = 1;
-        xfer[j].speed_hz = PSX_SPI_SPEED;
-        xfer[j].bits_per_word = PSX_SPI_BITS_PER_WORD;
-        xfer[j].delay_usecs = PSX_SPI_BYTE_XFR_DELAY;
-        xfer[j].cs_change = 0;
-    }
-
-    /* print_xfr( xfer ); */
-
-    int status;
-
-    if ( lsb_first ){
-        /* printf("lsb trans cmd\n"); */
-        reverseBitsInArray(cmd, len);  // soft reverse bit order
-    }
-    status = ioctl(fd, SPI_IOC_MESSAGE(len), xfer);
-
-    /* status = write(fd, cmd, len); */
-
-    if (status < 0) {
-        perror("SPI_IOC_MESSAGE");
-    }
-    
-    // soft reverse bit order rx
-    if (lsb_first) {
-        /* printf("lsb trans dat\n"); */
-        reverseBitsInArray(dat, len);
+/* Double the spidev clock as long as the test reads come back clean.
+ * hw, if the transfers go byte by byte on /ACK, sends with its own copy
+ * of the clock, which has to follow each step. */
+static void tune_spidev( struct psx_spidev *s, struct psx_ack_hw *hw, struct psx_engine *e ){
+    uint32_t good = s->speed, hz;
+
+    for (hz = good * 2; hz <= PSX_SPI_SPEED_MAX; hz *= 2) {
+        if (psx_spidev_set_speed(s, hz) < 0)
+            break;
+        if (hw)
+            hw->speed_hz = hz;
+        if (psx_link_clean(e) != 1)
+            break;
+        good = hz;
     }
+    psx_spidev_set_speed(s, good);
+    if (hw)
+        hw->speed_hz = good;
+    printf("link: SPI %u Hz\n", good);
 }
 
-static int psx_get_id( const char* spi_device ){
-    /* This command is supported only by original Sony memory cards.
-     * Not sure if all sony cards are responding with the same values,
-     * and what meaning they have,
-     * might be number of sectors (0400h) and sector size (0080h) or whatever.
-     */
-    uint8_t cmd[] = {
-        /* Send Reply Comment*/
-        0x81 ,// N/A   Memory Card Access (unlike 01h=Controller access), dummy response
-        0x53 ,// FLAG  Send Get ID Command (ASCII "S"), Receive FLAG Byte
-        0x00 ,// 5Ah   Receive Memory Card ID1
-        0x00 ,// 5Dh   Receive Memory Card ID2
-        0x00 ,// 5Ch   Receive Command Acknowledge 1
-        0x00 ,// 5Dh   Receive Command Acknowledge 2
-        0x00 ,// 04h   Receive 04h
-        0x00 ,// 00h   Receive 00h
-        0x00 ,// 00h   Receive 00h
-        0x00  // 80h   Receive 80h
-    };
-    uint8_t dat[ARRAY_SIZE(cmd)] = {0, };
-    int ret = 0;
-    int fd;
-
-    memset(dat, 0xff, ARRAY_SIZE(cmd));     // DEBUG
-
-    fd = open(spi_device, O_RDWR);
-    if (fd < 0)
-        pabort("psx_get_id() can't open device");
-
-    psx_spi_setup(fd);
-    spi_dump_stat(fd);
-    psx_spi_do_msg(fd, cmd, dat, ARRAY_SIZE(cmd) );
-
-    close(fd);
-
-    printf("PSX get id\n");
-    print_buffer(dat, ARRAY_SIZE(dat) );
-    return ret;
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-v] [-D device] [-s hz] [-b frames] [-a] [-g gpiochip] [-T hdr,addr,data]\n"
+           "          [-S image] [-P tty] [-B baud] [-Z] [-N] [-t trace.json]\n"
+           "          dump FILE | id | read SECTOR | scope\n"
+           "  -s     SPI clock of spidev in Hz, default %d\n"
+           "  -b     frames per transfer, 1..%d\n"
+           "  -a     transfer byte by byte on /ACK (GPIO%d) instead of fixed delays,\n"
+           "         with -P print the /ACK statistics of the Arduino reader\n"
+           "  -g     gpio chip of /ACK, default %s\n"
+           "  -T     /ACK timeouts per phase in usec, default %d,%d,%d,\n"
+           "         with -P set in the Arduino reader\n"
+           "  -S     simulate a card holding a .mcr image, implies -a\n"
+           "  -P     use the Arduino reader on a serial port instead of spidev\n"
+           "  -B     baud rate of the Arduino reader, default %d\n"
+           "  -Z     ask the Arduino reader for compressed frames\n"
+           "  -N     step the link up to the fastest setting that reads clean:\n"
+           "         SPI clock and baud of the Arduino reader, or the spidev clock\n"
+           "  -t     record a timeline of the transfers, Chrome trace event JSON\n"
+           "  dump   read the whole card into a .mcr image\n"
+           "  id     get memory card id (Sony cards only)\n"
+           "  read   read and print one sector (0..3FFh)\n"
+           "  scope  read block 0 until interrupted, for wave pattern scope\n",
+           prog, PSX_SPI_SPEED, PSX_BATCH_MAX, PSX_ACK, PSX_GPIO_CHIP,
+           PSX_ACK_TIMEOUT_HDR, PSX_ACK_TIMEOUT_ADDR, PSX_ACK_TIMEOUT_DATA,
+           PSX_SERIAL_BAUD);
+    exit(1);
 }
 
-static int psx_read( const char* spi_device, unsigned long addr, unsigned long read_len ){
-    unsigned long len = read_len + 12;
-    uint8_t LSB = 0xFF & addr;
-    uint8_t MSB = 0xFF & (addr >> 8);
-    uint8_t *cmd = calloc( len, sizeof (uint8_t) );
-    uint8_t *dat= calloc( len, sizeof (uint8_t) );
-    /* Send Reply Comment */
-    cmd[0] = 0x81; // N/A   Memory Card Access (unlike 01h=Controller access), dummy response
-    cmd[1] = 0x52; // FLAG  Send Read Command (ASCII "R"), Receive FLAG Byte
-    cmd[2] = 0x00; // 5Ah   Receive Memory Card ID1
-    cmd[3] = 0x00; // 5Dh   Receive Memory Card ID2
-    cmd[4] = MSB ; // (00h) Send Address MSB  ;\sector number (0..3FFh)
-    cmd[5] = LSB ; // (pre) Send Address LSB  ;/
-    /* [6]   0x00     5Ch   Receive Command Acknowledge 1  ;<-- late /ACK after this byte-pair */
-    /* [7]   0x00     5Dh   Receive Command Acknowledge 2 */
-    /* [8]   0x00     MSB   Receive Confirmed Address MSB */
-    /* [9]   0x00     LSB   Receive Confirmed Address LSB */
-    /* [10]   0x00    ...   Receive Data Sector (128 bytes) |)}># */
-    /* [len-2]   0x00 CHK   Receive Checksum (MSB xor LSB xor Data bytes) */
-    /* [len-1]   0x00 47h   Receive Memory End Byte (should be always 47h="G"=Good for Read) */
-    /* Non-sony cards additionally send eight 5Ch bytes after the end flag. */
-    /* When sending an invalid sector number, 
-     * original Sony memory cards respond with FFFFh as Confirmed Address 
-     * (and do then abort the transfer without sending any data, checksum, or end flag), 
-     * third-party memory cards typically respond with the sector number ANDed with 3FFh
-     * (and transfer the data for that adjusted sector number).
-     */
+int main(int argc, char *argv[])
+{
+    static struct psx_spidev spi;
+    static struct psx_serial serial;
+    static struct psx_sim sim;
+    static struct psx_ack ack;
+    struct psx_ack_hw hw;
+    struct psx_ack_io io;
+    struct psx_transport t;
+    struct psx_engine e;
+    const char *gpiochip = PSX_GPIO_CHIP;
+    const char *sim_image = NULL;
+    const char *tty = NULL;
+    const char *trace = NULL;
+    unsigned int timeout[PSX_PHASE_COUNT] = {
+        PSX_ACK_TIMEOUT_HDR, PSX_ACK_TIMEOUT_ADDR, PSX_ACK_TIMEOUT_DATA
+    };
+    int baud = PSX_SERIAL_BAUD;
+    int batch = PSX_BATCH_MAX;
+    int verbose = 0;
+    int use_ack = 0;
+    int use_hw = 0;
+    int rle = 0;
+    int tune = 0;
+    int set_timeout = 0;
+    uint32_t spi_hz = 0;
     int ret = 0;
-    int fd;
-
-    memset(dat, 0xff, len);     // DEBUG
-
-    fd = open(spi_device, O_RDWR);
-    if (fd < 0)
-        pabort("psx_get_id() can't open device");
-
-    psx_spi_setup(fd);
-    spi_dump_stat(fd);
-    psx_spi_do_msg(fd, cmd, dat, len );
-
-    close(fd);
-
-
-    printf("psx_read() at 0x%lx, len %ld\n", addr, read_len);
-    print_buffer(dat, len);
-
-    // MSB xor LSB xor DATA
-    uint8_t chk = MSB ^ LSB;
-    int i;
-    for (i = 0 ; i < read_len; ++i  ){
-        chk ^=  dat[10 + i];
+    int c, i;
+
+    while ((c = getopt(argc, argv, "vD:s:b:ag:T:S:P:B:ZNt:")) != -1) {
+        switch (c) {
+        case 'v':
+            verbose = 1;
+            break;
+        case 'D':
+            device = optarg;
+            break;
+        case 's':
+            spi_hz = strtoul(optarg, NULL, 0);
+            if (!spi_hz)
+                usage(argv[0]);
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            if (batch < 1 || batch > PSX_BATCH_MAX)
+                usage(argv[0]);
+            break;
+        case 'a':
+            use_ack = 1;
+            break;
+        case 'g':
+            gpiochip = optarg;
+            break;
+        case 'T':
+            if (sscanf(optarg, "%u,%u,%u", &timeout[PSX_PHASE_HDR],
+                       &timeout[PSX_PHASE_ADDR], &timeout[PSX_PHASE_DATA]) != 3)
+                usage(argv[0]);
+            set_timeout = 1;
+            break;
+        case 'S':
+            sim_image = optarg;
+            use_ack = 1;
+            break;
+        case 'P':
+            tty = optarg;
+            break;
+        case 'B':
+            baud = atoi(optarg);
+            break;
+        case 'Z':
+            rle = 1;
+            break;
+        case 'N':
+            tune = 1;
+            break;
+        case 't':
+            trace = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
     }
-    printf("checksum %x, returned %x\n", chk, dat[len-2]);
-
-    return ret;
-}
-
-static int psx_read_frame( const char* spi_device, unsigned long block, unsigned long frame){
-    /* block 0 - 15 , each 8KB*/
-    /* frame 0 - 63 , each 128 B */ 
-    if ( ! (block < 16) ){
-        printf("psx_read_frame() not a block No. : %ld", block);
-        abort();
+    if (optind >= argc)
+        usage(argv[0]);
+    if (trace)
+        psx_trace_on = 1;
+
+    if (tty) {
+        if (psx_serial_open(&serial, tty, baud) < 0)
+            return 1;
+        if (rle && psx_serial_set_mode(&serial, PSX_MODE_RLE) != PSX_MODE_RLE)
+            fprintf(stderr, "%s: reader cannot compress frames\n", tty);
+        for (i = 0; i < PSX_PHASE_COUNT && set_timeout; ++i) {
+            if (psx_serial_set_ack_timeout(&serial, i, timeout[i]) != 0) {
+                fprintf(stderr, "%s: reader cannot set the /ACK timeouts\n", tty);
+                break;
+            }
+        }
+        psx_serial_transport(&serial, &t);
+    } else if (sim_image) {
+        psx_sim_init(&sim);
+        if (psx_sim_load(&sim, sim_image) < 0)
+            pabort(sim_image);
+        psx_sim_io(&sim, &io);
+    } else {
+        if (psx_spidev_open(&spi, device) < 0)
+            pabort("can't open device");
+        if (spi_hz && psx_spidev_set_speed(&spi, spi_hz) < 0)
+            pabort("can't set SPI clock");
+        psx_spidev_transport(&spi, &t);
+        if (use_ack) {
+            if (psx_ack_hw_open(&hw, spi.fd, spi.speed, spi.lsb_first, gpiochip, PSX_ACK) < 0)
+                pabort("can't watch /ACK");
+            psx_ack_hw_io(&hw, &io);
+            use_hw = 1;
+        }
     }
-
-    if ( ! (frame < 64) ){
-        printf("psx_read_frame() not a frame No. : %ld", frame);
-        abort();
+    if (use_ack && !tty) {
+        psx_ack_init(&ack, &io);
+        for (i = 0; i < PSX_PHASE_COUNT; ++i)
+            ack.timeout_us[i] = timeout[i];
+        psx_ack_transport(&ack, &t);
+    }
+    psx_engine_init(&e, &t);
+    if (batch < e.batch)
+        e.batch = batch;
+    e.verbose = verbose;
+    e.progress = 1;
+
+    if (tune && tty) {
+        if (tune_serial(&serial, &e) < 0) {
+            t.close(t.ctx);
+            return 1;
+        }
+    } else if (tune && !sim_image) {
+        tune_spidev(&spi, use_hw ? &hw : NULL, &e);
     }
 
-    printf("psx_read_frame() block %ld, frame %ld\n", block, frame);
-    psx_read( spi_device, block * 8 * 1024 + frame * 128, 128 );
-}
-
-int main(int argc, char *argv[])
-{
-    int ret = 0;
-
-    /* ret = psx_get_id( device ) ; */
-    /* ret = psx_read( device, 0x00, 16) ; */
-    // for wave pattern scope
-    while(1) {
-        /* ret = psx_read_frame( device, 0, f) ; */
-        /* ret = psx_get_id( device ) ; */
-        int f = 0;
-        for ( f = 0; f < 64; ++f) {
-            ret = psx_read_frame( device, 0, f) ;
+    if (!strcmp(argv[optind], "dump") && optind + 1 < argc) {
+        ret = psx_dump(&e, argv[optind + 1]);
+    } else if (!strcmp(argv[optind], "id")) {
+        uint8_t dat[10];
+        memset(dat, 0xff, sizeof dat);
+        ret = psx_get_id(&e, dat);
+        printf("PSX get id\n");
+        psx_print_buffer(dat, sizeof dat);
+    } else if (!strcmp(argv[optind], "read") && optind + 1 < argc) {
+        uint8_t data[PSX_FRAME_SIZE];
+        e.verbose = 1;
+        ret = psx_read_sector(&e, strtoul(argv[optind + 1], NULL, 0), data);
+        printf("psx_read_sector() %d\n", ret);
+    } else if (!strcmp(argv[optind], "scope")) {
+        // for wave pattern scope, Ctrl-C still prints stats and the trace
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        while (!stop) {
+            int f = 0;
+            for ( f = 0; f < 64 && !stop; ++f) {
+                ret = psx_read_frame(&e, 0, f, NULL) ;
+            }
         }
+    } else {
+        usage(argv[0]);
     }
 
-    return ret;
+    if (use_ack && tty) {
+        // the reader keeps its own, since its reset on open
+        if (psx_serial_ack_stats(&serial, &ack, 0) == 0)
+            psx_ack_print_stats(&ack);
+        else
+            fprintf(stderr, "%s: no /ACK statistics from the reader\n", tty);
+    } else if (use_ack) {
+        psx_ack_print_stats(&ack);
+    }
+    t.close(t.ctx);
+    if (use_hw) {
+        psx_ack_hw_close(&hw);
+        psx_spidev_close(&spi);
+    }
+    if (trace) {
+        psx_trace_on = 0;
+        if (psx_trace_write(trace) < 0)
+            ret = 1;
+    }
+    return ret ? 1 : 0;
 }